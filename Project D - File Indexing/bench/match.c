@@ -0,0 +1,135 @@
+// Microbenchmark of the namepart substring kernels against the original isSubstring().
+// usage: match [directory]  - names are read from directory or generated when it is missing
+#define MOLE_LIBRARY
+#include "../mole.c"
+
+#define BENCH_NAMES 200000  // names in a generated corpus
+#define BENCH_ROUNDS 20     // passes over the corpus for each measurement
+
+typedef struct corpus_t
+{
+    char* names;            // names separated by '\0', followed by MATCH_PAD bytes
+    size_t* offsets;
+    size_t* lengths;
+    size_t count, cap, size, capsize;
+} corpus_t;
+
+bool isSubstring(const char* sub, const char* str) // the original implementation, as the baseline
+{
+    int sublength = strlen(sub);
+    int strlength = strlen(str);
+    
+    for (int i = 0; i+sublength <= strlength; i++) 
+    {
+        if ( strncmp(sub, str+i, sublength) == 0 ) return true;
+    }
+    
+    return false;
+}
+void addName(corpus_t* corpus, const char* name)
+{
+    size_t length = strlen(name);
+    
+    if (corpus->count == corpus->cap)
+    {
+        corpus->cap = corpus->cap ? 2 * corpus->cap : 4096;
+        if ((corpus->offsets = (size_t*) realloc(corpus->offsets, corpus->cap * sizeof(size_t))) == NULL) ERR("realloc");
+        if ((corpus->lengths = (size_t*) realloc(corpus->lengths, corpus->cap * sizeof(size_t))) == NULL) ERR("realloc");
+    }
+    while (corpus->size + length + 1 + MATCH_PAD > corpus->capsize)
+    {
+        corpus->capsize = corpus->capsize ? 2 * corpus->capsize : 65536;
+        if ((corpus->names = (char*) realloc(corpus->names, corpus->capsize)) == NULL) ERR("realloc");
+    }
+    
+    memcpy(corpus->names + corpus->size, name, length + 1);
+    memset(corpus->names + corpus->size + length + 1, 0, MATCH_PAD);
+    corpus->offsets[corpus->count] = corpus->size;
+    corpus->lengths[corpus->count++] = length;
+    corpus->size += length + 1;
+}
+void readNames(corpus_t* corpus, const char* path, int depth)
+{
+    DIR* dirp;
+    struct dirent* dp;
+    char child[MAX_PATH];
+    
+    if (depth > 32 || (dirp = opendir(path)) == NULL) return;
+    while ((dp = readdir(dirp)) != NULL)
+    {
+        if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0) continue;
+        addName(corpus, dp->d_name);
+        if (dp->d_type == DT_DIR && snprintf(child, MAX_PATH, "%s/%s", path, dp->d_name) < MAX_PATH) readNames(corpus, child, depth + 1);
+    }
+    closedir(dirp);
+}
+void generateNames(corpus_t* corpus) // names in the style of photos, downloads, documents and sources
+{
+    const char* stems[] = {"IMG_", "DSC", "Screenshot from 2023-", "report-final-v", "invoice_", "backup-", "node_modules", "libfoo.so.", "README", "thumbnail_"};
+    const char* suffixes[] = {".jpg", ".JPG", ".png", ".tar.gz", ".zip", ".pdf", ".c", ".h", ".docx", ""};
+    char name[MAX_FILE];
+    unsigned seed = 12345;
+    
+    for (int i = 0; i < BENCH_NAMES; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        snprintf(name, MAX_FILE, "%s%u%s", stems[(seed >> 8) % 10], (seed >> 4) % 100000, suffixes[(seed >> 20) % 10]);
+        addName(corpus, name);
+    }
+}
+double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+void measure(const corpus_t* corpus, const char* label, const char* part, bool fold, bool (*match)(const matcher_t*, const char*, size_t))
+{
+    matcher_t matcher;
+    long matches = 0;
+    double start;
+    
+    initMatcher(&matcher, part, fold);
+    start = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++)
+        for (size_t i = 0; i < corpus->count; i++)
+        {
+            const char* name = corpus->names + corpus->offsets[i];
+            matches += match == NULL ? isSubstring(part, name) : match(&matcher, name, corpus->lengths[i]);
+        }
+    
+    printf("%-12s %-8s %-3s %10ld %10.2f\n", part, label, fold ? "-i" : "", matches / BENCH_ROUNDS, (now() - start) * 1e9 / BENCH_ROUNDS / corpus->count);
+}
+int main(int argc, char** argv)
+{
+    corpus_t corpus = {0};
+    const char* parts[] = {"e", "IMG", ".jpg", "final", "2023-05", "node_modules", "zzzz"};
+    struct { const char* label; bool (*match)(const matcher_t*, const char*, size_t); } kernels[] = {
+        {"scalar", matchScalar},
+#if HAVE_X86
+        {"sse4.2", __builtin_cpu_supports("sse4.2") ? matchSse : NULL},
+        {"avx2", __builtin_cpu_supports("avx2") ? matchAvx2 : NULL},
+#endif
+    };
+    
+    if (argc > 1) readNames(&corpus, argv[1], 0);
+    else generateNames(&corpus);
+    printf("%lu names, %lu bytes, %d rounds\n", corpus.count, corpus.size, BENCH_ROUNDS);
+    printf("%-12s %-8s %-3s %10s %10s\n", "part", "kernel", "", "matches", "ns/name");
+    
+    for (int p = 0; p < sizeof(parts) / sizeof(parts[0]); p++)
+    {
+        measure(&corpus, "original", parts[p], false, NULL);
+        for (int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        {
+            if (kernels[k].match == NULL) continue;
+            measure(&corpus, kernels[k].label, parts[p], false, kernels[k].match);
+            measure(&corpus, kernels[k].label, parts[p], true, kernels[k].match);
+        }
+    }
+    
+    free(corpus.names);
+    free(corpus.offsets);
+    free(corpus.lengths);
+    return EXIT_SUCCESS;
+}
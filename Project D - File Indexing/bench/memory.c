@@ -0,0 +1,139 @@
+// Peak memory of indexing a generated tree with indexDir(), with the -m budget against one that never spills.
+// usage: memory [files [budget]]  - a tree of files in directories of BENCH_FANOUT, generated in a scratch directory
+//   every size is indexed twice: without a signature cache, and again with the cache the first indexing wrote
+#define MOLE_LIBRARY
+#include "../mole.c"
+#include <ftw.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_FILES 1000000         // largest tree indexed, the smaller ones are halves of it
+#define BENCH_FANOUT 1000           // files in each generated directory
+#define BENCH_SIZES 4               // trees indexed, each half of the next
+#define BENCH_BUDGET (16UL << 20)   // budget small enough that the largest index spills
+#define BENCH_UNBOUNDED (1UL << 40) // budget so large nothing is ever spilled
+
+unsigned int seed = 42;
+
+double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+void makeFiles(const char* path, uint64_t files) // a quarter of them jpeg, the others plain text that is not indexed
+{
+    char name[MAX_PATH];
+    int fd;
+
+    if (mkdir(path, 0755)) ERR("mkdir");
+    for (uint64_t id = 0; id < files; id++)
+    {
+        seed = seed * 1103515245 + 12345;
+        if (id % BENCH_FANOUT == 0)
+        {
+            snprintf(name, MAX_PATH, "%s/d%06lu", path, id / BENCH_FANOUT);
+            if (mkdir(name, 0755)) ERR("mkdir");
+        }
+        snprintf(name, MAX_PATH, "%s/d%06lu/file-%lu.%s", path, id / BENCH_FANOUT, id, (seed >> 8) % 4 ? "txt" : "jpeg");
+        if ((fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) ERR("open");
+        if ((seed >> 8) % 4 ? write(fd, "plain text\n", 11) != 11 : write(fd, "\xff\xd8\xff\xe0", 4) != 4) ERR("write");
+        if (close(fd)) ERR("close");
+    }
+}
+void makeTree(const char* path, uint64_t files, int sizes) // half of the files in path/part, the other half in path/rest the same way
+{
+    char sub[MAX_PATH];
+    uint64_t here = sizes > 1 ? files / 2 : files;
+
+    if (mkdir(path, 0755)) ERR("mkdir");
+    snprintf(sub, MAX_PATH, "%s/part", path);
+    makeFiles(sub, here);
+    snprintf(sub, MAX_PATH, "%s/rest", path);
+    if (sizes > 1) makeTree(sub, files - here, sizes - 1);
+}
+int removeEntry(const char* path, const struct stat* s, int flag, struct FTW* ftw)
+{
+    if (remove(path)) ERR("remove");
+    return 0;
+}
+void removeIndex(void) // with its cache and secondary indexes
+{
+    unlink("bench.idx");
+    unlink("bench.idx" CACHE_SUFFIX);
+    unlink("bench.idx" SIZE_SUFFIX);
+    unlink("bench.idx" OWNER_SUFFIX);
+    unlink("bench.idx" TRIGRAM_SUFFIX);
+    unlink("bench.idx" METRICS_SUFFIX);
+}
+void measure(const char* tree, uint64_t budget, double* seconds, long* peak) // in a child, so each peak starts from nothing
+{
+    struct rusage usage;
+    double start = now();
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    if ((pid = fork()) < 0) ERR("fork");
+    if (pid == 0)
+    {
+        memoryBudget = budget;
+        indexDir(tree, "bench.idx", sysconf(_SC_NPROCESSORS_ONLN));
+        exit(EXIT_SUCCESS);
+    }
+    if (wait4(pid, &status, 0, &usage) < 0) ERR("wait4");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) ERR("child");
+
+    *seconds = now() - start;
+    *peak = usage.ru_maxrss / 1024;
+}
+int main(int argc, char** argv)
+{
+    uint64_t files = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_FILES;
+    uint64_t budget = BENCH_BUDGET, budgets[2] = { 0, BENCH_UNBOUNDED };
+    char scratch[] = "/tmp/mole-memory-XXXXXX", tree[MAX_PATH];
+    double start;
+
+    if (argc > 2 && !parseSize(argv[2], &budget)) ERR("budget");
+    budgets[0] = budget;
+
+    if (mkdtemp(scratch) == NULL) ERR("mkdtemp");
+    if (chdir(scratch)) ERR("chdir");
+    snprintf(tree, MAX_PATH, "%s/tree", scratch);
+
+    start = now();
+    makeTree(tree, files, BENCH_SIZES);
+    printf("budget %lu MB, %lu files in directories of %d in %s, generated in %.2f s\n", budget >> 20, files, BENCH_FANOUT, tree, now() - start);
+    printf("%10s %12s %10s %10s %10s %10s\n", "files", "memory", "full s", "peak MB", "cached s", "peak MB");
+
+    // peak with the budget should stay flat as the tree grows, without it it grows with the tree;
+    // the smallest tree is the deepest rest, each level up doubles it
+    for (int level = BENCH_SIZES - 1; level >= 0; level--)
+    {
+        char path[MAX_PATH];
+        uint64_t n = files;
+
+        snprintf(path, MAX_PATH, "%s", tree);
+        for (int i = 0; i < level; i++)
+        {
+            strcat(path, "/rest");
+            n -= n / 2;
+        }
+        for (int b = 0; b < 2; b++)
+        {
+            double seconds[2];
+            long peak[2];
+
+            removeIndex();
+            measure(path, budgets[b], &seconds[0], &peak[0]);
+            measure(path, budgets[b], &seconds[1], &peak[1]);
+            printf("%10lu %12s %10.2f %10ld %10.2f %10ld\n", n, budgets[b] == BENCH_UNBOUNDED ? "unbounded" : "budget", seconds[0], peak[0], seconds[1], peak[1]);
+        }
+    }
+
+    removeIndex();
+    if (nftw(tree, removeEntry, 64, FTW_DEPTH | FTW_PHYS)) ERR("nftw");
+    if (chdir("/")) ERR("chdir");
+    rmdir(scratch);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+// Microbenchmark of the signature trie against comparing every signature in turn.
+// usage: sniff  - headers are generated from the first signatures of FILE_TYPES and random bytes
+#define MOLE_LIBRARY
+#include "../mole.c"
+
+#define BENCH_HEADERS 2000  // headers in a generated corpus, half of them match a signature - small enough to stay in cache like a batch just read
+#define BENCH_ROUNDS 200    // passes over the corpus for each measurement
+#define BENCH_TYPED 5       // signatures stamped into the corpus, those of the original types
+
+enum ftype linearType(const tpattern_t* patterns, int count, const unsigned char* sig, ssize_t length) // the longest signature, one by one
+{
+    int best = -1;
+    
+    for (int p = 0; p < count; p++)
+    {
+        int b = 0;
+        while (b < patterns[p].count && patterns[p].pos[b] < length && sig[patterns[p].pos[b]] == patterns[p].byte[b]) b++;
+        if (b == patterns[p].count && (best < 0 || patterns[p].count > patterns[best].count)) best = p;
+    }
+    
+    return best < 0 ? other : patterns[best].type;
+}
+double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+void generateHeaders(unsigned char* headers, const tpattern_t* patterns, int count)
+{
+    unsigned int seed = 42;
+    
+    for (int h = 0; h < BENCH_HEADERS; h++)
+    {
+        unsigned char* sig = headers + (size_t)h * SIG_LENGTH;
+        for (int i = 0; i < SIG_LENGTH; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            sig[i] = seed >> 16;
+        }
+        if (h % 2) continue;
+        
+        seed = seed * 1103515245 + 12345;
+        const tpattern_t* pattern = &patterns[(seed >> 8) % count];
+        for (int b = 0; b < pattern->count; b++) sig[pattern->pos[b]] = pattern->byte[b];
+    }
+}
+void measure(const unsigned char* headers, const tpattern_t* patterns, int count) // the same corpus against a growing registry
+{
+    typetrie_t trie;
+    long typed[2] = {0}, differ = 0;
+    double start, elapsed[2];
+    
+    buildTrie(&trie, patterns, count);
+    
+    for (int kernel = 0; kernel < 2; kernel++)
+    {
+        start = now();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+            for (int h = 0; h < BENCH_HEADERS; h++)
+            {
+                const unsigned char* sig = headers + (size_t)h * SIG_LENGTH;
+                enum ftype type = kernel ? trieType(&trie, sig, SIG_LENGTH) : linearType(patterns, count, sig, SIG_LENGTH);
+                typed[kernel] += type != other;
+            }
+        elapsed[kernel] = (now() - start) * 1e9 / BENCH_ROUNDS / BENCH_HEADERS;
+    }
+    
+    // both must find the same types, or the numbers mean nothing
+    for (int h = 0; h < BENCH_HEADERS; h++)
+    {
+        const unsigned char* sig = headers + (size_t)h * SIG_LENGTH;
+        differ += trieType(&trie, sig, SIG_LENGTH) != linearType(patterns, count, sig, SIG_LENGTH);
+    }
+    
+    printf("%10d %8u %10ld %10.2f %10.2f %8ld\n", count, trie.nnodes, typed[1] / BENCH_ROUNDS, elapsed[0], elapsed[1], differ);
+    freeTrie(&trie);
+}
+int main(int argc, char** argv)
+{
+#define X(type, text, indexed, signature) signature,
+    const char* signatures[TYPE_COUNT] = { FILE_TYPES };
+#undef X
+    tpattern_t patterns[MAX_SIGNATURES];
+    int count = 0;
+    unsigned char* headers;
+    
+    for (int type = 0; type < TYPE_COUNT; type++) addSignatures(patterns, &count, type, signatures[type]);
+    if ((headers = (unsigned char*) malloc((size_t)BENCH_HEADERS * SIG_LENGTH)) == NULL) ERR("malloc");
+    generateHeaders(headers, patterns, BENCH_TYPED);
+    
+    printf("%d headers of %d bytes, %d rounds\n", BENCH_HEADERS, SIG_LENGTH, BENCH_ROUNDS);
+    printf("%10s %8s %10s %10s %10s %8s\n", "signatures", "nodes", "typed", "linear ns", "trie ns", "differ");
+    
+    // the first signatures of the registry, then all of them - the trie should stay flat, the linear scan grows
+    for (int k = BENCH_TYPED; k < count; k *= 2) measure(headers, patterns, k);
+    measure(headers, patterns, count);
+    
+    free(headers);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,326 @@
+// Times a full indexing, an incremental indexing and every query command of a tree, made with bench/tree for one.
+// usage: suite [-r runs] [-j threads] [-c percent] [-o csv|json] [-b baseline.csv] tree
+//   the incremental indexing runs after percent of the files got a new mtime, so only they are read again,
+//   partial count is timed while a full indexing runs in another thread,
+//   the median of the runs is compared with the same benchmark of a baseline written by an earlier -o csv
+#define MOLE_LIBRARY
+#include "../mole.c"
+#include <ftw.h>
+
+#define SUITE_RUNS 5
+#define SUITE_TOUCHED 1         // percent of the files modified before an incremental indexing
+#define SUITE_RESULTS 32
+#define SUITE_LINE 256
+#define SUITE_BUILDS 8          // indexings started at most to time partial count during them
+
+typedef struct result_t
+{
+    char name[SUITE_LINE];      // the same for every tree, so that runs can be compared
+    uint64_t records;           // in the index
+    double min, median, max;    // s
+    double baseline;            // median of the baseline, 0 if it has none
+} result_t;
+
+// the commands timed, %s is the tree
+const char* commands[][2] =
+{
+    { "count",              "count\n" },
+    { "count path",         "count %s\n" },
+    { "stats",              "stats\n" },
+    { "du",                 "du\n" },
+    { "du path",            "du %s\n" },
+    { "listall",            "listall\n" },
+    { "largerthan",         "largerthan 100000\n" },
+    { "namepart",           "namepart file00\n" },
+    { "namepart -i",        "namepart -i FILE00\n" },
+    { "owner",              "owner %s\n" },
+    { "query",              "query type jpg and size > 100K or name zip\n" },
+    { "query path",         "query path %s and type png\n" },
+    { "top",                "top 20\n" },
+    { "sum size by owner",  "sum size by owner\n" },
+    { "sum size by type",   "sum size by type\n" },
+    { "sum size by dir",    "sum size by dir\n" },
+    { "histogram size",     "histogram size\n" }
+};
+typedef struct build_t
+{
+    const char* tree;
+    const char* pathf;
+    int nthreads;
+    bool done;                  // set once indexDir() returned
+} build_t;
+
+result_t results[SUITE_RESULTS];
+int nresults = 0;
+char** files = NULL;            // regular files of the tree, for the incremental indexing
+uint64_t nfiles = 0, capfiles = 0;
+
+double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+void suiteUsage(void)
+{
+    fprintf(stderr, "usage: suite [-r runs] [-j threads] [-c percent] [-o csv|json] [-b baseline.csv] tree\n");
+    exit(EXIT_FAILURE);
+}
+int compareTimes(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+result_t* addResult(const char* name, double* times, int runs, uint64_t records)
+{
+    result_t* result = &results[nresults++];
+
+    qsort(times, runs, sizeof(double), compareTimes);
+    snprintf(result->name, SUITE_LINE, "%s", name);
+    result->records = records;
+    result->min = times[0];
+    result->median = runs % 2 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    result->max = times[runs - 1];
+    result->baseline = 0;
+    fprintf(stderr, "%-20s %10.6f s\n", name, result->median);
+    return result;
+}
+int addFile(const char* path, const struct stat* s, int flag, struct FTW* ftw)
+{
+    if (flag != FTW_F || !S_ISREG(s->st_mode)) return 0;
+    if (nfiles == capfiles)
+    {
+        capfiles = capfiles ? 2 * capfiles : 4096;
+        if ((files = (char**) realloc(files, capfiles * sizeof(char*))) == NULL) ERR("realloc");
+    }
+    if ((files[nfiles++] = strdup(path)) == NULL) ERR("strdup");
+    return 0;
+}
+void touchFiles(int percent) // new mtime for every 100/percent-th file, the signature cache no longer matches them
+{
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { 0, 0 } };
+
+    if (percent <= 0) return;
+    clock_gettime(CLOCK_REALTIME, &times[1]);
+    for (uint64_t i = 0; i < nfiles; i += 100 / percent)
+        if (utimensat(AT_FDCWD, files[i], times, 0)) ERR("utimensat");
+}
+void removeIndex(const char* pathf) // with its cache and secondary indexes
+{
+    const char* suffixes[] = { SIZE_SUFFIX, OWNER_SUFFIX, TRIGRAM_SUFFIX, METRICS_SUFFIX, CACHE_SUFFIX };
+    char path[MAX_PATH];
+
+    unlink(pathf);
+    for (int i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+    {
+        snprintf(path, MAX_PATH, "%s%s", pathf, suffixes[i]);
+        unlink(path);
+    }
+}
+uint64_t indexRecords(const char* pathf)
+{
+    index_t index;
+    uint64_t count;
+
+    if (!openIndex(&index, pathf, MADV_NORMAL)) ERR("openIndex");
+    count = index.header->count;
+    unmapIndex(&index);
+    return count;
+}
+void timeIndexing(const char* tree, const char* pathf, int runs, int nthreads, int percent)
+{
+    double full[runs], incremental[runs];
+
+    // without a cache every signature is read, the same as a first indexing
+    for (int r = 0; r < runs; r++)
+    {
+        removeIndex(pathf);
+        double start = now();
+        indexDir(tree, pathf, nthreads);
+        full[r] = now() - start;
+    }
+    addResult("index full", full, runs, indexRecords(pathf));
+
+    // the cache of the previous indexing is there, only the touched files are read
+    for (int r = 0; r < runs; r++)
+    {
+        touchFiles(percent);
+        double start = now();
+        indexDir(tree, pathf, nthreads);
+        incremental[r] = now() - start;
+    }
+    addResult("index incremental", incremental, runs, indexRecords(pathf));
+}
+void timeQueries(const char* tree, const char* pathf, int runs)
+{
+    char buf[SUITE_LINE], owner[16];
+    double times[runs];
+    uint64_t records = indexRecords(pathf);
+    FILE* out;
+
+    if ((out = fopen("/dev/null", "w")) == NULL) ERR("fopen");
+    snprintf(owner, sizeof(owner), "%u", getuid() > 0 ? getuid() : 1); // owner 0 is refused by the command
+
+    // each run maps the index again as an interactive command does, so mapping is part of the time
+    for (int c = 0; c < sizeof(commands) / sizeof(commands[0]); c++)
+    {
+        snprintf(buf, SUITE_LINE, commands[c][1], strcmp(commands[c][0], "owner") == 0 ? owner : tree);
+        for (int r = 0; r < runs; r++)
+        {
+            index_t index;
+            double start = now();
+            if (!openIndex(&index, pathf, MADV_SEQUENTIAL)) ERR("openIndex");
+            runQuery(&index, buf, out);
+            unmapIndex(&index);
+            times[r] = now() - start;
+        }
+        addResult(commands[c][0], times, runs, records);
+    }
+
+    fclose(out);
+}
+void* buildWork(void* voidArgs) // indexes the tree while partial queries are timed
+{
+    build_t* build = voidArgs;
+    
+    indexDir(build->tree, build->pathf, build->nthreads);
+    __atomic_store_n(&build->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+bool building(void) // an indexing has published records for partial queries
+{
+    bool published;
+    
+    pthread_mutex_lock(&buildProgress.mx);
+    published = buildProgress.pathf != NULL;
+    pthread_mutex_unlock(&buildProgress.mx);
+    return published;
+}
+void timePartial(const char* tree, const char* pathf, int runs, int nthreads, double full)
+{
+    char cachePath[MAX_PATH + 16];
+    double times[runs];
+    int samples = 0;
+    FILE* out;
+    
+    if ((out = fopen("/dev/null", "w")) == NULL) ERR("fopen");
+    snprintf(cachePath, sizeof(cachePath), "%s%s", pathf, CACHE_SUFFIX);
+    
+    // without a cache the indexing is as long as a full one, the runs are spread over it
+    for (int b = 0; b < SUITE_BUILDS && samples < runs; b++)
+    {
+        build_t build = { tree, pathf, nthreads, false };
+        pthread_t tid;
+        
+        unlink(cachePath);
+        if (pthread_create(&tid, NULL, buildWork, &build)) ERR("pthread_create");
+        while (!building() && !__atomic_load_n(&build.done, __ATOMIC_ACQUIRE)) sched_yield();
+        while (samples < runs && !__atomic_load_n(&build.done, __ATOMIC_ACQUIRE))
+        {
+            index_t index;
+            double start = now(), time;
+            
+            if (!openIndex(&index, pathf, MADV_SEQUENTIAL)) ERR("openIndex");
+            runQuery(&index, "partial count\n", out);
+            unmapIndex(&index);
+            time = now() - start;
+            
+            // a run the indexing did not outlast answered from the index alone
+            if (!building()) break;
+            times[samples++] = time;
+            usleep(full / (runs + 1) * 1e6);
+        }
+        if (pthread_join(tid, NULL)) ERR("pthread_join");
+    }
+    
+    if (samples == runs) addResult("partial count", times, runs, indexRecords(pathf));
+    else fprintf(stderr, "%-20s the indexing is too short to be queried %d times\n", "partial count", runs);
+    fclose(out);
+}
+void readBaseline(const char* path) // medians of the results of an earlier run with -o csv
+{
+    char line[SUITE_LINE], name[SUITE_LINE];
+    double median;
+    FILE* in;
+
+    if ((in = fopen(path, "r")) == NULL) ERR("fopen");
+    while (fgets(line, SUITE_LINE, in) != NULL)
+    {
+        // benchmark,records,runs,min_s,median_s,max_s and maybe a comparison
+        if (sscanf(line, "%[^,],%*u,%*d,%*f,%lf", name, &median) != 2) continue;
+        for (int i = 0; i < nresults; i++)
+            if (strcmp(results[i].name, name) == 0) results[i].baseline = median;
+    }
+    fclose(in);
+}
+void printResults(bool json, int runs, bool baseline)
+{
+    if (!json)
+    {
+        printf("benchmark,records,runs,min_s,median_s,max_s%s\n", baseline ? ",baseline_median_s,change_percent" : "");
+        for (int i = 0; i < nresults; i++)
+        {
+            result_t* r = &results[i];
+            printf("%s,%lu,%d,%.6f,%.6f,%.6f", r->name, r->records, runs, r->min, r->median, r->max);
+            if (baseline && r->baseline > 0) printf(",%.6f,%+.1f", r->baseline, 100 * (r->median - r->baseline) / r->baseline);
+            else if (baseline) printf(",,");
+            printf("\n");
+        }
+        return;
+    }
+
+    printf("[\n");
+    for (int i = 0; i < nresults; i++)
+    {
+        result_t* r = &results[i];
+        printf("  {\"benchmark\": \"%s\", \"records\": %lu, \"runs\": %d, \"min_s\": %.6f, \"median_s\": %.6f, \"max_s\": %.6f",
+               r->name, r->records, runs, r->min, r->median, r->max);
+        if (baseline && r->baseline > 0) printf(", \"baseline_median_s\": %.6f, \"change_percent\": %.1f", r->baseline, 100 * (r->median - r->baseline) / r->baseline);
+        printf("}%s\n", i < nresults - 1 ? "," : "");
+    }
+    printf("]\n");
+}
+int main(int argc, char** argv)
+{
+    int runs = SUITE_RUNS, nthreads = sysconf(_SC_NPROCESSORS_ONLN), percent = SUITE_TOUCHED, c;
+    char *baseline = NULL, tree[PATH_MAX], pathf[MAX_PATH + 16];
+    char scratch[] = "/tmp/mole-suite-XXXXXX";
+    bool json = false;
+
+    while ((c = getopt(argc, argv, "r:j:c:o:b:")) != -1)
+        switch (c)
+        {
+            case 'r': runs = atoi(optarg); break;
+            case 'j': nthreads = atoi(optarg); break;
+            case 'c': percent = atoi(optarg); break;
+            case 'b': baseline = optarg; break;
+            case 'o':
+                if (strcmp(optarg, "json") == 0) json = true;
+                else if (strcmp(optarg, "csv") != 0) suiteUsage();
+                break;
+            default: suiteUsage();
+        }
+    if (optind != argc - 1 || runs < 1 || nthreads < 1 || nthreads > MAX_THREADS || percent < 0 || percent > 100) suiteUsage();
+    if (realpath(argv[optind], tree) == NULL) ERR("realpath");
+
+    // the temp files of the indexer are written to the working directory
+    if (mkdtemp(scratch) == NULL) ERR("mkdtemp");
+    if (chdir(scratch)) ERR("chdir");
+    snprintf(pathf, sizeof(pathf), "%s/bench.idx", scratch);
+    if (nftw(tree, addFile, 64, FTW_PHYS)) ERR("nftw");
+
+    fprintf(stderr, "%s: %lu files, %d runs, %d threads, warm page cache\n", tree, nfiles, runs, nthreads);
+    timeIndexing(tree, pathf, runs, nthreads, percent);
+    timeQueries(tree, pathf, runs);
+    timePartial(tree, pathf, runs, nthreads, results[0].median);
+
+    if (baseline != NULL) readBaseline(baseline);
+    printResults(json, runs, baseline != NULL);
+
+    removeIndex(pathf);
+    if (chdir("/")) ERR("chdir");
+    rmdir(scratch);
+    for (uint64_t i = 0; i < nfiles; i++) free(files[i]);
+    free(files);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+// Counts the system calls made by a command and all of its threads, a minimal strace -c.
+// usage: syscalls command [args]  - stdin and stdout are passed to the command, the counts go to stderr
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#define ERR(source) (perror(source),\
+                     fprintf(stderr,"%s:%d\n",__FILE__,__LINE__),\
+                     exit(EXIT_FAILURE))
+
+#define MAX_SYSCALL 512
+#define SHOW_TOP 12         // most frequent system calls listed by name
+
+typedef struct sysname_t
+{
+    long nr;
+    const char* name;
+} sysname_t;
+
+// the calls made by the indexer, the rest are listed by number
+const sysname_t sysnames[] =
+{
+    { SYS_read, "read" }, { SYS_write, "write" }, { SYS_openat, "openat" }, { SYS_close, "close" },
+    { SYS_newfstatat, "newfstatat" }, { SYS_fstat, "fstat" }, { SYS_lstat, "lstat" }, { SYS_stat, "stat" },
+    { SYS_statx, "statx" }, { SYS_readlink, "readlink" }, { SYS_getdents64, "getdents64" },
+    { SYS_mmap, "mmap" }, { SYS_munmap, "munmap" }, { SYS_brk, "brk" }, { SYS_futex, "futex" },
+    { SYS_lseek, "lseek" }, { SYS_pread64, "pread64" }, { SYS_rename, "rename" }, { SYS_clone3, "clone3" },
+    { SYS_sched_yield, "sched_yield" }, { SYS_madvise, "madvise" }, { SYS_mprotect, "mprotect" },
+};
+
+const char* sysName(long nr, char* buf, size_t length)
+{
+    for (size_t i = 0; i < sizeof(sysnames) / sizeof(sysname_t); i++)
+        if (sysnames[i].nr == nr) return sysnames[i].name;
+    snprintf(buf, length, "#%ld", nr);
+    return buf;
+}
+void printCounts(const long* counts)
+{
+    long total = 0;
+    char buf[32];
+    int shown[MAX_SYSCALL] = {0};
+
+    for (int i = 0; i < MAX_SYSCALL; i++) total += counts[i];
+    fprintf(stderr, "%12ld total\n", total);
+
+    for (int n = 0; n < SHOW_TOP; n++)
+    {
+        int top = -1;
+        for (int i = 0; i < MAX_SYSCALL; i++)
+            if (!shown[i] && counts[i] && (top < 0 || counts[i] > counts[top])) top = i;
+        if (top < 0) break;
+
+        shown[top] = 1;
+        fprintf(stderr, "%12ld %s\n", counts[top], sysName(top, buf, sizeof(buf)));
+    }
+}
+int main(int argc, char** argv)
+{
+    long counts[MAX_SYSCALL] = {0};
+    struct __ptrace_syscall_info info;
+    pid_t child, pid;
+    int status;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s command [args]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ((child = fork()) < 0) ERR("fork");
+    if (child == 0)
+    {
+        if (ptrace(PTRACE_TRACEME, 0, NULL, NULL)) ERR("ptrace");
+        raise(SIGSTOP); // wait until the tracer has set its options
+        execvp(argv[1], argv + 1);
+        ERR("execvp");
+    }
+
+    if (waitpid(child, &status, 0) < 0) ERR("waitpid");
+    if (ptrace(PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACECLONE|PTRACE_O_TRACEFORK|PTRACE_O_EXITKILL)) ERR("ptrace");
+    if (ptrace(PTRACE_SYSCALL, child, NULL, NULL)) ERR("ptrace");
+
+    // every thread stops at each system call entry and exit, only the entries are counted
+    while ((pid = waitpid(-1, &status, __WALL)) > 0)
+    {
+        int signal = 0;
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) continue;
+        if (WSTOPSIG(status) == (SIGTRAP|0x80))
+        {
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) < 0) ERR("ptrace");
+            if (info.op == PTRACE_SYSCALL_INFO_ENTRY && info.entry.nr < MAX_SYSCALL) counts[info.entry.nr]++;
+        }
+        else if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP) signal = WSTOPSIG(status); // pass real signals on
+
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, signal) && errno != ESRCH) ERR("ptrace");
+    }
+    if (errno != ECHILD) ERR("waitpid");
+
+    printCounts(counts);
+    return EXIT_SUCCESS;
+}
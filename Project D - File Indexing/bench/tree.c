@@ -0,0 +1,147 @@
+// Generates a synthetic directory tree to index, the same one for the same arguments.
+// usage: tree [-f fanout] [-d depth] [-n files] [-s min:max] [-m jpg=n,png=n,gzip=n,zip=n] [-r seed] dir
+//   fanout subdirectories in every directory down to depth, files spread evenly over all directories,
+//   sizes log-uniform between min and max (sparse, only the signature is written) and the given percent
+//   of each signed type, the rest plain text
+#define MOLE_LIBRARY
+#include "../mole.c"
+#include <math.h>
+
+#define TREE_FANOUT 8
+#define TREE_DEPTH 3
+#define TREE_FILES 10000
+#define TREE_MIN 512
+#define TREE_MAX (1UL << 20)
+#define TREE_KINDS 5            // signed types and plain text
+
+typedef struct tkind_t
+{
+    const char* name;           // as in FILE_TYPES and -m
+    const char* extension;
+    const char* signature;
+    size_t length;
+    int percent;
+    uint64_t files;
+} tkind_t;
+
+tkind_t kinds[TREE_KINDS] =
+{
+    { "jpg",  "jpg", "\xff\xd8\xff\xe0", 4, 10, 0 },
+    { "png",  "png", "\x89PNG\r\n\x1a\n", 8, 10, 0 },
+    { "gzip", "gz",  "\x1f\x8b\x08", 3, 10, 0 },
+    { "zip",  "zip", "PK\x03\x04", 4, 10, 0 },
+    { "text", "txt", "plain text\n", 11, 0, 0 } // takes what the others leave
+};
+unsigned int seed = 42;
+
+unsigned int nextRandom(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+void treeUsage(void)
+{
+    fprintf(stderr, "usage: tree [-f fanout] [-d depth] [-n files] [-s min:max] [-m jpg=n,png=n,gzip=n,zip=n] [-r seed] dir\n");
+    exit(EXIT_FAILURE);
+}
+void parseMix(char* text) // percent of each signed type, as jpg=10,png=5
+{
+    int total = 0;
+
+    for (char* item = strtok(text, ","); item != NULL; item = strtok(NULL, ","))
+    {
+        char* value = strchr(item, '=');
+        int k = 0;
+
+        if (value == NULL) treeUsage();
+        *value++ = '\0';
+        while (k < TREE_KINDS - 1 && strcmp(kinds[k].name, item) != 0) k++;
+        if (k == TREE_KINDS - 1) treeUsage();
+        kinds[k].percent = atoi(value);
+    }
+    for (int k = 0; k < TREE_KINDS - 1; k++) total += kinds[k].percent;
+    if (total > 100) treeUsage();
+}
+uint64_t makeDirs(const char* path, int level, int fanout, int depth, char** dirs, uint64_t ndirs) // dirs in preorder, returns their number
+{
+    char sub[MAX_PATH];
+
+    if (mkdir(path, 0755) && errno != EEXIST) ERR("mkdir");
+    if ((dirs[ndirs++] = strdup(path)) == NULL) ERR("strdup");
+    if (level == depth) return ndirs;
+
+    for (int i = 0; i < fanout; i++)
+    {
+        snprintf(sub, MAX_PATH, "%s/d%02d", path, i);
+        ndirs = makeDirs(sub, level + 1, fanout, depth, dirs, ndirs);
+    }
+    return ndirs;
+}
+uint64_t makeFile(const char* path, const tkind_t* kind, uint64_t min, uint64_t max) // returns its size
+{
+    double u = nextRandom() / (double)(1U << 24);
+    uint64_t size = exp(log(min + 1.0) + u * (log(max + 1.0) - log(min + 1.0))) - 1;
+    int fd;
+
+    // a shorter file would lose its signature and be indexed as other
+    if (size < kind->length) size = kind->length;
+
+    if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) ERR("open");
+    if (write(fd, kind->signature, kind->length) != kind->length) ERR("write");
+    if (ftruncate(fd, size)) ERR("ftruncate");
+    if (close(fd)) ERR("close");
+    return size;
+}
+int main(int argc, char** argv)
+{
+    int fanout = TREE_FANOUT, depth = TREE_DEPTH, c;
+    uint64_t files = TREE_FILES, min = TREE_MIN, max = TREE_MAX, ndirs = 1, level = 1, bytes = 0;
+    char path[MAX_PATH], *colon, **dirs;
+
+    while ((c = getopt(argc, argv, "f:d:n:s:m:r:")) != -1)
+        switch (c)
+        {
+            case 'f': fanout = atoi(optarg); break;
+            case 'd': depth = atoi(optarg); break;
+            case 'n': files = strtoull(optarg, NULL, 10); break;
+            case 'm': parseMix(optarg); break;
+            case 'r': seed = strtoul(optarg, NULL, 10); break;
+            case 's':
+                if ((colon = strchr(optarg, ':')) == NULL) treeUsage();
+                *colon = '\0';
+                if (!parseSize(optarg, &min) || !parseSize(colon + 1, &max) || min > max) treeUsage();
+                break;
+            default: treeUsage();
+        }
+    if (optind != argc - 1 || fanout < 1 || depth < 0) treeUsage();
+
+    for (int i = 0; i < depth; i++) ndirs += (level *= fanout);
+    if ((dirs = (char**) malloc(ndirs * sizeof(char*))) == NULL) ERR("malloc");
+    ndirs = makeDirs(argv[optind], 0, fanout, depth, dirs, 0);
+
+    kinds[TREE_KINDS - 1].percent = 100;
+    for (int k = 0; k < TREE_KINDS - 1; k++) kinds[TREE_KINDS - 1].percent -= kinds[k].percent;
+
+    // file i goes to directory i modulo their number, so every directory gets its share
+    for (uint64_t i = 0; i < files; i++)
+    {
+        int roll = nextRandom() % 100, k = 0;
+
+        while (k < TREE_KINDS - 1 && roll >= kinds[k].percent)
+        {
+            roll -= kinds[k].percent;
+            k++;
+        }
+        snprintf(path, MAX_PATH, "%s/file%07lu.%s", dirs[i % ndirs], i, kinds[k].extension);
+        bytes += makeFile(path, &kinds[k], min, max);
+        kinds[k].files++;
+    }
+
+    printf("%lu directories, %lu files, %lu bytes:", ndirs, files, bytes);
+    for (int k = 0; k < TREE_KINDS; k++) printf(" %s %lu", kinds[k].name, kinds[k].files);
+    printf("\n");
+
+    for (uint64_t d = 0; d < ndirs; d++) free(dirs[d]);
+    free(dirs);
+    return EXIT_SUCCESS;
+}
@@ -1,5 +1,5 @@
-#define _XOPEN_SOURCE 500
-#include <ftw.h>
+#define _GNU_SOURCE
+#include <dirent.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -10,7 +10,32 @@
 #include <errno.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <sched.h>
+#include <poll.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/mman.h>
+#include <malloc.h>
+#include <ctype.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#else
+#define HAVE_X86 0
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_URING 1
+#else
+#define HAVE_URING 0
+#endif
 
 // used to turn the debug messages on/off
 #define DEBUGMAIN 0
@@ -19,27 +44,662 @@
 #define DEBUGWRITEFILE 0
 #define DEBUGQUICKEXIT 0
 #define DEBUGSIMULATION 0
+#define DEBUGWATCH 0
+#define DEBUGSERVER 0
 
 #define MAX_PATH 1024
 #define MAX_FILE 256
-#define MAXFD 100
+#define MAX_THREADS 64
+#define DEQUE_INIT 64
+#define CACHE_SUFFIX ".cache"
+#define CACHE_MAGIC "MOLESG2"
+#define CHECKPOINT_MAGIC "MOLECKP"
+#define CHECKPOINT_FILE "./.temp-checkpoint"    // frontier and writer state of the indexing in progress
+#define CHECKPOINT_TEMP "./.temp-checkpoint-new" // written and synced before it replaces the checkpoint
+#define CHECKPOINT_INTERVAL 30 // s of indexing between checkpoints
+#define PROGRESS_INTERVAL 1    // s between flushes of the temp files for partial queries
+#define SIZE_SUFFIX ".size"   // secondary index of records sorted by size
+#define OWNER_SUFFIX ".owner" // secondary index of records by owner
+#define TRIGRAM_SUFFIX ".tri" // secondary index of records by trigrams of their names
+#define METRICS_SUFFIX ".prom" // counters in Prometheus text format, rewritten every METRICS_INTERVAL
+#define METRICS_INTERVAL 15 // s between writes of the metrics file
+#define LATENCY_BUCKETS 24  // query latencies below 2^n us, the last bucket takes the rest
+#define QUERY_COMMANDS 12   // commands whose latency is kept, as in queryNames
+#define WATCH_MASK (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_CLOSE_WRITE|IN_MODIFY|IN_ATTRIB|IN_ONLYDIR|IN_DONT_FOLLOW|IN_EXCL_UNLINK)
+#define WATCH_BUCKETS 4096
+#define WATCH_BUFFER 65536
+#define WATCH_DEBOUNCE 500  // ms without events before pending changes are applied
+#define WATCH_MAXDELAY 5    // s after which pending changes are applied even if events keep coming
+#define WATCH_COMPACT 16    // the index file is written whole once its delta changes more than 1/WATCH_COMPACT of its records
+#define WATCH_NORECORD UINT64_MAX // record of an entry the index file has no record of
+#define DELTA_SUFFIX ".delta" // records the watcher changed since it last wrote the index file whole
+#define BATCH_MAX 256       // entries of a directory written to the index together
+#define PIPE_QUEUE 64       // batches waiting between two stages of the indexing pipeline, power of 2
+#define DENTS_BUFFER 131072 // bytes of directory entries a walker reads with one getdents64()
+#define SIG_LENGTH 512      // bytes read from the start of a file to find its type, enough for every signature
+#define MAX_SIGBYTES 32     // bytes compared by one signature
+#define MAX_SIGNATURES 64   // signatures of all types together
+#define TRIE_LEAF 0xffff    // position of a trie node with nothing left to compare
+#define NO_SIGNATURE 0xff
+#define URING_ENTRIES (4 * BATCH_MAX) // submission queue of a classifier, openat+read+close for a whole batch
+#define INDEX_MAGIC "MOLEIDX"
+#define INDEX_VERSION 5
+#define INDEX_ENDIAN 0x0102 // reads as 0x0201 on a host of the other byte order
+#define INDEX_RESTART 64    // records between restart points, which store their whole path
+#define INDEX_SECTIONS 16
+#define INDEX_ALIGN 64      // alignment of column sections, one cache line
+#define INDEX_NODIR UINT64_MAX // record number of a directory the index has no record of, like the root
+#define NO_PARENT UINT32_MAX  // parent of a root directory
+#define XINDEX_MAGIC "MOLEXIX"
+#define XINDEX_SCAN 8       // secondary index is not used if more than 1/XINDEX_SCAN of the records match
+#define MATCH_PAD 32        // readable bytes after the end of a decoded name, for vector loads
+#define QUERY_NODES 64      // operators and predicates of one query
+#define QUERY_TEXT 4096     // bytes of the path prefixes of one query
+#define QUERY_SAMPLE 1024   // records of the size column sampled to estimate a size predicate
+#define COST_COLUMN 1.0     // a predicate on a column, the unit of query costs
+#define COST_DECODE 8.0     // decoding the path of a record, paid by the first string predicate
+#define COST_MATCH 4.0      // searching a name for a part
+#define HISTOGRAM_BUCKETS 65 // sizes by number of significant bits, 0 to 64
+#define HISTOGRAM_BAR 40    // characters of the longest histogram bar
+#define SERVER_THREADS 8    // clients served at the same time, others wait in the listen backlog
+#define SERVER_LINE 256     // longest request line, same as an interactive command
+#define TYPE_COUNT (error + 1)
+#define READ_BUFFER 65536
+#define WRITE_BUFFER (1 << 20) // bytes collected by a buffered writer before they are written
+#define WRITE_ALIGN 4096    // alignment of the buffer, full buffers are written as whole pages
+#define MAX_RECORD (MAX_PATH + 64) // longest encoded record
+#define MEM_DEFAULT (256UL << 20) // bytes the indexer may hold for sorting unless -m says otherwise
+#define MEM_MIN (1UL << 20)       // smallest budget accepted by -m
+#define MERGE_FANIN 64      // sorted runs merged at once, more runs take several merge passes
+#define DROP_SECTIONS 4     // records and the columns nextRecord() reads
+#define DROP_CHUNK 65536    // records scanned between releasing the pages of the mapped index behind them
 
 #define ERR(source) (perror(source),\
 		     fprintf(stderr,"%s:%d\n",__FILE__,__LINE__),\
 		     exit(EXIT_FAILURE))
 
-int tempfile; // global file descriptor for temp file
 
-enum ftype {dir, jpeg, png, gzip, zip, other, error};
+// file types, their names and signatures - adding a type takes one line here
+// a signature is hex bytes, ?? skips a byte, @n continues at offset n and | separates alternatives
+// the longest matching signature wins, dir is known from stat
+// files of the types marked 1 are indexed, the others are only classified and kept in the signature cache
+#define FILE_TYPES \
+    X(dir,      "dir",    1, "") \
+    X(jpeg,     "jpg",    1, "ffd8ff") \
+    X(png,      "png",    1, "89504e470d0a1a0a") \
+    X(gzip,     "gzip",   1, "1f8b") \
+    X(zip,      "zip",    1, "504b0304 | 504b0506 | 504b0708") \
+    X(pdf,      "pdf",    0, "255044462d") \
+    X(gif,      "gif",    0, "474946383761 | 474946383961") \
+    X(webp,     "webp",   0, "52494646 ???????? 57454250") \
+    X(wav,      "wav",    0, "52494646 ???????? 57415645") \
+    X(mp4,      "mp4",    0, "@4 66747970") /* any ISO base media file, mov and heic too */ \
+    X(tar,      "tar",    0, "@257 7573746172") \
+    X(xz,       "xz",     0, "fd377a585a00") \
+    X(zstd,     "zstd",   0, "28b52ffd") \
+    X(bzip2,    "bzip2",  0, "425a68") \
+    X(sevenzip, "7z",     0, "377abcaf271c") \
+    X(rar,      "rar",    0, "526172211a07") \
+    X(elf,      "elf",    0, "7f454c46") \
+    X(docx,     "docx",   0, "504b0304 @30 5b436f6e74656e745f54797065735d2e786d6c") /* zip starting with [Content_Types].xml */ \
+    X(sqlite,   "sqlite", 0, "53514c69746520666f726d6174203300") \
+    X(wasm,     "wasm",   0, "0061736d") \
+    X(ogg,      "ogg",    0, "4f676753") \
+    X(flac,     "flac",   0, "664c6143") \
+    X(mp3,      "mp3",    0, "494433") /* with an ID3v2 tag */ \
+    X(other,    "other",  0, "") \
+    X(error,    "error",  0, "")
+
+#define X(type, text, indexed, signature) type,
+enum ftype { FILE_TYPES };
+#undef X
+enum isection {SEC_RECORDS, SEC_RESTARTS, SEC_SIZES, SEC_UIDS, SEC_TYPES, SEC_SUMMARY, SEC_PARENTS, SEC_DIRS, SEC_DIRKEYS, SEC_CHILDREN, SEC_BASE, SEC_HIDDEN};
+enum xkind {XSIZE, XOWNER, XTRIGRAM, XKINDS};
+enum wcolumn {WSIZES, WUIDS, WTYPES, WPARENTS, WCOLUMNS};
+enum qkind {QAND, QOR, QNOT, QSIZE, QOWNER, QTYPE, QNAME, QPATH};
+enum qop {QLT, QLE, QEQ, QNE, QGE, QGT};
+enum mphase {MWALK, MSTAT, MCLASSIFY, MWRITE, MPHASES};
 
 typedef struct finfo_t
 {
-    char name[MAX_FILE];    // filename
-    char path[MAX_PATH];    //absolute path
+    const char* name;       // filename, points into path
+    const char* path;       // absolute path, valid until the next record is decoded
+    size_t nameLength;
     off_t size;             // file size in bytes
     uid_t uid;              // owner's uid
     enum ftype type;        // file type
 } finfo_t;
+typedef struct isection_t
+{
+    uint64_t offset;        // from the beginning of the index file
+    uint64_t length;        // in bytes
+} isection_t;
+typedef struct iheader_t
+{
+    char magic[8];          // INDEX_MAGIC
+    uint16_t endian;        // INDEX_ENDIAN in the byte order of the indexer
+    uint16_t version;       // INDEX_VERSION
+    uint32_t restart;       // records between restart points
+    uint64_t count;         // number of records
+    uint32_t checksum;      // CRC-32 of everything after the header
+    uint32_t registry;      // CRC-32 of FILE_TYPES, types are numbered by it
+    isection_t sections[INDEX_SECTIONS];
+} iheader_t;
+typedef struct iowner_t
+{
+    uint32_t uid;
+    uint32_t reserved;
+    uint64_t count;         // records owned by uid
+    uint64_t bytes;         // their total size
+} iowner_t;
+typedef struct isummary_t
+{
+    int64_t created;        // time the index was written
+    uint64_t typeCount[TYPE_COUNT]; // records of each type
+    uint64_t typeBytes[TYPE_COUNT]; // their total size
+    uint64_t owners;        // number of iowner_t following the summary, sorted by uid
+} isummary_t;
+typedef struct ibase_t
+{
+    uint32_t checksum;      // of the index file a delta changes, empty sections of a whole index
+    uint32_t reserved;
+    uint64_t count;         // its records
+    uint64_t hidden;        // of them replaced or removed by the delta, their numbers follow in the hidden section
+} ibase_t;
+typedef struct idir_t
+{
+    uint64_t id;            // record of the directory, INDEX_NODIR for a root
+    uint32_t parent;        // directory number, NO_PARENT for a root
+    uint32_t reserved;
+    uint64_t descendants;   // directories below, numbered right after this one
+    uint64_t firstChild;    // records directly in the directory, in the children section
+    uint64_t children;
+    uint64_t files;         // files in the whole subtree, directories not counted
+    uint64_t bytes;         // their total size
+    uint64_t typeCount[TYPE_COUNT]; // records of each type in the subtree, dir counts the directories below
+} idir_t;
+typedef struct idirkey_t
+{
+    uint64_t hash;          // hashPath() of the directory
+    uint64_t dir;           // its number
+} idirkey_t;
+typedef struct wdir_t
+{
+    char* path;
+    size_t length;
+    uint64_t hash;
+    uint64_t id;            // record of the directory, INDEX_NODIR until it is written
+    uint32_t parent;        // directory its record is in, numbered in order of first sight
+} wdir_t;
+typedef struct bwriter_t
+{
+    int fd;                 // -1 when closed
+    unsigned char* buf;     // WRITE_BUFFER bytes aligned to WRITE_ALIGN
+    size_t used;
+    uint64_t bytes;         // written through the writer since it was opened
+    uint64_t records;       // counted by the callers, reported on close
+    uint64_t writes;        // write() calls made for the flushes
+} bwriter_t;
+typedef struct iwriter_t
+{
+    uint64_t offset;        // bytes written after the header
+    uint64_t count;         // records written
+    uint32_t crc;           // CRC-32 of everything written after the header
+    uint64_t* restarts;     // offsets of restart records from the start of the records section
+    uint64_t caprestarts;
+    char prevPath[MAX_PATH];// path of the previous record, paths are stored as a suffix to it
+    size_t prevLength;
+    bwriter_t columns[WCOLUMNS]; // spilled to temp files, copied after the records by endIndex()
+    isummary_t summary;     // aggregates written as the last section
+    iowner_t* owners;       // open addressing table of owners, empty slots have count 0
+    uint64_t capowners;     // power of 2
+    uint32_t* preorder;     // number writeTree() gives each directory, the parents column is spilled in order of first sight
+    wdir_t* dirs;           // directories seen as parents or as records, in order of first sight
+    uint64_t ndirs, capdirs;
+    uint64_t* dirslots;     // open addressing table of dirs numbers + 1 on the path hash, 0 for an empty slot
+    uint64_t capdirslots;   // power of 2
+    uint32_t lastParent;    // directory of the previous record, most records share it
+    size_t lastParentLength;
+} iwriter_t;
+typedef struct ckheader_t
+{
+    char magic[8];          // CHECKPOINT_MAGIC
+    uint16_t endian;        // INDEX_ENDIAN
+    uint16_t version;       // INDEX_VERSION
+    uint32_t registry;      // types numbered by the same FILE_TYPES
+    uint32_t stateSize;     // sizeof(iwriter_t) of the program that saved it
+    uint64_t index;         // committed bytes of ./.temp, anything after them is written again
+    uint64_t columns[WCOLUMNS]; // committed bytes of the column temps
+    uint64_t cache;         // committed bytes of ./.temp-cache
+    uint64_t cacheRecords;
+    uint64_t ntasks;        // directories of the frontier
+    uint32_t rootLength;    // resolved pathd and pathf follow, then the writer state and the frontier
+    uint32_t pathfLength;
+} ckheader_t;
+typedef struct xheader_t
+{
+    char magic[8];          // XINDEX_MAGIC
+    uint16_t endian;        // INDEX_ENDIAN
+    uint16_t version;       // INDEX_VERSION
+    uint32_t checksum;      // checksum of the index it was built from, stale files are ignored
+    uint64_t count;         // entries of the first array
+} xheader_t;
+typedef struct xowner_t
+{
+    uint32_t uid;
+    uint32_t reserved;
+    uint64_t first;         // position of the first record number of uid in the posting lists
+    uint64_t count;
+} xowner_t;
+typedef struct xtrigram_t
+{
+    uint32_t trigram;       // three bytes of a name folded to lower case
+    uint32_t count;         // records whose name contains it
+    uint64_t offset;        // of its posting list, varint deltas of record numbers
+} xtrigram_t;
+typedef struct tritable_t
+{
+    xtrigram_t* slots;      // open addressing on trigram, empty slots have count 0
+    uint64_t cap;           // power of 2
+    uint64_t used;
+} tritable_t;
+typedef struct xsize_t
+{
+    uint64_t size;          // or any other key of a (key, record) pair sorted by an xsorter_t
+    uint64_t id;            // record number
+} xsize_t;
+typedef struct breader_t
+{
+    int fd;                 // -1 when closed
+    unsigned char* buf;     // READ_BUFFER bytes
+    size_t used;            // bytes of buf already returned
+    size_t length;          // bytes of buf read from the file
+} breader_t;
+typedef struct xsorter_t
+{
+    const char* name;       // runs are spilled to ./.temp-<name>-<number>
+    xsize_t* pairs;         // pairs of the next run, or all of them while they fit the budget
+    uint64_t count, cap;
+    uint64_t limit;         // pairs collected before they are spilled as a sorted run
+    uint64_t next;          // next pair returned when nothing was spilled
+    int nruns;              // runs written
+    int merged;             // runs already merged into a later run and removed
+    breader_t* readers;     // runs of the final merge
+    xsize_t* heads;         // next pair of each reader
+    int* heap;              // readers with pairs left, min-heap on their heads
+    int nheap, nreaders;
+} xsorter_t;
+typedef struct xfile_t
+{
+    const void* base;       // secondary index file mapped read-only, NULL if missing or stale
+    size_t length;
+} xfile_t;
+typedef struct index_t
+{
+    const char* pathf;
+    unsigned char* base;    // whole index file mapped read-only
+    size_t length;
+    const iheader_t* header;
+    const unsigned char* records; // records section
+    const unsigned char* end;     // end of records section
+    const uint64_t* restarts;     // restart table section
+    const uint64_t* sizes;        // column sections, one value per record
+    const uint32_t* uids;
+    const uint8_t* types;
+    const isummary_t* summary;    // footer with aggregates
+    const iowner_t* owners;
+    const uint32_t* parents;      // directory of each record
+    const idir_t* dirs;           // directory tree in preorder, a subtree is a range of it
+    uint64_t ndirs;
+    const idirkey_t* dirkeys;     // directories sorted by path hash
+    const uint64_t* children;     // records grouped by directory, in the order of dirs
+    xfile_t secondary[XKINDS];    // attached by openIndex()
+    const struct index_t* parts;  // of a view, the indexes whose records it lists in turn, it has no records of its own
+    int nparts;                   // the last is a whole index, the others change it: a delta, the build in progress
+    const uint64_t* hidden;       // of a view, bitmap of the records of its parts that an earlier part replaced or removed
+} index_t;
+typedef struct icursor_t
+{
+    const index_t* index;
+    const index_t* segment; // decoded, index itself or a part of a view
+    uint64_t first;         // number of the first record of segment in index
+    const unsigned char* p; // next record to decode, in the mapping
+    uint64_t next;          // number of the next record
+    size_t pathLength;
+    char path[MAX_PATH + MATCH_PAD]; // path of the current record, rebuilt from shared prefix and suffix
+} icursor_t;
+typedef struct progress_t
+{
+    pthread_mutex_t mx;
+    pthread_cond_t idle;    // signalled when the last reader is done
+    const char* pathf;      // index being built, NULL when no indexing is in progress
+    uint64_t count;         // records flushed to the temp files
+    uint64_t offset;        // bytes of them in ./.temp after the header
+    int readers;            // partial queries mapping the temp files, a new build truncates them only once there are none
+    time_t published;       // last update, for the serializer
+} progress_t;
+typedef struct mcounters_t
+{
+    uint64_t entries;       // records written to the index
+    uint64_t dirs;          // directories read
+    uint64_t syscalls;      // made by walkers and classifiers, an io_uring_enter() counts once for the whole batch
+    uint64_t sniffed;       // files whose signature was read
+    uint64_t sniffedBytes;
+    uint64_t reused;        // files whose type came from the signature cache
+    uint64_t ns[MPHASES];   // thread time spent in each stage, walkers and classifiers run in parallel
+} mcounters_t;
+typedef struct mlatency_t
+{
+    uint64_t count;
+    uint64_t ns;            // total of all latencies
+    uint64_t buckets[LATENCY_BUCKETS]; // bucket n counts latencies below 2^n us
+} mlatency_t;
+typedef struct metrics_t
+{
+    pthread_mutex_t mx;     // protects everything but total
+    mcounters_t total;      // since start, added to atomically by the indexing threads
+    mcounters_t last;       // of the last indexing that was finished
+    uint64_t indexings;     // finished since start
+    uint64_t lastNs;        // wall time of the last indexing
+    mlatency_t queries[QUERY_COMMANDS];
+} metrics_t;
+typedef struct matcher_t
+{
+    char part[MAX_FILE];    // searched name part, lower case if fold is set
+    size_t length;
+    bool fold;              // ASCII case insensitive
+} matcher_t;
+typedef struct pager_t
+{
+    FILE* out;              // output of the query
+    FILE* stream;           // where records are printed, out or $PAGER
+    FILE* hold;             // memory stream holding the first records
+    char* held;
+    size_t heldLength;
+    int count;              // records printed so far
+} pager_t;
+typedef struct qnode_t
+{
+    enum qkind kind;
+    enum qop op;            // comparison of a size predicate
+    uint64_t value;         // size, uid or type
+    matcher_t matcher;      // name part
+    const char* prefix;     // path prefix, in query text
+    double cost;            // expected work to evaluate the node for one record, in COST_COLUMN
+    double selectivity;     // expected fraction of records for which it is true
+    int first;              // first operand of AND, OR and NOT, -1 for a predicate
+    int next;               // next operand of the same operator, -1 after the last
+} qnode_t;
+typedef struct query_t
+{
+    const index_t* index;
+    qnode_t nodes[QUERY_NODES];
+    int count;
+    int root;
+    const char* p;          // next character of the query to read
+    char token[MAX_PATH];   // current token
+    bool quoted;            // token was in quotes, so it is never an operator
+    bool end;               // no tokens left
+    char text[QUERY_TEXT];  // path prefixes
+    size_t textLength;
+    char error[MAX_PATH + 64]; // first error found by the parser, empty if none
+    int pushed;             // path predicate whose subtree gave the candidates, true for all of them, -1 if none
+} query_t;
+typedef struct qrecord_t
+{
+    icursor_t cursor;
+    uint64_t id;            // record evaluated
+    bool decoded;           // fileinfo holds the record, only string predicates need it
+    bool damaged;           // the record could not be decoded
+    finfo_t fileinfo;
+} qrecord_t;
+typedef struct agroup_t
+{
+    uint64_t key;           // uid, type or hash of the directory path
+    char* name;             // directory path, NULL for the other groupings
+    uint64_t count;         // files in the group, 0 for an empty slot
+    uint64_t bytes;         // their total size
+} agroup_t;
+typedef struct aggregate_t
+{
+    agroup_t* slots;        // open addressing on key
+    uint64_t cap;           // power of 2
+    uint64_t used;
+} aggregate_t;
+typedef struct kernels_t
+{
+    // set bit i of bitmap if column[i] > value, bitmap must be zeroed
+    void (*greater64)(const uint64_t* column, uint64_t n, uint64_t value, uint64_t* bitmap);
+    // set bit i of bitmap if column[i] == value, bitmap must be zeroed
+    void (*equal32)(const uint32_t* column, uint64_t n, uint32_t value, uint64_t* bitmap);
+    // check if name of length n contains the part, MATCH_PAD bytes after name must be readable
+    bool (*match)(const matcher_t* matcher, const char* name, size_t n);
+    const char* name;
+} kernels_t;
+typedef struct tpattern_t
+{
+    enum ftype type;
+    int count;              // bytes compared, a longer signature wins over a shorter one
+    uint16_t pos[MAX_SIGBYTES]; // increasing offsets of the bytes
+    uint8_t byte[MAX_SIGBYTES];
+} tpattern_t;
+typedef struct tnode_t
+{
+    uint16_t pos;           // offset of the byte examined, TRIE_LEAF if no signature is left to compare
+    uint8_t type;           // longest signature matched on the way to this node, other if none
+    uint8_t nedges;
+    uint32_t edges;         // first of nedges edges, sorted by byte
+    uint32_t fallback;      // next node for a byte without an edge
+} tnode_t;
+typedef struct tedge_t
+{
+    uint8_t byte;
+    uint32_t node;
+} tedge_t;
+typedef struct tkey_t
+{
+    uint64_t alive;         // signatures still matching
+    uint16_t pos;           // next offset compared
+    uint8_t best;           // longest signature matched so far, NO_SIGNATURE if none
+} tkey_t;
+typedef struct typetrie_t
+{
+    tnode_t* nodes;         // decision trie, node 0 is the root
+    tkey_t* keys;           // while building, the state of each node so that equal states share it
+    uint32_t nnodes, capnodes;
+    tedge_t* edges;
+    uint32_t nedges, capedges;
+    uint32_t registry;      // CRC-32 of FILE_TYPES, stored in index and cache files
+} typetrie_t;
+typedef struct sigheader_t
+{
+    char magic[8];          // CACHE_MAGIC
+    uint32_t registry;      // cached types are only valid for the same FILE_TYPES
+    uint32_t reserved;
+    uint64_t count;         // entries in the order they were found, followed by as many (inode, entry) pairs in order
+} sigheader_t;
+typedef struct sigentry_t
+{
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;  // last modification of the file contents
+    off_t size;
+    enum ftype type;        // type found by getType()
+} sigentry_t;
+typedef struct sigcache_t
+{
+    unsigned char* base;    // whole cache file mapped read-only
+    size_t length;
+    const sigentry_t* entries; // signatures found during the previous indexing
+    const xsize_t* sorted;  // (inode, entry) pairs in order, for a binary search
+    uint64_t count;
+    uint64_t lookups;       // counted by all walkers, the mapping is dropped every dropEvery of them
+    uint64_t dropEvery;
+} sigcache_t;
+typedef struct entry_t
+{
+    char name[NAME_MAX+1];  // name within the directory of its batch
+    bool indexed;           // recognised type, its record goes to the index
+    uid_t uid;
+    bool cached;            // regular file, its signature goes to the cache
+    bool sniff;             // new or modified file, its type is read by a classifier
+    sigentry_t sig;
+} entry_t;
+typedef struct batch_t
+{
+    entry_t entries[BATCH_MAX]; // entries of one directory, written together to keep paths front-coded
+    int count;
+    int sniff;              // entries whose type is not known yet
+    int dirfd;              // directory the sniffed files are opened relative to, -1 to use their paths
+    char* path;             // absolute path of the directory followed by '/', entry names are appended to it
+    size_t length;          // length of the directory part including the '/'
+} batch_t;
+typedef struct uring_t
+{
+    int fd;                 // io_uring instance of a classifier, -1 if files are read one by one
+    unsigned* sqHead;       // submission ring, shared with the kernel
+    unsigned* sqTail;
+    unsigned sqMask;
+    struct io_uring_sqe* sqes;
+    unsigned* cqHead;       // completion ring
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+    void* rings;            // single mapping of both rings
+    size_t ringsLength;
+    size_t sqesLength;
+    unsigned char* sigs;    // BATCH_MAX headers of SIG_LENGTH bytes
+} uring_t;
+typedef struct qslot_t
+{
+    size_t seq;             // position the slot is ready for, tells producers and consumers whose turn it is
+    batch_t* batch;
+} qslot_t;
+typedef struct bqueue_t
+{
+    qslot_t* slots;         // bounded lock-free queue of batches between two pipeline stages
+    size_t mask;            // number of slots - 1
+    size_t head __attribute__((aligned(64))); // next position to push, producers and consumers on own cache lines
+    size_t tail __attribute__((aligned(64))); // next position to pop
+    int producers __attribute__((aligned(64))); // threads still pushing, the queue is closed when none are left
+    long pushed;            // queue depth metrics
+    long depthSum;          // depth seen by each push, for the average
+    long maxDepth;
+    long fullWaits;         // times a producer had to wait (backpressure)
+    long emptyWaits;        // times a consumer had to wait
+} bqueue_t;
+typedef struct dent_t
+{
+    uint64_t ino;           // struct linux_dirent64, as returned by getdents64()
+    int64_t off;
+    unsigned short reclen;  // length of the whole record, the next one follows
+    unsigned char type;     // DT_DIR, DT_REG, ... or DT_UNKNOWN if the file system does not tell
+    char name[];
+} dent_t;
+typedef struct dirtask_t
+{
+    char* path;             // path of the directory to read (malloc'd)
+    int level;              // depth below pathd, pathd itself is 0
+} dirtask_t;
+typedef struct deque_t
+{
+    pthread_mutex_t mx;
+    dirtask_t* tasks;       // circular buffer of pending directories
+    int head;               // index of the oldest task, thieves steal from here
+    int count;
+    int cap;
+} deque_t;
+typedef struct walker_t
+{
+    int nthreads;           // walkers, the classifier pool has as many threads
+    int joined;             // number of walkers and classifiers already joined
+    int stop;               // set when the indexer thread is cancelled
+    int pause;              // set by the serializer for a checkpoint, walkers wait between directories
+    int parked;             // walkers waiting for the checkpoint or done
+    long pending;           // directories queued or being read by any worker
+    long passed;            // batches handed on by walkers
+    long written;           // batches written by the serializer
+    time_t checkpointed;    // time of the last checkpoint
+    const char* root;       // resolved pathd, a checkpoint only resumes the same tree
+    const char* pathf;
+    long sniffed;           // files whose signature was read with getType()
+    long reused;            // files whose type was taken from the cache
+    long unstated;          // entries skipped by their d_type, without a stat
+    sigcache_t* cache;
+    deque_t* deques;        // one deque per walker
+    pthread_t* tids;        // walkers followed by classifiers
+    bqueue_t classify;      // walkers -> classifiers, batches with new or modified files
+    bqueue_t serialize;     // walkers and classifiers -> serializer, batches ready to be written
+    batch_t* writing;       // batch being written by the serializer
+} walker_t;
+typedef struct worker_t
+{
+    walker_t* walker;
+    int id;                 // index of own deque
+    char* dents;            // DENTS_BUFFER bytes for getdents64()
+} worker_t;
+typedef struct wentry_t
+{
+    char* path;             // absolute path (malloc'd), key of the entry table
+    uid_t uid;
+    bool isDir;
+    bool seen;              // cleared before a rescan, entries not seen again are removed
+    bool changed;           // differs from its record in the index file, listed in the changed paths
+    uint64_t id;            // its record in the index file, WATCH_NORECORD if there is none
+    sigentry_t sig;         // dev, inode, mtime, size and type of the entry
+    struct wentry_t* next;  // next entry in the same bucket
+} wentry_t;
+typedef struct watch_t
+{
+    int fd;                 // inotify instance
+    int sfd;                // signalfd of the indexer thread's signals
+    char* root;             // resolved pathd, not an entry itself
+    wentry_t** buckets;     // hash table of every entry under root
+    long nbuckets;
+    long count;
+    char** wdPaths;         // directory path of each watch descriptor
+    int nwd;
+    char** pending;         // paths with events not applied yet
+    long npending;
+    long cappending;
+    time_t since;           // time of the oldest pending event
+    long sniffed;           // files read with getType() by the watcher
+    char** changed;         // paths of the entries that differ from the index file, since it was written whole
+    long nchanged;
+    long capchanged;
+    uint64_t* dropped;      // records of the index file whose entries were removed since
+    long ndropped;
+    long capdropped;
+    uint64_t records;       // in the index file
+    uint32_t checksum;      // of the index file, a delta names the one it changes
+    bool numbered;          // entries know their records, changes can be written as a delta
+    bool dirty;             // entry table differs from the index file
+    bool overflow;          // events were lost, a rescan is needed
+    sigcache_t cache;       // signatures of the last indexing, used while setting up
+} watch_t;
+typedef struct snapshot_t
+{
+    index_t index;          // mapped index with its secondary indexes, never modified
+    struct snapshot_t* next;// in the list of retired snapshots
+} snapshot_t;
+typedef struct server_t
+{
+    int fd;                 // listening socket
+    const char* path;
+    bool running;
+    pthread_t tids[SERVER_THREADS];
+    snapshot_t* current;    // published snapshot, swapped atomically by the indexer
+    snapshot_t* hazards[SERVER_THREADS]; // snapshot each worker is reading, it is not freed until cleared
+    snapshot_t* retired;    // replaced snapshots that may still be read
+    pthread_mutex_t mxRetired;
+} server_t;
+typedef struct client_t
+{
+    int id;                 // worker number, selects the hazard slot
+    FILE* in;
+    FILE* out;
+    char* line;
+} client_t;
 typedef struct thread_t
 {
     pthread_t tid;
@@ -48,40 +708,285 @@ typedef struct thread_t
     char* pathd;
     char* pathf;
     int t;
-    unsigned short newIndex; //0:old index file exists, 1:does not exist new needed, 2:indexing initiated by user
+    int j;                  // number of walker threads
+    bool watch;             // keep the index up to date from filesystem events
+    char* socket;           // path of the query socket in server mode, NULL otherwise
+    unsigned short newIndex; //0:old index file exists, 1:does not exist new needed, 2:indexing initiated by user, 3:interrupted indexing is resumed
     bool exitFlag;
     struct stat* pIndexStat;
     sigset_t* pMask;
     pthread_mutex_t* pmxIndexer;
+    pthread_t metricsTid;   // writes the metrics file
 } thread_t;
 
+bwriter_t tempfile; // buffered writer of the temp index file
+bwriter_t cachefile; // buffered writer of the temp signature cache file
+iwriter_t indexWriter; // encoder state of the temp file
+uint32_t crcTable[256];
+uint64_t memoryBudget = MEM_DEFAULT; // bytes the indexer may hold for sorting, -m
+progress_t buildProgress = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0, 0}; // records of the indexing in progress partial queries may read
+metrics_t metrics = {PTHREAD_MUTEX_INITIALIZER}; // always on counters, shown by stats and written to pathf METRICS_SUFFIX
+const char* phaseNames[MPHASES] = {"walk", "stat", "classify", "write"};
+const char* queryNames[QUERY_COMMANDS] = {"count", "stats", "du", "listall", "largerthan", "namepart", "owner", "query", "top", "sum", "histogram", "partial"};
+const char* columnTemps[WCOLUMNS] = {"./.temp-sizes", "./.temp-uids", "./.temp-types", "./.temp-parents"};
+const size_t columnWidths[WCOLUMNS] = {sizeof(uint64_t), sizeof(uint32_t), sizeof(uint8_t), sizeof(uint32_t)};
+pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+typetrie_t typeTrie; // signatures of FILE_TYPES
+pthread_once_t typesOnce = PTHREAD_ONCE_INIT;
+#define X(type, text, indexed, signature) text,
+const char* typeNames[TYPE_COUNT] = { FILE_TYPES };
+#undef X
+#define X(type, text, indexed, signature) indexed,
+const bool typeIndexed[TYPE_COUNT] = { FILE_TYPES }; // records of these types go to the index
+#undef X
+kernels_t kernels; // column scan functions for the best instruction set of this cpu
+pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+const char* xsuffixes[XKINDS] = {SIZE_SUFFIX, OWNER_SUFFIX, TRIGRAM_SUFFIX};
+server_t server; // query server, used from the indexer thread to publish new snapshots
+
 // function declarations
 void displayHelp();
 void usage();
-void readArgs(int argc, char** argv, char** pathd, char** pathf, int* t);
+void readArgs(int argc, char** argv, char** pathd, char** pathf, int* t, int* j, bool* w, char** s, uint64_t* m);
 char* typeToText(int type); // returns type based on enum
-enum ftype getType(const char* fname); // returns file type based on signature
-bool isSubstring(const char* sub, const char* str); // checks if sub is a substring of str
+void addSignatures(tpattern_t* patterns, int* count, enum ftype type, const char* text); // parses the alternatives of a type
+uint32_t buildNode(typetrie_t* trie, const tpattern_t* patterns, uint16_t pos, uint64_t alive, uint8_t best);
+void buildTrie(typetrie_t* trie, const tpattern_t* patterns, int count);
+void freeTrie(typetrie_t* trie);
+enum ftype trieType(const typetrie_t* trie, const unsigned char* sig, ssize_t length); // one step per compared byte
+void initTypes(void); // builds the trie of FILE_TYPES
+enum ftype signatureType(const unsigned char* sig, ssize_t length); // type from the first bytes of a file
+enum ftype getType(int dirfd, const char* fname); // returns file type based on signature, fname is relative to dirfd
+void initMatcher(matcher_t* matcher, const char* part, bool fold);
+bool matchAt(const matcher_t* matcher, const char* s); // compares part to s, first and last bytes already matched
+uint64_t nowNs(void); // monotonic clock in ns
+char* formatSize(uint64_t bytes, char* buf); // writes size in human readable form to buf[16]
 void quickexit(void* tempfile);  // cleanup function for thread during quick exit
+unsigned long hashFile(dev_t dev, ino_t ino);
+void loadSigCache(sigcache_t* cache, const char* cachePath);
+void freeSigCache(void* voidCache); // also cleanup function for thread during quick exit
+enum ftype cachedType(sigcache_t* cache, const struct stat* s); // returns error if file changed or unknown
+void beginCache(void);
+void addToCacheFile(const sigentry_t* entry);
+void endCache(void); // appends the sorted pairs to the temp cache file and fills in its header
+void initCrcTable(void);
+uint32_t crc32(uint32_t crc, const void* buf, size_t length);
+size_t putVarint(unsigned char* p, uint64_t value); // returns number of bytes used
+uint64_t getVarint(const unsigned char** p);
+void openWriter(bwriter_t* writer, const char* path, mode_t mode); // creates or truncates path
+void resumeWriter(bwriter_t* writer, const char* path, uint64_t length); // reopens path for appending, cut back to length
+void writeBuffered(bwriter_t* writer, const void* buf, size_t length);
+void flushWriter(bwriter_t* writer); // writes out what is buffered
+void closeWriter(bwriter_t* writer); // flushes and syncs the file so that it can be renamed over the old one
+void discardWriter(bwriter_t* writer); // closes without writing what is buffered
+void openReader(breader_t* reader, const char* path);
+size_t readBuffered(breader_t* reader, void* buf, size_t length); // returns bytes read, less than length only at the end of the file
+void closeReader(breader_t* reader);
+void writeIndex(const void* buf, size_t length); // writes to temp file and updates checksum
+void alignIndex(size_t alignment); // pads the temp file so that the next section starts at a multiple of alignment
+void beginIndex(void);
+void copyColumn(enum wcolumn column, const uint32_t* map); // appends a spilled column to the temp file, map renumbers directories
+uint32_t findDir(const char* path, size_t length); // returns number of directory path in the writer, inserts if missing
+iowner_t* findOwner(uid_t uid); // returns slot of uid in the owner table of the writer, inserts if missing
+size_t encodeRecord(unsigned char* record, const char* path, size_t pathLength, size_t nameOffset, const char* prevPath, size_t prevLength, bool restart, size_t* shared); // returns bytes used
 void addToTempFile(const char* fpath, const char* fname, off_t fsize, uid_t fuid, enum ftype ftype);
-int walkTree(const char* name, const struct stat* s, int type, struct FTW* f);
-void indexDir(const char* pathd, const char* pathf);
+int compareOwners(const void* a, const void* b);
+int compareDirkeys(const void* a, const void* b);
+void writeTree(iheader_t* header); // directory sections, numbers the directories of the parents column in preorder
+void freeDirs(void);
+void endIndex(const ibase_t* base, const uint64_t* hidden); // base and its records hidden by a delta, NULL for a whole index
+bool checkHeader(const iheader_t* header, size_t length); // returns false if file is not a valid index
+bool mapIndex(index_t* index, const char* pathf, int advice); // maps the index file read-only
+bool openIndex(index_t* index, const char* pathf, int advice); // maps index for a query, reports errors
+void unmapIndex(index_t* index);
+bool mapCurrent(index_t* index, const char* pathf, int advice); // maps the index with its secondary indexes and the delta the watcher wrote next to it
+int64_t findDirectory(const index_t* index, const char* path); // number of directory path, -1 if it is not in the index
+void firstRecord(icursor_t* cursor, const index_t* index);
+void enterPart(icursor_t* cursor, int part); // moves the cursor of a view to the start of its part
+bool isHidden(const index_t* view, uint64_t id); // record id of a view is replaced or removed by an earlier part
+bool decodeRecord(icursor_t* cursor, finfo_t* fileinfo); // next record of the segment, false after its last one
+bool nextRecord(icursor_t* cursor, finfo_t* fileinfo); // returns false after last record
+bool seekRecord(icursor_t* cursor, uint64_t n, finfo_t* fileinfo); // decodes record n from the closest restart point
+bool verifyIndex(const char* pathf); // checks header and checksum of the whole file
+void greater64Scalar(const uint64_t* column, uint64_t n, uint64_t value, uint64_t* bitmap);
+void equal32Scalar(const uint32_t* column, uint64_t n, uint32_t value, uint64_t* bitmap);
+bool matchScalar(const matcher_t* matcher, const char* name, size_t n);
+#if HAVE_X86
+void greater64Sse(const uint64_t* column, uint64_t n, uint64_t value, uint64_t* bitmap);
+void equal32Sse(const uint32_t* column, uint64_t n, uint32_t value, uint64_t* bitmap);
+bool matchSse(const matcher_t* matcher, const char* name, size_t n);
+void greater64Avx2(const uint64_t* column, uint64_t n, uint64_t value, uint64_t* bitmap);
+void equal32Avx2(const uint32_t* column, uint64_t n, uint32_t value, uint64_t* bitmap);
+bool matchAvx2(const matcher_t* matcher, const char* name, size_t n);
+#endif
+void initKernels(void); // picks column scan functions at runtime
+void writeFile(int fd, const void* buf, size_t length);
+void writeXheader(bwriter_t* writer, const index_t* index, uint64_t count);
+int compareSizes(const void* a, const void* b);
+int compareIds(const void* a, const void* b);
+void initSorter(xsorter_t* sorter, const char* name); // pairs are kept in memory up to half the memory budget
+void addPair(xsorter_t* sorter, uint64_t key, uint64_t id);
+void spillRun(xsorter_t* sorter); // sorts the collected pairs and writes them as the next run
+void openRuns(xsorter_t* sorter, int first, int last); // starts merging runs first to last - 1
+bool mergePair(xsorter_t* sorter, xsize_t* pair); // smallest head of the runs being merged, false once all are done
+void closeRuns(xsorter_t* sorter);
+void sortPairs(xsorter_t* sorter); // ends collecting, the pairs are then returned in order by nextPair()
+bool nextPair(xsorter_t* sorter, xsize_t* pair);
+void rewindPairs(xsorter_t* sorter); // nextPair() starts again from the smallest pair
+void runPath(const xsorter_t* sorter, int run, char* path); // path[MAX_FILE] of a run file
+void freeSorter(void* voidSorter); // also cleanup function, removes the runs
+const unsigned char* dropPages(const unsigned char* from, const unsigned char* to); // releases the whole pages of a mapping between from and to, returns where the next call starts
+void dropDecoded(const icursor_t* cursor, const unsigned char** dropped); // dropPages() of records and columns behind the cursor, dropped[DROP_SECTIONS]
+void buildSizeIndex(const index_t* index, bwriter_t* writer); // record numbers sorted by size
+void buildOwnerIndex(const index_t* index, bwriter_t* writer); // record numbers of each owner
+int nameTrigrams(const char* name, uint32_t* trigrams); // distinct folded trigrams of name, returns their number
+xtrigram_t* findTrigram(tritable_t* table, uint32_t trigram); // inserts if missing
+int compareTrigrams(const void* a, const void* b);
+void buildTrigramIndex(const index_t* index, bwriter_t* writer); // posting lists of record numbers by name trigrams
+uint64_t* lookupNames(const index_t* index, const char* part, uint64_t* count); // candidates for a name part or NULL
+void buildSecondary(const char* pathf); // writes secondary indexes of a new index file next to it
+void mapSecondary(index_t* index, enum xkind kind); // attaches secondary index file if it belongs to index
+uint64_t* lookupRecords(const index_t* index, void* value, int option, uint64_t* count); // sorted candidate records or NULL if a scan is better
+uint64_t* viewRecords(const index_t* view, void* value, int option, uint64_t* count); // candidates of a view from the secondary index of its last part, NULL for a scan
+void dequePush(deque_t* dq, dirtask_t task); // owner pushes newest task
+bool dequePop(deque_t* dq, dirtask_t* task);  // owner pops newest task (depth first)
+bool dequeSteal(deque_t* dq, dirtask_t* task);  // thief takes oldest task (largest subtree)
+void initQueue(bqueue_t* q, int producers);
+bool queueTryPush(bqueue_t* q, batch_t* batch); // lock-free, false if the queue is full
+bool queueTryPop(bqueue_t* q, batch_t** batch); // lock-free, false if the queue is empty
+bool queuePush(walker_t* walker, bqueue_t* q, batch_t* batch); // waits while full, false if stopped
+bool queuePop(walker_t* walker, bqueue_t* q, batch_t** batch); // waits while empty, false once closed or stopped
+void closeProducer(bqueue_t* q); // the queue is closed when its last producer is done
+batch_t* newBatch(const char* path); // empty batch for entries of directory path
+void freeBatch(batch_t* batch);
+void addEntry(batch_t* batch, const char* name, const struct stat* s, enum ftype ftype, bool sniff);
+void passBatch(walker_t* walker, batch_t* batch, int dirfd); // hands a batch of directory dirfd to the next stage
+int statEntry(int dirfd, const char* name, struct stat* s); // lstat() of only the fields the index needs
+void readDirectory(walker_t* walker, worker_t* worker, dirtask_t* task);
+void* walkWork(void* voidArgs);
+bool initUring(uring_t* ring); // false if io_uring is not available, files are then read one by one
+void freeUring(uring_t* ring);
+void sniffUring(uring_t* ring, batch_t* batch); // reads the signatures of a batch with all reads in flight at once
+void sniffBatch(uring_t* ring, batch_t* batch); // finds the types of entries that need it
+void* classifyWork(void* voidWalker); // reads signatures of new and modified files
+void writeBatch(batch_t* batch); // serializer, the only writer of the temp files
+void printQueue(const char* name, const bqueue_t* q);
+void stopWalkers(void* voidWalker); // cleanup function for walker threads
+void freeTasks(dirtask_t* tasks, uint64_t ntasks);
+void serializeBatch(walker_t* walker); // writes and frees the batch taken by the serializer
+void saveCheckpoint(const walker_t* walker); // frontier and committed length of every temp file, the walkers must be parked
+void checkpointWalk(walker_t* walker); // parks the walkers between directories, writes what they handed on and saves a checkpoint
+bool committedFile(const char* path, uint64_t length); // path is there with at least length bytes
+bool loadCheckpoint(const char* pathd, const char* pathf, dirtask_t** tasks, uint64_t* ntasks); // restores the temp files and writer of an interrupted indexing of the same tree, false to start over
+void walkDir(const char* pathd, const char* pathf, int nthreads, sigcache_t* cache, dirtask_t* frontier, uint64_t nfrontier); // frontier of a checkpoint or NULL to start at pathd
+void indexDir(const char* pathd, const char* pathf, int nthreads);
+unsigned long hashPath(const char* path);
+unsigned long hashPrefix(const char* path, size_t length); // hashPath() of the first length bytes of path
+bool isUnder(const char* path, const char* dirpath); // checks if path is dirpath or lies below it
+wentry_t* findEntry(watch_t* watch, const char* path);
+wentry_t* putEntry(watch_t* watch, const char* path);
+void dropTree(watch_t* watch, const char* path, bool unseenOnly); // removes path and everything below it
+void moveTree(watch_t* watch, const char* from, const char* to); // renames from and everything below it
+void scanDir(watch_t* watch, const char* path, bool rescan); // watches a directory and reads its contents
+void updatePath(watch_t* watch, const char* path, bool rescan); // brings the entry of path up to date
+void rescanTree(watch_t* watch, const char* path); // re-reads a subtree, used by a requested or periodic indexing
+void rescanDir(watch_t* watch, const char* path); // re-reads the entries of one directory, those gone are removed with their subtrees
+void recheckTree(watch_t* watch); // after lost events, re-reads only the directories that changed and stats the other entries
+void addPending(watch_t* watch, const char* path);
+void markChanged(watch_t* watch, wentry_t* e); // lists the entry for the next delta
+void addDropped(watch_t* watch, uint64_t id); // record of a removed entry, hidden by the next delta
+void numberEntries(watch_t* watch, const char* pathf); // finds the record of every entry in the index file, those that differ from theirs are changed
+int comparePaths(const void* a, const void* b);
+int compareEntries(const void* a, const void* b);
+void applyPending(watch_t* watch); // updates every path that had events since last call, once
+void readEvents(watch_t* watch);
+void pruneChanged(watch_t* watch); // sorts the changed paths, without repeats and removed entries
+void writeWhole(watch_t* watch, const char* pathf); // rewrites the index file and the signature cache from the entry table
+void writeDelta(watch_t* watch, const char* pathf); // writes the changed entries and the records they hide next to the index file
+void flushWatch(watch_t* watch, const char* pathf); // writes the changes as a delta, or the whole index file once they are many
+void freeWatch(void* voidWatch); // also cleanup function for thread during quick exit
+void watchTree(thread_t* threadArgs); // keeps the index up to date from filesystem events
 void* threadWork(void* voidArgs);
 void u_index(thread_t* threadArgs);
-void u_count(const char* pathf);
-void u_namepart(const char* pathf, const char* buf);
-void u_largerthan(const char* pathf, const char* buf);
-void u_owner(const char* pathf, const char* buf);
+void u_count(const index_t* index, const char* buf, FILE* out);
+void u_stats(const index_t* index, FILE* out);
+void loadCounters(mcounters_t* to, mcounters_t* from); // consistent enough copy of counters the indexing threads are adding to
+void finishMetrics(const mcounters_t* start, uint64_t startNs); // keeps what the indexing that began at start added
+void recordQuery(const char* buf, uint64_t startNs); // adds the latency of command buf, run since startNs
+double latencyQuantile(const mlatency_t* latency, double q); // upper bound of the bucket holding quantile q, in ms
+void printMetrics(FILE* out); // counters of the indexings and queries since start
+void writeMetrics(const char* pathf); // writes pathf METRICS_SUFFIX in Prometheus text format, replacing it at once
+void* metricsWork(void* voidArgs); // rewrites the metrics file every METRICS_INTERVAL until cancelled
+void u_du(const index_t* index, const char* buf, FILE* out);
+bool dirArgument(const index_t* index, const char* arg, idir_t* totals, FILE* out); // totals of the directory named by a command argument, reports if it is not indexed
+bool viewTotals(const index_t* view, const char* path, idir_t* totals); // rollup of directory path in a view, false if it is not in the view
+void u_namepart(const index_t* index, const char* buf, FILE* out);
+void u_largerthan(const index_t* index, const char* buf, FILE* out);
+void u_owner(const index_t* index, const char* buf, FILE* out);
+void u_query(const index_t* index, const char* buf, FILE* out); // compound query answered in one pass
+int queryError(query_t* query, const char* what); // keeps the first error, returns -1
+int newQnode(query_t* query, enum qkind kind); // -1 if the query has too many nodes
+void addOperand(query_t* query, int node, int operand); // operands of the same operator are merged into node
+bool nextToken(query_t* query); // reads the next token of the query, false at the end
+bool isToken(const query_t* query, const char* keyword); // current token is keyword, in any case and without quotes
+int parseOr(query_t* query);
+int parseAnd(query_t* query);
+int parseUnary(query_t* query);
+int parsePredicate(query_t* query);
+bool parseSize(const char* text, uint64_t* size); // number with an optional K, M, G or T suffix
+bool parseQuery(query_t* query, const index_t* index, const char* text); // builds the query tree or sets query->error
+bool compareSize(uint64_t size, enum qop op, uint64_t value);
+void planNode(query_t* query, int node); // estimates cost and selectivity, orders the operands of AND and OR
+void printPlan(const query_t* query, int node, int depth);
+uint64_t* pushdownQuery(query_t* query, uint64_t* count); // candidate records from a secondary index or the tree, NULL for a scan
+uint64_t* subtreeRecords(const index_t* index, const char* path, uint64_t* count); // records at path and below, NULL if it is not a directory
+bool evalNode(const query_t* query, int node, qrecord_t* record);
+void u_top(const index_t* index, const char* buf, FILE* out); // largest files, from a bounded heap
+void u_sum(const index_t* index, const char* buf, FILE* out); // file sizes totalled by owner, type or directory
+void u_histogram(const index_t* index, const char* buf, FILE* out); // file sizes in power of 2 buckets
+void siftDown(xsize_t* heap, uint64_t n, uint64_t i); // restores the min-heap below i
+void keepLargest(xsize_t* heap, uint64_t* count, uint64_t k, xsize_t x); // min-heap of the k largest, the smallest of them at the root to be replaced
+uint64_t largestRecords(const index_t* index, uint64_t k, xsize_t* largest); // k largest files in descending order, returns their number
+agroup_t* findGroup(aggregate_t* table, uint64_t key, const char* name, size_t length); // inserts if missing
+int compareGroups(const void* a, const void* b);
+bool isQuery(const char* buf); // checks if buf is a command answered from the index
+void runQuery(const index_t* index, const char* buf, FILE* out); // answers a command accepted by isQuery()
+void publishProgress(const char* pathf); // lets partial queries read the records written so far, NULL once the build is over
+void waitReaders(void); // returns once no partial query maps the temp files, before they are truncated
+const void* mapTemp(const char* path, size_t length); // first length bytes of a temp file read-only, MAP_FAILED if it is gone
+bool readPartial(index_t* partial); // maps the records published by the build in progress, false if nothing is being built
+void releasePartial(index_t* partial);
+void tallyRecord(isummary_t* summary, aggregate_t* owners, const finfo_t* fileinfo); // adds a record to the summary of a view
+void buildView(index_t* view, index_t* parts, int nparts, const index_t* old); // records of the build parts[0], then those of the previous index old, in the other parts, it has not written again
+void deltaView(index_t* view, index_t* parts); // records of the delta parts[0], then those of the index parts[1] it does not hide
+void freeView(index_t* view);
+void partialQuery(const index_t* old, const char* buf, FILE* out); // answers buf from the build in progress merged with old, which may be NULL
 bool queryTest(finfo_t* fileinfo, void* value, int option);
-void listRecords(const char* pathf, void* value, int option);
+uint64_t* selectRecords(const index_t* index, void* value, int option); // bitmap of records matching a column predicate
+void openPager(pager_t* pager, FILE* out);
+void pageRecord(pager_t* pager, const finfo_t* fileinfo); // switches to $PAGER at the third record on stdout
+void closePager(pager_t* pager);
+void listRecords(const index_t* index, void* value, int option, FILE* out);
+snapshot_t* loadSnapshot(const char* pathf); // maps index and its secondary indexes, NULL if not readable
+void freeSnapshot(snapshot_t* snapshot);
+void publishSnapshot(const char* pathf); // replaces the snapshot served to clients by the new index
+snapshot_t* acquireSnapshot(int id); // protects the current snapshot with hazard slot id
+void releaseSnapshot(int id);
+void reclaimSnapshots(void); // frees retired snapshots no worker is reading
+void closeClient(void* voidClient); // also cleanup function for cancelled workers
+void serveClient(client_t* client); // answers request lines until the client disconnects
+void* serveWork(void* voidId);
+void startServer(thread_t* threadArgs);
+void stopServer(void);
+void serveQueries(thread_t* threadArgs); // server mode main loop, until SIGINT or SIGTERM
 void initialization(thread_t* threadArgs, int argc, char** argv);
 void startupIndexing(thread_t* threadArgs);
 void getUserInput(thread_t* threadArgs);
 void exitSequence(thread_t* threadArgs);
 
+#ifndef MOLE_LIBRARY // benchmarks include this file for its functions
 int main(int argc, char** argv)
 {	
-    int sigNo = 0;
     struct thread_t threadArgs;    
 
     // INITIALIZATION
@@ -90,56 +995,86 @@ int main(int argc, char** argv)
     // STARTUP INDEXING
     startupIndexing(&threadArgs);
     
-    // if a prevous index file did not exist, wait for it to be created
-    // wait for confirmation from indexer thread via SIGUSR1
-    if (threadArgs.newIndex != 0) 
-        while (sigNo != SIGUSR1) 
-            sigwait(threadArgs.pMask, &sigNo);
-    
-    // at this point index file exists and if periodic
-    // indexing is set indexer thread is waiting for signals
+    // if a prevous index file did not exist, commands are accepted while it is created,
+    // partial queries are answered from it right away and the others wait for it
+    // if periodic indexing is set indexer thread is waiting for signals
     // and carrying out periodic indexing as required
     
     // USER INPUT
-    getUserInput(&threadArgs); // start accepting user commands
+    if (threadArgs.socket != NULL) serveQueries(&threadArgs); // answer clients of the socket instead
+    else getUserInput(&threadArgs); // start accepting user commands
     
     // EXIT SEQUENCE
     exitSequence(&threadArgs);
 
     return EXIT_SUCCESS;
 }
+#endif
 
 void displayHelp()
 {
     printf("\nindex        : Start indexing procedure.\n\n");
-    printf("count        : Print the counts of each file type in index.\n\n");
+    printf("count [path] : Print the counts of each file type in index, or in directory path and below.\n\n");
+    printf("stats        : Print record counts and total sizes per file type and per owner, then the counters of\n");
+    printf("               the last indexing and the latency of each query command since start.\n\n");
+    printf("du [path]    : Print the total size of all files in index, or in directory path and below.\n\n");
     printf("listall      : List all records in the index.\n\n");
     printf("largerthan x : Print the full path, size and type of all files in index that have size larger than x.\n\n");
-    printf("namepart y   : Print the full path, size and type of all files in index that have y in the name.\n\n");
+    printf("namepart y   : Print the full path, size and type of all files in index that have y in the name.\n");
+    printf("namepart -i y: Same as above, ignoring the case of letters.\n\n");
     printf("owner uid    : Print the full path, size and type of all files in index that owner is uid.\n\n");
+    printf("query e      : Print the full path, size and type of all files in index that match the expression e.\n");
+    printf("               e combines size op x (op is <, <=, =, !=, >= or >, x may end in K, M, G or T), owner uid,\n");
+    printf("               type t, name y, iname y (ignoring case) and path p (p and everything below it)\n");
+    printf("               with and, or, not and parentheses, e.g. query type jpg and size > 10M and owner 1000 and name raw\n\n");
+    printf("top n        : Print the full path, size and type of the n largest files in index, \"by size\" may follow n.\n\n");
+    printf("sum size by g: Print the number and total size of files in index for each owner, type or dir (g).\n\n");
+    printf("histogram size: Print the number and total size of files in index in power of 2 size ranges.\n\n");
+    printf("partial c    : Answer command c (any of the above but index) from the files the indexing in progress has\n");
+    printf("               written so far, with the files of the previous index it has not reached yet. Counts and\n");
+    printf("               sizes of a directory path are not available.\n\n");
     printf("exit         : Terminate program – wait for any indexing to finish\n\n");
     printf("exit!        : Terminate program – cancel any indexing in process.\n\n");
     printf("help         : prints this help message.\n\n");
 }
 void usage()
 {
-    fprintf(stderr,"\nUSAGE : mole [-d pathd] [-f pathf] [-t n]\n\n");
+    fprintf(stderr,"\nUSAGE : mole [-d pathd] [-f pathf] [-t n] [-j threads] [-w] [-s socket] [-m mem]\n\n");
     fprintf(stderr,"pathd : the path to a directory that will be traversed, if the option is not present a path set in an environment variable $MOLE_DIR is used. If the environment variable is not set the program end with an error.\n\n");
-    fprintf(stderr,"pathf : a path to a file where index is stored. If the option is not present, the value from environment variable $MOLE_INDEX_PATH is used. If the variable is not set, the default value of file `.mole-index` in user's home directory is used\n\n");
+    fprintf(stderr,"pathf : a path to a file where index is stored. If the option is not present, the value from environment variable $MOLE_INDEX_PATH is used. If the variable is not set, the default value of file `.mole-index` in user's home directory is used. File signatures of the last indexing are cached in pathf" CACHE_SUFFIX " so unchanged files are not read again. Counters of the indexings and query latencies are written to pathf" METRICS_SUFFIX " in Prometheus text format every %d seconds\n\n", METRICS_INTERVAL);
     fprintf(stderr,"n : is an integer from the range [30,7200]. n denotes a time between subsequent rebuilds of index. This parameter is optional. If it is not present, the periodic re-indexing is disabled\n\n");
+    fprintf(stderr,"threads : is an integer from the range [1,%d]. threads denotes the number of threads walking the directory tree during indexing. If it is not present, the number of online processors is used\n\n", MAX_THREADS);
+    fprintf(stderr,"-w : watch mode. Changes under pathd are applied to the index as they happen (inotify) instead of waiting for the next re-indexing. They are written to pathf" DELTA_SUFFIX " and merged into queries, the index file is rewritten once they change more than 1/%d of its records\n\n", WATCH_COMPACT);
+    fprintf(stderr,"socket : server mode. Queries are read from clients of a Unix domain socket created at this path instead of the terminal. Each request is a command line as typed interactively and its response ends with a line holding a single \".\". The server keeps the index mapped and switches to every new index as it is written. SIGINT or SIGTERM end the server\n\n");
+    fprintf(stderr,"mem : memory budget of the indexer, a number of bytes that may end in K, M, G or T, at least 1M. Sorting beyond it spills sorted runs to temporary files next to the temp index, which are merged into the index and its secondary indexes. If it is not present, 256M is used\n\n");
     exit(EXIT_FAILURE); 
 }
-void readArgs(int argc, char** argv, char** pathd, char** pathf, int* t)
+void readArgs(int argc, char** argv, char** pathd, char** pathf, int* t, int* j, bool* w, char** s, uint64_t* m)
 {
-	int c, dcount = 0, fcount = 0, tcount = 0;
+	int c, dcount = 0, fcount = 0, tcount = 0, jcount = 0, scount = 0, mcount = 0;
 
-    while ((c = getopt(argc, argv, "d:f:t:")) != -1)
+    while ((c = getopt(argc, argv, "d:f:t:j:ws:m:")) != -1)
         switch (c)
         {
+            case 'm':
+                if (++mcount > 1 || !parseSize(optarg, m) || *m < MEM_MIN) usage();
+                break;
+            case 's':
+                if (++scount > 1) usage();
+                *s = optarg;
+                break;
+            case 'w':
+                if (*w) usage();
+                *w = true;
+                break;
             case 't':
                 *t = atoi(optarg);
                 if (*t < 30 || *t > 7200 || ++tcount > 1) usage();
                 break;
+            case 'j':
+                *j = atoi(optarg);
+                if (*j < 1 || *j > MAX_THREADS || ++jcount > 1) usage();
+                break;
             case 'd':
                 if (++dcount > 1) usage();
                 *pathd = *(argv + optind - 1);                                 
@@ -184,376 +1119,5321 @@ void readArgs(int argc, char** argv, char** pathd, char** pathf, int* t)
         *t = 0;
     }    
 
+    if (jcount == 0) // one walker thread per online processor
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        *j = cpus < 1 ? 1 : (cpus > MAX_THREADS ? MAX_THREADS : cpus);
+    }
+
+    if (mcount == 0) // default memory budget
+    {
+        *m = MEM_DEFAULT;
+    }
+
     if (argc>optind) usage();
 }
 char* typeToText(int type) // returns type based on enum
 {
-    if (type == 0) return "dir";
-    else if (type == 1) return "jpg";
-    else if (type == 2) return "png";
-    else if (type == 3) return "gzip";
-    else if (type == 4) return "zip";
-    else if (type == 5) return "other";
-    return "error";
+    return (char*) typeNames[type >= 0 && type < TYPE_COUNT ? type : error];
 }
-enum ftype getType(const char* fname) // returns file type based on signature
+void addSignatures(tpattern_t* patterns, int* count, enum ftype type, const char* text) // parses the alternatives of a type
 {
-    unsigned char sig[9];
-    enum ftype type = 5;
-    int state;
-    int fd;
+    while (*text)
+    {
+        tpattern_t pattern;
+        long offset = 0;
+        bool valid = true;
+        
+        memset(&pattern, 0, sizeof(tpattern_t));
+        pattern.type = type;
+        for (; *text && *text != '|'; )
+        {
+            if (isspace(*text)) text++;
+            else if (*text == '@') // offsets only grow so that bytes stay in order
+            {
+                char* end;
+                long to = strtol(text + 1, &end, 10);
+                if (to < offset) valid = false;
+                offset = to;
+                text = end;
+            }
+            else if (text[0] == '?' && text[1] == '?') offset++, text += 2;
+            else if (isxdigit(text[0]) && isxdigit(text[1]) && pattern.count < MAX_SIGBYTES)
+            {
+                char hex[3] = { text[0], text[1], '\0' };
+                pattern.pos[pattern.count] = offset++;
+                pattern.byte[pattern.count++] = strtol(hex, NULL, 16);
+                text += 2;
+            }
+            else valid = false, text++;
+        }
+        if (*text == '|') text++;
+        
+        if (!valid || pattern.count == 0 || offset > SIG_LENGTH || *count == MAX_SIGNATURES)
+            fprintf(stderr, "WARNING! Signature of %s is invalid or does not fit. Ignoring...\n", typeToText(type));
+        else patterns[(*count)++] = pattern;
+    }
+}
+uint32_t buildNode(typetrie_t* trie, const tpattern_t* patterns, uint16_t pos, uint64_t alive, uint8_t best)
+{
+    int next[MAX_SIGNATURES];   // first byte of each alive signature at or after pos
+    uint8_t bytes[MAX_SIGNATURES];
+    uint32_t children[MAX_SIGNATURES], fallback, id;
+    int nbytes = 0;
+    uint16_t at = TRIE_LEAF;
+    uint64_t waiting = 0;       // alive signatures that do not compare the byte at
     
-    if (DEBUGINDEXING) printf("[getType] Reading file: %s\n", fname);
+    // the node compares the lowest offset any alive signature still needs
+    for (int p = 0; p < MAX_SIGNATURES; p++)
+    {
+        if (!(alive >> p & 1)) continue;
+        for (next[p] = 0; patterns[p].pos[next[p]] < pos; next[p]++);
+        if (patterns[p].pos[next[p]] < at) at = patterns[p].pos[next[p]];
+    }
+    
+    // equal states share their node, so a wildcard does not copy the subtries it spans
+    for (id = 0; id < trie->nnodes; id++)
+        if (trie->keys[id].alive == alive && trie->keys[id].pos == at && trie->keys[id].best == best) return id;
     
-    if ((fd=open(fname, O_RDONLY)) < 0)
+    if (trie->nnodes == trie->capnodes)
     {
-        // couldn't open file for reading, return "6 = error" as file type and continue
-        if (DEBUGINDEXING) printf("[getType] File %s NOT opened \033[0;35m%s\033[0m\n", fname, typeToText(type));
-        return 6;
+        trie->capnodes = trie->capnodes ? 2 * trie->capnodes : 256;
+        if ((trie->nodes = (tnode_t*) realloc(trie->nodes, trie->capnodes * sizeof(tnode_t))) == NULL) ERR("realloc");
+        if ((trie->keys = (tkey_t*) realloc(trie->keys, trie->capnodes * sizeof(tkey_t))) == NULL) ERR("realloc");
     }
+    id = trie->nnodes++;
+    trie->keys[id] = (tkey_t){ alive, at, best };
+    trie->nodes[id] = (tnode_t){ at, best == NO_SIGNATURE ? other : patterns[best].type, 0, 0, 0 };
+    if (alive == 0) return id; // leaf, the type is decided
     
-    if ((state = read(fd, sig, 8)) < 0 || state < 8)
+    for (int p = 0; p < MAX_SIGNATURES; p++)
     {
-        // couldn't read from the file, return "6 = error" as file type and continue
-        if (DEBUGINDEXING) printf("[getType] File %s NOT opened \033[0;35m%s\033[0m\n", fname, typeToText(type));
-        return 6;
-    }    
+        if (!(alive >> p & 1)) continue;
+        if (patterns[p].pos[next[p]] != at) waiting |= 1UL << p;
+        else
+        {
+            int b = 0;
+            while (b < nbytes && bytes[b] != patterns[p].byte[next[p]]) b++;
+            if (b == nbytes) bytes[nbytes++] = patterns[p].byte[next[p]];
+        }
+    }
+    for (int i = 1; i < nbytes; i++) // edges sorted by byte for a binary search
+        for (int k = i; k > 0 && bytes[k - 1] > bytes[k]; k--)
+        {
+            uint8_t swap = bytes[k]; bytes[k] = bytes[k - 1]; bytes[k - 1] = swap;
+        }
     
-    if (close(fd)) ERR("fclose");
-
-    if (DEBUGINDEXING) printf("[getType] Signature: %02x %02x %02x %02x %02x %02x %02x %02x - \n", sig[0], sig[1],sig[2],sig[3], sig[4], sig[5],sig[6],sig[7]);
-
-    // signatures
-    unsigned char jpg[] = { 0xff, 0xd8, 0xff };
-    unsigned char png[] = { 0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a };
-    unsigned char gzip[] = { 0x1f, 0x8b };
-    unsigned char zip[] = { 0x50, 0x4b, 0x03, 0x04 };
-    unsigned char zip2[] = { 0x50, 0x4b, 0x05, 0x06 };
-    unsigned char zip3[] = { 0x50, 0x4b, 0x07, 0x08 };    
+    // each byte keeps the signatures that expect it, completing some of them
+    for (int b = 0; b < nbytes; b++)
+    {
+        uint64_t survivors = waiting;
+        uint8_t longest = best;
+        
+        for (int p = 0; p < MAX_SIGNATURES; p++)
+        {
+            if (!(alive >> p & 1) || patterns[p].pos[next[p]] != at || patterns[p].byte[next[p]] != bytes[b]) continue;
+            if (next[p] + 1 < patterns[p].count) survivors |= 1UL << p;
+            else if (longest == NO_SIGNATURE || patterns[p].count > patterns[longest].count) longest = p;
+        }
+        children[b] = buildNode(trie, patterns, at + 1, survivors, longest);
+    }
+    fallback = buildNode(trie, patterns, at + 1, waiting, best);
     
-    // recognize file type
-    if (memcmp(sig, gzip, 2) == 0) type = 3;
-    else if (memcmp(sig, jpg, 3) == 0) type = 1;
-    else if (memcmp(sig, zip, 4) == 0 || memcmp(sig, zip2, 4) == 0 || memcmp(sig, zip3, 4) == 0) type = 4;
-    else if (memcmp(sig, png, 8) == 0) type = 2;
-    else type = 5;
-
-    if (DEBUGINDEXING) printf("[getType] File %s is \033[0;35m%s\033[0m\n", fname, typeToText(type));
-
-    return type;
+    // edges are appended after the subtries are built, so that those of one node are contiguous
+    if (trie->nedges + nbytes > trie->capedges)
+    {
+        while (trie->nedges + nbytes > trie->capedges) trie->capedges = trie->capedges ? 2 * trie->capedges : 256;
+        if ((trie->edges = (tedge_t*) realloc(trie->edges, trie->capedges * sizeof(tedge_t))) == NULL) ERR("realloc");
+    }
+    trie->nodes[id].edges = trie->nedges;
+    trie->nodes[id].nedges = nbytes;
+    trie->nodes[id].fallback = fallback;
+    for (int b = 0; b < nbytes; b++) trie->edges[trie->nedges++] = (tedge_t){ bytes[b], children[b] };
+    
+    return id;
+}
+void buildTrie(typetrie_t* trie, const tpattern_t* patterns, int count)
+{
+    memset(trie, 0, sizeof(typetrie_t));
+    buildNode(trie, patterns, 0, count == 64 ? ~0UL : (1UL << count) - 1, NO_SIGNATURE);
+    
+    free(trie->keys); // only needed while building
+    trie->keys = NULL;
+}
+void freeTrie(typetrie_t* trie)
+{
+    free(trie->nodes);
+    free(trie->edges);
+    memset(trie, 0, sizeof(typetrie_t));
 }
-bool isSubstring(const char* sub, const char* str) // checks if sub is a substring of str
+enum ftype trieType(const typetrie_t* trie, const unsigned char* sig, ssize_t length) // one step per compared byte
 {
-    int sublength = strlen(sub);
-    int strlength = strlen(str);
+    const tnode_t* node = &trie->nodes[0];
     
-    for (int i = 0; i+sublength <= strlength; i++) 
+    // the number of steps depends on the header, not on the number of signatures
+    while (node->pos != TRIE_LEAF && node->pos < length)
     {
-        if ( strncmp(sub, str+i, sublength) == 0 ) return true;
+        const tedge_t* edge = &trie->edges[node->edges];
+        uint8_t byte = sig[node->pos];
+        
+        // branchless binary search, header bytes are too random for the branch predictor
+        for (int n = node->nedges; n > 1; n -= n / 2)
+            edge = edge[n / 2].byte <= byte ? edge + n / 2 : edge;
+        node = &trie->nodes[node->nedges > 0 && edge->byte == byte ? edge->node : node->fallback];
     }
     
-    return false;
+    // a header shorter than the next byte compared ends with what matched so far
+    return node->type;
 }
-void quickexit(void* tempfile)  // cleanup function for thread during quick exit
+void initTypes(void) // builds the trie of FILE_TYPES
 {
-    if(DEBUGQUICKEXIT) printf("[quickExit] Starting cleanup.\n[quickExit] Closing tempfile.\n");
-    if (close(*(int*)tempfile)) ERR("close"); // close file descriptor if still open
+#define X(type, text, indexed, signature) signature,
+    static const char* signatures[TYPE_COUNT] = { FILE_TYPES };
+#undef X
+    tpattern_t patterns[MAX_SIGNATURES];
+    int count = 0;
+    uint32_t registry = 0;
+    
+    for (int type = 0; type < TYPE_COUNT; type++)
+    {
+        addSignatures(patterns, &count, type, signatures[type]);
+        registry = crc32(registry, typeNames[type], strlen(typeNames[type]) + 1);
+        registry = crc32(registry, signatures[type], strlen(signatures[type]) + 1);
+        registry = crc32(registry, &typeIndexed[type], sizeof(bool)); // an index of other types is rebuilt
+    }
     
-    if(DEBUGQUICKEXIT) printf("[quickExit] Deleting tempfile.\n");
-    remove("./.temp"); // delete the temp file
+    buildTrie(&typeTrie, patterns, count);
+    typeTrie.registry = registry;
     
-    if(DEBUGQUICKEXIT) printf("[quickExit] Cleanup complete.\n");
+    if (DEBUGINDEXING) printf("[initTypes] %d signatures of %d types in %u nodes\n", count, TYPE_COUNT, typeTrie.nnodes);
 }
-void addToTempFile(const char* fpath, const char* fname, off_t fsize, uid_t fuid, enum ftype ftype)
+enum ftype signatureType(const unsigned char* sig, ssize_t length) // type from the first bytes of a file
 {
-    int state;
-    finfo_t fileinfo;
-    memset(&fileinfo, 0, sizeof(finfo_t));
-
-    // prepare fileinfo struct
-    if (strlen(fpath) >= MAX_PATH) fprintf(stderr, "WARNING! Size of absolute path %s longer than buffer MAX_PATH (%d). Shortening...\n", fpath, MAX_PATH-1);
-    strncpy(fileinfo.path, fpath, MAX_PATH-1);
-    if (strlen(fname) >= MAX_FILE) fprintf(stderr, "WARNING! Size of file name %s longer than MAX_FILE (%d). Shortening...\n", fname, MAX_FILE-1);
-    strncpy(fileinfo.name, fname, MAX_FILE-1);
-    fileinfo.size = fsize;
-    fileinfo.uid = fuid;
-    fileinfo.type = ftype;
-
-    if (DEBUGWRITEFILE) // debug messages
+    enum ftype type;
+    
+    pthread_once(&typesOnce, initTypes);
+    type = trieType(&typeTrie, sig, length);
+    
+    if (DEBUGINDEXING) printf("[signatureType] Signature of %zd bytes starting %02x %02x %02x %02x is %s\n", length, sig[0], sig[1], sig[2], sig[3], typeToText(type));
+    return type;
+}
+enum ftype getType(int dirfd, const char* fname) // returns file type based on signature, fname is relative to dirfd
+{
+    unsigned char sig[SIG_LENGTH] = {0};
+    enum ftype type;
+    ssize_t length;
+    int fd;
+    
+    if (DEBUGINDEXING) printf("[getType] Reading file: %s\n", fname);
+    
+    // reading the signature should not change access times, but O_NOATIME is only allowed on own files
+    if ((fd = openat(dirfd, fname, O_RDONLY|O_NOATIME|O_CLOEXEC)) < 0 && errno == EPERM)
     {
-        printf("[addToTempFile] Writing to file:\n");
-        printf("[addToTempFile] Abs. path: %s\n", fileinfo.path);
-        printf("[addToTempFile] File name: %s\n", fileinfo.name);
-        printf("[addToTempFile] File size: %lu\n", fileinfo.size);
-        printf("[addToTempFile] File uid: %d\n", fileinfo.uid);
-        printf("[addToTempFile] File type: %s\n", typeToText(fileinfo.type));
+        fd = openat(dirfd, fname, O_RDONLY|O_CLOEXEC);
+        __atomic_add_fetch(&metrics.total.syscalls, 1, __ATOMIC_RELAXED);
     }
-
-    //write struct to file
-    if ((state = write(tempfile, &fileinfo, sizeof(finfo_t))) <= 0) ERR("write");
-
-    if (DEBUGWRITEFILE) printf("[addToTempFile] Finished writing %d bytes (should be sizeof(finfo_t) = %lu bytes)\n", state, sizeof(finfo_t));
+    __atomic_add_fetch(&metrics.total.syscalls, fd < 0 ? 1 : 3, __ATOMIC_RELAXED); // openat, read and close
+    if (fd < 0)
+    {
+        // couldn't open file for reading, return error as file type and continue
+        if (DEBUGINDEXING) printf("[getType] File %s NOT opened \033[0;35m%s\033[0m\n", fname, typeToText(error));
+        return error;
+    }
+    
+    length = read(fd, sig, SIG_LENGTH);
+    if (close(fd)) ERR("close");
+    if (length < 0)
+    {
+        // couldn't read from the file, return error as file type and continue
+        if (DEBUGINDEXING) printf("[getType] File %s NOT read \033[0;35m%s\033[0m\n", fname, typeToText(error));
+        return error;
+    }
+    
+    __atomic_add_fetch(&metrics.total.sniffedBytes, length, __ATOMIC_RELAXED);
+    type = signatureType(sig, length);
+    if (DEBUGINDEXING) printf("[getType] File %s is \033[0;35m%s\033[0m\n", fname, typeToText(type));
+    
+    return type;
 }
-int walkTree(const char* name, const struct stat* s, int type, struct FTW* f)
-{    
-    char* path;
-    enum ftype ftype;
-    errno = 0;
+void initMatcher(matcher_t* matcher, const char* part, bool fold)
+{
+    matcher->length = strlen(part);
+    matcher->fold = fold;
+    for (size_t i = 0; i <= matcher->length; i++) matcher->part[i] = fold ? tolower((unsigned char) part[i]) : part[i];
+}
+bool matchAt(const matcher_t* matcher, const char* s) // compares part to s, first and last bytes already matched
+{
+    if (!matcher->fold) return memcmp(matcher->part + 1, s + 1, matcher->length > 2 ? matcher->length - 2 : 0) == 0;
+    
+    for (size_t i = 0; i < matcher->length; i++)
+        if ((char) tolower((unsigned char) s[i]) != matcher->part[i]) return false;
+    return true;
+}
+uint64_t nowNs(void) // monotonic clock in ns
+{
+    struct timespec t;
     
-    if ( (path = realpath(name, NULL)) == NULL ) return 0; // ignore unresolved paths
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+char* formatSize(uint64_t bytes, char* buf) // writes size in human readable form to buf[16]
+{
+    const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB"};
+    double size = bytes;
+    int unit = 0;
+    
+    while (size >= 1024 && unit < 6) size /= 1024, unit++;
+    
+    if (unit == 0) snprintf(buf, 16, "%lu %s", bytes, units[unit]);
+    else snprintf(buf, 16, "%.1f %s", size, units[unit]);
+    return buf;
+}
+void quickexit(void* tempfile)  // cleanup function for thread during quick exit
+{
+    if(DEBUGQUICKEXIT) printf("[quickExit] Starting cleanup.\n[quickExit] Closing tempfile.\n");
+    publishProgress(NULL);
+    discardWriter((bwriter_t*)tempfile); // close file descriptor if still open
     
-    if (DEBUGINDEXING) printf("\n[walkTree] Abs. Path: %s \n[walkTree] File/Dir. Name: %s\n", path, name + f->base);
+    discardWriter(&cachefile);
     
-    switch (type)
+    for (int column = 0; column < WCOLUMNS; column++) discardWriter(&indexWriter.columns[column]);
+    
+    // a checkpoint points into the temp files, the next indexing resumes from it instead of starting over
+    if (access(CHECKPOINT_FILE, F_OK) == 0)
     {
-        case FTW_DNR:
-        case FTW_D:
-	        if (f->level != 0) ftype = 0;
-            else ftype = 5; // ignore root
-            break;
-        case FTW_F:	        
-            ftype = getType(name);
-            break;
+        if(DEBUGQUICKEXIT) printf("[quickExit] Keeping tempfile for the checkpoint.\n");
     }
-
-    if (DEBUGINDEXING) printf("[walkTree] Size: %lo \n[walkTree] UID: %d\n", s->st_size, s->st_uid);
-
-    if (ftype < 5) addToTempFile(path, name+f->base, s->st_size, s->st_uid, ftype);
+    else
+    {
+        if(DEBUGQUICKEXIT) printf("[quickExit] Deleting tempfile.\n");
+        remove("./.temp"); // delete the temp file
+        remove("./.temp-cache");
+        for (int column = 0; column < WCOLUMNS; column++) remove(columnTemps[column]);
+    }
+    free(indexWriter.restarts);
+    indexWriter.restarts = NULL;
     
-    free(path); // free the buffer returned from realpath
-    return 0;
+    if(DEBUGQUICKEXIT) printf("[quickExit] Cleanup complete.\n");
+}
+unsigned long hashFile(dev_t dev, ino_t ino)
+{
+    unsigned long h = (unsigned long)ino * 0x9e3779b97f4a7c15UL ^ (unsigned long)dev;
+    return h ^ (h >> 29);
 }
-void indexDir(const char* pathd, const char* pathf)
+void loadSigCache(sigcache_t* cache, const char* cachePath)
 {
-    // open temp file for writing and assign to global file descriptor
-    // nftw() will write to the file at each step
-    if ((tempfile = open("./.temp", O_WRONLY|O_CREAT|O_TRUNC, 0777)) < 0) ERR("open");
+    int fd;
+    struct stat s;
+    const sigheader_t* header;
     
-    // prepare cleanup for quick exit
-    pthread_cleanup_push(quickexit, &tempfile);
+    memset(cache, 0, sizeof(sigcache_t));
+    pthread_once(&typesOnce, initTypes);
     
-    if (DEBUGSIMULATION) 
+    // no cache from a previous indexing - every file will be sniffed
+    if ((fd = open(cachePath, O_RDONLY)) < 0) return;
+    if (fstat(fd, &s)) ERR("fstat");
+    if (s.st_size >= sizeof(sigheader_t) && (cache->base = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) ERR("mmap");
+    if (close(fd)) ERR("close");
+    if (cache->base == NULL) return;
+    cache->length = s.st_size;
+    header = (const sigheader_t*) cache->base;
+    
+    // types cached by an older format or with other FILE_TYPES are not valid any more, a file may have a type now
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header->registry != typeTrie.registry)
     {
-        printf("[indexDir] Simulating 5 second long indexing.\n");
-        sleep(5); // to simulate a 5 second long indexing procedure
+        if (DEBUGINDEXING) printf("[loadSigCache] Signature cache %s is of other types, not used\n", cachePath);
+        freeSigCache(cache);
+        return;
     }
-
-    //start tree walk process
-    if ( 0 != nftw(pathd, walkTree, MAXFD, FTW_PHYS))
-        printf("%s: cannot access\n", pathd);
-
-    // close temp file
-    if (close(tempfile)) ERR("close");
-    
-    int state = 0;
-    // atomically rename temp file to actual file
-    // protect renaming operation against cancellation
-    // loop while EBUSY so that if indexfile is open in another stream it waits?
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-    do
+    if (header->count > s.st_size / (sizeof(sigentry_t) + sizeof(xsize_t)) || s.st_size != sizeof(sigheader_t) + header->count * (sizeof(sigentry_t) + sizeof(xsize_t)))
     {
-        if ( (state = rename(".temp", pathf)) == EBUSY) sleep(1);
-    } while (state == EBUSY);
-    if (state != 0) ERR("rename");
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-
-    pthread_cleanup_pop(0);
+        fprintf(stderr, "WARNING! Signature cache %s is damaged. Ignoring...\n", cachePath);
+        freeSigCache(cache);
+        return;
+    }
+    
+    // the file is looked up in place, its pages are given back now and then so they stay within the memory budget
+    cache->count = header->count;
+    cache->entries = (const sigentry_t*) (header + 1);
+    cache->sorted = (const xsize_t*) (cache->entries + cache->count);
+    cache->dropEvery = memoryBudget / 4 / (2 * sysconf(_SC_PAGESIZE)) + 1; // a lookup reads about two pages, one of pairs and one of entries
+    if (madvise(cache->base, cache->length, MADV_RANDOM)) ERR("madvise");
+    
+    if (DEBUGINDEXING) printf("[loadSigCache] Mapped %lu signatures from %s\n", cache->count, cachePath);
 }
-void* threadWork(void* voidArgs)
+void freeSigCache(void* voidCache) // also cleanup function for thread during quick exit
 {
-    thread_t* threadArgs = voidArgs;
-    long timeElapsed = threadArgs->newIndex>0 ? 0 : time(NULL) - threadArgs->pIndexStat->st_mtime;
-    long timeLeft = threadArgs->newIndex>0 ? threadArgs->t : threadArgs->t - timeElapsed;
-    int sigNo = 0;
-
-    if (DEBUGTHREAD) // debug messages
+    sigcache_t* cache = voidCache;
+    if (cache->base != NULL && munmap(cache->base, cache->length)) ERR("munmap");
+    memset(cache, 0, sizeof(sigcache_t));
+}
+enum ftype cachedType(sigcache_t* cache, const struct stat* s) // returns error if file changed or unknown
+{
+    uint64_t lo = 0, hi = cache->count, ino = s->st_ino;
+    enum ftype type = error;
+    
+    if (cache->count == 0) return error;
+    
+    // first pair of the inode, files of other devices may have the same one
+    while (lo < hi)
     {
-        printf("[threadWork] Thread with TID: %lu started.\n", (unsigned long)threadArgs->tid);
-        if (threadArgs->newIndex == 1) printf("[threadWork] Index file \"%s\" does not exist.\n", threadArgs->pathf);
-        else if (threadArgs->newIndex == 2) printf("[threadWork] Indexing initiated by user.\n");
-        else if (threadArgs->newIndex == 0)
-        {
-            printf("[threadWork] Index file \"%s\" exists. Last modification: %ld\n", threadArgs->pathf, threadArgs->pIndexStat->st_mtime);
-            printf("[threadWork] Current time: %ld\n", time(NULL));
-            printf("[threadWork] Time elapsed since last indexing is: %ld seconds.\n", timeElapsed);
-            printf("[threadWork] Will wait for: %d - %ld = %ld seconds before re-indexing.\n", threadArgs->t, timeElapsed, timeLeft);
-        }
+        uint64_t mid = (lo + hi) / 2;
+        if (cache->sorted[mid].size < ino) lo = mid + 1;
+        else hi = mid;
     }
-
-    if (threadArgs->newIndex != 0) // 1:start-up without old index file / 2:user initiated indexing 
+    for (; lo < cache->count && cache->sorted[lo].size == ino; lo++)
     {
-        printf("--Starting indexing.\n");
-        if (threadArgs->newIndex == 2) printf("> Enter command (\"help\" for list of commands): \n");
-        
-        pthread_mutex_lock(threadArgs->pmxIndexer);
-        indexDir(threadArgs->pathd, threadArgs->pathf);
-        pthread_mutex_unlock(threadArgs->pmxIndexer);
+        const sigentry_t* e = &cache->entries[cache->sorted[lo].id < cache->count ? cache->sorted[lo].id : 0];
         
-        printf("--Indexing complete.\n");
-        if (threadArgs->newIndex != 1 && threadArgs->exitFlag == 0) printf("> Enter command (\"help\" for list of commands): \n");
+        if (e->dev != s->st_dev || e->ino != s->st_ino) continue;
         
-        // if necessary, inform main thread that start-up indexing is finished
-        if (threadArgs->newIndex == 1) pthread_kill(threadArgs->mtid, SIGUSR1);
-
-        // set alarm for periodic indexing
-        if (threadArgs->t > 0) alarm(threadArgs->t);        
-    }
-    else // start-up with old index file and perodic indexing set
-    { 
-        if(timeLeft > 0) // index file not old enough - set alarm to wait until it's old enough
-        {
-            if (DEBUGTHREAD) printf("[threadWork] Setting alarm for %ld seconds and waiting for periodic indexing.\n", timeLeft);
-            alarm(timeLeft);
-        }
-        else // index file too old - directly trigger indexing in periodic indexing loop
-        {
-            pthread_kill(threadArgs->tid, SIGALRM); 
-            printf("--Index file too old.\n");
-        }
+        // same file, reuse its type only if contents were not modified since
+        if (e->size == s->st_size && e->mtime.tv_sec == s->st_mtim.tv_sec && e->mtime.tv_nsec == s->st_mtim.tv_nsec) type = e->type;
+        break;
     }
     
-    timeLeft = threadArgs->t;
-
-    // enter periodic indexing loop if it is set
-    while (threadArgs->t > 0)
-    {
-        // wait for a signal
-        do
+    // other walkers may be reading the mapping meanwhile, its pages are read again from the page cache
+    if (__atomic_add_fetch(&cache->lookups, 1, __ATOMIC_RELAXED) % cache->dropEvery == 0 && madvise(cache->base, cache->length, MADV_DONTNEED)) ERR("madvise");
+    return type;
+}
+void beginCache(void)
+{
+    sigheader_t header;
+    
+    pthread_once(&typesOnce, initTypes);
+    memset(&header, 0, sizeof(sigheader_t));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.registry = typeTrie.registry;
+    writeBuffered(&cachefile, &header, sizeof(sigheader_t));
+}
+void addToCacheFile(const sigentry_t* entry)
+{
+    writeBuffered(&cachefile, entry, sizeof(sigentry_t));
+    cachefile.records++;
+}
+void endCache(void) // appends the sorted pairs to the temp cache file and fills in its header
+{
+    xsorter_t sorter;
+    breader_t reader;
+    sigheader_t header;
+    sigentry_t entry;
+    xsize_t pair;
+    uint64_t count = 0;
+    
+    // entries are in the order the walk found them, only the pairs to look them up are sorted, spilling as the other sorts
+    flushWriter(&cachefile);
+    initSorter(&sorter, "sigs");
+    pthread_cleanup_push(freeSorter, &sorter);
+    openReader(&reader, "./.temp-cache");
+    if (readBuffered(&reader, &header, sizeof(sigheader_t)) != sizeof(sigheader_t)) ERR("readBuffered");
+    while (readBuffered(&reader, &entry, sizeof(sigentry_t)) == sizeof(sigentry_t)) addPair(&sorter, entry.ino, count++);
+    closeReader(&reader);
+    
+    sortPairs(&sorter);
+    while (nextPair(&sorter, &pair)) writeBuffered(&cachefile, &pair, sizeof(xsize_t));
+    pthread_cleanup_pop(1);
+    
+    header.count = count;
+    flushWriter(&cachefile);
+    if (pwrite(cachefile.fd, &header, sizeof(sigheader_t), 0) != sizeof(sigheader_t)) ERR("pwrite");
+}
+void initCrcTable(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crcTable[i] = c;
+    }
+}
+uint32_t crc32(uint32_t crc, const void* buf, size_t length)
+{
+    const unsigned char* p = buf;
+    
+    pthread_once(&crcOnce, initCrcTable);
+    
+    crc = ~crc;
+    while (length--) crc = crcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+size_t putVarint(unsigned char* p, uint64_t value) // returns number of bytes used
+{
+    size_t length = 0;
+    
+    // 7 bits per byte, highest bit set if more bytes follow
+    while (value >= 0x80)
+    {
+        p[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    p[length++] = value;
+    
+    return length;
+}
+uint64_t getVarint(const unsigned char** p)
+{
+    uint64_t value = 0;
+    int shift = 0;
+    
+    do value |= (uint64_t)(**p & 0x7f) << shift, shift += 7;
+    while (*(*p)++ & 0x80 && shift < 64);
+    
+    return value;
+}
+void openWriter(bwriter_t* writer, const char* path, mode_t mode) // creates or truncates path
+{
+    memset(writer, 0, sizeof(bwriter_t));
+    if ((writer->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, mode)) < 0) ERR("open");
+    if (posix_memalign((void**)&writer->buf, WRITE_ALIGN, WRITE_BUFFER)) ERR("posix_memalign");
+}
+void resumeWriter(bwriter_t* writer, const char* path, uint64_t length) // reopens path for appending, cut back to length
+{
+    memset(writer, 0, sizeof(bwriter_t));
+    if ((writer->fd = open(path, O_WRONLY)) < 0) ERR("open");
+    if (ftruncate(writer->fd, length)) ERR("ftruncate");
+    if (lseek(writer->fd, 0, SEEK_END) < 0) ERR("lseek");
+    if (posix_memalign((void**)&writer->buf, WRITE_ALIGN, WRITE_BUFFER)) ERR("posix_memalign");
+    writer->bytes = length;
+}
+void writeBuffered(bwriter_t* writer, const void* buf, size_t length)
+{
+    const unsigned char* p = buf;
+    
+    // the buffer is always filled up before it is written, so every write but the last one is WRITE_BUFFER long
+    while (length > 0)
+    {
+        size_t part = WRITE_BUFFER - writer->used < length ? WRITE_BUFFER - writer->used : length;
+        
+        memcpy(writer->buf + writer->used, p, part);
+        writer->used += part;
+        writer->bytes += part;
+        p += part;
+        length -= part;
+        
+        if (writer->used == WRITE_BUFFER) flushWriter(writer);
+    }
+}
+void flushWriter(bwriter_t* writer) // writes out what is buffered
+{
+    if (writer->used == 0) return;
+    
+    writeFile(writer->fd, writer->buf, writer->used);
+    writer->used = 0;
+    writer->writes++;
+}
+void closeWriter(bwriter_t* writer) // flushes and syncs the file so that it can be renamed over the old one
+{
+    flushWriter(writer);
+    
+    // without the sync a crash shortly after the rename could leave an empty or partial file under the new name
+    if (fsync(writer->fd)) ERR("fsync");
+    if (close(writer->fd)) ERR("close");
+    writer->fd = -1;
+    free(writer->buf);
+    writer->buf = NULL;
+    
+    if (DEBUGWRITEFILE) printf("[closeWriter] %lu records, %lu bytes in %lu writes\n", writer->records, writer->bytes, writer->writes);
+}
+void discardWriter(bwriter_t* writer) // closes without writing what is buffered
+{
+    if (writer->fd >= 0 && close(writer->fd)) ERR("close");
+    writer->fd = -1;
+    free(writer->buf);
+    writer->buf = NULL;
+}
+void openReader(breader_t* reader, const char* path)
+{
+    memset(reader, 0, sizeof(breader_t));
+    if ((reader->fd = open(path, O_RDONLY)) < 0) ERR("open");
+    if ((reader->buf = (unsigned char*) malloc(READ_BUFFER)) == NULL) ERR("malloc");
+}
+size_t readBuffered(breader_t* reader, void* buf, size_t length) // returns bytes read, less than length only at the end of the file
+{
+    unsigned char* p = buf;
+    size_t done = 0;
+    
+    while (done < length)
+    {
+        if (reader->used == reader->length)
         {
-            sigwait(threadArgs->pMask, &sigNo);
-        } while (sigNo != SIGUSR1 && sigNo != SIGUSR2 && sigNo != SIGALRM);
+            ssize_t state;
+            if ((state = read(reader->fd, reader->buf, READ_BUFFER)) < 0) ERR("read");
+            if (state == 0) break;
+            reader->used = 0;
+            reader->length = state;
+        }
         
-        if (DEBUGTHREAD) // debug messages
+        size_t part = reader->length - reader->used < length - done ? reader->length - reader->used : length - done;
+        memcpy(p + done, reader->buf + reader->used, part);
+        reader->used += part;
+        done += part;
+    }
+    
+    return done;
+}
+void closeReader(breader_t* reader)
+{
+    if (reader->fd >= 0 && close(reader->fd)) ERR("close");
+    reader->fd = -1;
+    free(reader->buf);
+    reader->buf = NULL;
+}
+void writeIndex(const void* buf, size_t length) // writes to temp file and updates checksum
+{
+    writeBuffered(&tempfile, buf, length);
+    
+    indexWriter.crc = crc32(indexWriter.crc, buf, length);
+    indexWriter.offset += length;
+}
+void alignIndex(size_t alignment) // pads the temp file so that the next section starts at a multiple of alignment
+{
+    static const unsigned char pad[INDEX_ALIGN] = {0};
+    
+    writeIndex(pad, (alignment - (sizeof(iheader_t) + indexWriter.offset) % alignment) % alignment);
+}
+void beginIndex(void)
+{
+    iheader_t header;
+    
+    free(indexWriter.restarts);
+    free(indexWriter.owners);
+    freeDirs();
+    memset(&indexWriter, 0, sizeof(iwriter_t));
+    
+    // header is filled in by endIndex() once sizes are known
+    memset(&header, 0, sizeof(iheader_t));
+    writeBuffered(&tempfile, &header, sizeof(iheader_t));
+    
+    // columns grow with the tree, so they wait in temp files instead of memory until the records are written
+    for (int column = 0; column < WCOLUMNS; column++) indexWriter.columns[column].fd = -1;
+    for (int column = 0; column < WCOLUMNS; column++) openWriter(&indexWriter.columns[column], columnTemps[column], 0600);
+}
+void copyColumn(enum wcolumn column, const uint32_t* map) // appends a spilled column to the temp file, map renumbers directories
+{
+    breader_t reader;
+    uint32_t chunk[READ_BUFFER / sizeof(uint32_t)];
+    size_t length;
+    
+    openReader(&reader, columnTemps[column]);
+    while ((length = readBuffered(&reader, chunk, sizeof(chunk))) > 0)
+    {
+        if (map != NULL)
+            for (size_t i = 0; i < length / sizeof(uint32_t); i++) chunk[i] = map[chunk[i]];
+        writeIndex(chunk, length);
+    }
+    closeReader(&reader);
+}
+uint32_t findDir(const char* path, size_t length) // returns number of directory path in the writer, inserts if missing
+{
+    uint64_t i, hash = hashPrefix(path, length);
+    
+    if (2 * indexWriter.ndirs >= indexWriter.capdirslots) // keep table at most half full
+    {
+        free(indexWriter.dirslots);
+        indexWriter.capdirslots = indexWriter.capdirslots ? 2 * indexWriter.capdirslots : 1024;
+        if ((indexWriter.dirslots = (uint64_t*) calloc(indexWriter.capdirslots, sizeof(uint64_t))) == NULL) ERR("calloc");
+        for (uint64_t d = 0; d < indexWriter.ndirs; d++)
         {
-            if (sigNo == SIGUSR1) printf("[threadWork] SIGUSR1 (index) received from user.\n");
-            if (sigNo == SIGUSR2) printf("[threadWork] SIGUSR2 (exit) received from user.\n");
-            if (sigNo == SIGALRM) printf("[threadWork] SIGALRM (periodic indexing) triggered.\n");
+            for (i = indexWriter.dirs[d].hash & (indexWriter.capdirslots - 1); indexWriter.dirslots[i] != 0; i = (i + 1) & (indexWriter.capdirslots - 1));
+            indexWriter.dirslots[i] = d + 1;
+        }
+    }
+    
+    for (i = hash & (indexWriter.capdirslots - 1); indexWriter.dirslots[i] != 0; i = (i + 1) & (indexWriter.capdirslots - 1))
+    {
+        wdir_t* d = &indexWriter.dirs[indexWriter.dirslots[i] - 1];
+        if (d->hash == hash && d->length == length && memcmp(d->path, path, length) == 0) return indexWriter.dirslots[i] - 1;
+    }
+    
+    if (indexWriter.ndirs == indexWriter.capdirs)
+    {
+        indexWriter.capdirs = indexWriter.capdirs ? 2 * indexWriter.capdirs : 1024;
+        if ((indexWriter.dirs = (wdir_t*) realloc(indexWriter.dirs, indexWriter.capdirs * sizeof(wdir_t))) == NULL) ERR("realloc");
+    }
+    if ((indexWriter.dirs[indexWriter.ndirs].path = strndup(path, length)) == NULL) ERR("strndup");
+    indexWriter.dirs[indexWriter.ndirs].length = length;
+    indexWriter.dirs[indexWriter.ndirs].hash = hash;
+    indexWriter.dirs[indexWriter.ndirs].id = INDEX_NODIR;
+    indexWriter.dirslots[i] = indexWriter.ndirs + 1;
+    
+    return indexWriter.ndirs++;
+}
+iowner_t* findOwner(uid_t uid) // returns slot of uid in the owner table of the writer, inserts if missing
+{
+    uint64_t i;
+    
+    if (2 * indexWriter.summary.owners >= indexWriter.capowners) // keep table at most half full
+    {
+        iowner_t* old = indexWriter.owners;
+        uint64_t oldcap = indexWriter.capowners;
+        
+        indexWriter.capowners = oldcap ? 2 * oldcap : 64;
+        if ((indexWriter.owners = (iowner_t*) calloc(indexWriter.capowners, sizeof(iowner_t))) == NULL) ERR("calloc");
+        for (uint64_t j = 0; j < oldcap; j++)
+        {
+            if (old[j].count == 0) continue;
+            for (i = old[j].uid & (indexWriter.capowners - 1); indexWriter.owners[i].count != 0; i = (i + 1) & (indexWriter.capowners - 1));
+            indexWriter.owners[i] = old[j];
         }
+        free(old);
+    }
+    
+    for (i = uid & (indexWriter.capowners - 1); indexWriter.owners[i].count != 0; i = (i + 1) & (indexWriter.capowners - 1))
+        if (indexWriter.owners[i].uid == uid) return &indexWriter.owners[i];
+    
+    indexWriter.owners[i].uid = uid;
+    indexWriter.summary.owners++;
+    return &indexWriter.owners[i];
+}
+size_t encodeRecord(unsigned char* record, const char* path, size_t pathLength, size_t nameOffset, const char* prevPath, size_t prevLength, bool restart, size_t* shared) // returns bytes used
+{
+    size_t length = 0;
+    
+    // restart points store the whole path, others only what differs from the previous path
+    *shared = 0;
+    if (!restart) while (*shared < pathLength && *shared < prevLength && path[*shared] == prevPath[*shared]) (*shared)++;
+    
+    length += putVarint(record + length, *shared);
+    length += putVarint(record + length, pathLength - *shared);
+    memcpy(record + length, path + *shared, pathLength - *shared);
+    length += pathLength - *shared;
+    length += putVarint(record + length, nameOffset);
+    
+    return length;
+}
+void addToTempFile(const char* fpath, const char* fname, off_t fsize, uid_t fuid, enum ftype ftype)
+{
+    unsigned char record[MAX_RECORD];
+    size_t length, pathLength = strlen(fpath), nameLength = strlen(fname), shared;
 
-        if (sigNo == SIGUSR2) break; // exit signal received - end the thread
+    // prepare record
+    if (pathLength >= MAX_PATH) 
+    {
+        fprintf(stderr, "WARNING! Size of absolute path %s longer than buffer MAX_PATH (%d). Shortening...\n", fpath, MAX_PATH-1);
+        pathLength = MAX_PATH-1;
+    }
+    if (nameLength >= MAX_FILE) fprintf(stderr, "WARNING! Size of file name %s longer than MAX_FILE (%d). Shortening...\n", fname, MAX_FILE-1);
+    
+    // name is the tail of the path, only its offset is stored
+    size_t nameOffset = nameLength <= pathLength && strcmp(fpath + pathLength - nameLength, fname) == 0 ? pathLength - nameLength : pathLength;
 
-        printf("--Starting indexing.\n");
-        printf("> Enter command (\"help\" for list of commands): \n");
+    // restart points are listed so that a record can be found without decoding all before it
+    if (indexWriter.count % INDEX_RESTART == 0)
+    {
+        if (indexWriter.count / INDEX_RESTART == indexWriter.caprestarts)
+        {
+            indexWriter.caprestarts = indexWriter.caprestarts ? 2 * indexWriter.caprestarts : 1024;
+            if ((indexWriter.restarts = (uint64_t*) realloc(indexWriter.restarts, indexWriter.caprestarts * sizeof(uint64_t))) == NULL) ERR("realloc");
+        }
+        indexWriter.restarts[indexWriter.count / INDEX_RESTART] = indexWriter.offset;
+    }
+    length = encodeRecord(record, fpath, pathLength, nameOffset, indexWriter.prevPath, indexWriter.prevLength, indexWriter.count % INDEX_RESTART == 0, &shared);
 
-        pthread_mutex_lock(threadArgs->pmxIndexer);
-        indexDir(threadArgs->pathd, threadArgs->pathf);
-        pthread_mutex_unlock(threadArgs->pmxIndexer);
-        
-        printf("--Indexing complete.\n");
-        if (threadArgs->exitFlag == 0) printf("> Enter command (\"help\" for list of commands): \n");
+    if (DEBUGWRITEFILE) // debug messages
+    {
+        printf("[addToTempFile] Writing to file:\n");
+        printf("[addToTempFile] Abs. path: %s (%zu bytes shared)\n", fpath, shared);
+        printf("[addToTempFile] File name: %s\n", fpath + nameOffset);
+        printf("[addToTempFile] File size: %lu\n", fsize);
+        printf("[addToTempFile] File uid: %d\n", fuid);
+        printf("[addToTempFile] File type: %s\n", typeToText(ftype));
+    }
 
-        // set new alarm for periodic indexing
-        if (DEBUGTHREAD) printf("[threadWork] Setting alarm for %ld seconds and waiting for periodic indexing.\n", timeLeft);
-        alarm(timeLeft);
+    //write record to file, numeric fields go to the columns
+    writeIndex(record, length);
+    tempfile.records++;
+    
+    // the parent is the path up to the last slash, the lookup is skipped while it stays the same
+    size_t parentLength = pathLength;
+    while (parentLength > 0 && fpath[parentLength - 1] != '/') parentLength--;
+    if (parentLength > 0) parentLength--;
+    if (indexWriter.count == 0 || parentLength != indexWriter.lastParentLength || shared < parentLength)
+    {
+        indexWriter.lastParent = findDir(fpath, parentLength);
+        indexWriter.lastParentLength = parentLength;
+    }
+    if (ftype == dir)
+    {
+        uint32_t d = findDir(fpath, pathLength); // may move dirs
+        indexWriter.dirs[d].id = indexWriter.count;
+        indexWriter.dirs[d].parent = indexWriter.lastParent;
+    }
+    
+    uint64_t size = fsize;
+    uint32_t uid = fuid;
+    uint8_t type = ftype;
+    writeBuffered(&indexWriter.columns[WSIZES], &size, sizeof(uint64_t));
+    writeBuffered(&indexWriter.columns[WUIDS], &uid, sizeof(uint32_t));
+    writeBuffered(&indexWriter.columns[WTYPES], &type, sizeof(uint8_t));
+    writeBuffered(&indexWriter.columns[WPARENTS], &indexWriter.lastParent, sizeof(uint32_t));
+    
+    // aggregates are kept while writing so that summary queries never scan the records
+    if (ftype < TYPE_COUNT)
+    {
+        indexWriter.summary.typeCount[ftype]++;
+        indexWriter.summary.typeBytes[ftype] += fsize;
+    }
+    iowner_t* owner = findOwner(fuid);
+    owner->count++;
+    owner->bytes += fsize;
+    
+    memcpy(indexWriter.prevPath + shared, fpath + shared, pathLength - shared);
+    indexWriter.prevLength = pathLength;
+    indexWriter.count++;
+
+    if (DEBUGWRITEFILE) printf("[addToTempFile] Finished writing %zu bytes\n", length);
+}
+int compareOwners(const void* a, const void* b)
+{
+    const iowner_t *x = (const iowner_t*) a, *y = (const iowner_t*) b;
+    
+    // empty slots sort last
+    if ((x->count == 0) != (y->count == 0)) return x->count == 0 ? 1 : -1;
+    return (x->uid > y->uid) - (x->uid < y->uid);
+}
+int compareDirkeys(const void* a, const void* b)
+{
+    const idirkey_t *x = (const idirkey_t*) a, *y = (const idirkey_t*) b;
+    
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return (x->dir > y->dir) - (x->dir < y->dir);
+}
+void writeTree(iheader_t* header) // directory sections, numbers the directories of the parents column in preorder
+{
+    uint64_t n = indexWriter.count, ndirs = indexWriter.ndirs, next = 0, top = 0;
+    uint64_t *first, *subdirs, *order, *stack;
+    uint32_t *up, *pre;
+    idir_t* dirs;
+    idirkey_t* keys;
+    breader_t parents, types, sizes;
+    xsorter_t children;
+    xsize_t pair;
+    
+    if ((up = (uint32_t*) malloc(ndirs * sizeof(uint32_t) + 1)) == NULL) ERR("malloc");
+    if ((pre = (uint32_t*) malloc(ndirs * sizeof(uint32_t) + 1)) == NULL) ERR("malloc");
+    if ((first = (uint64_t*) calloc(ndirs + 1, sizeof(uint64_t))) == NULL) ERR("calloc");
+    if ((subdirs = (uint64_t*) malloc(ndirs * sizeof(uint64_t) + 1)) == NULL) ERR("malloc");
+    if ((order = (uint64_t*) malloc(ndirs * sizeof(uint64_t) + 1)) == NULL) ERR("malloc");
+    if ((stack = (uint64_t*) malloc(ndirs * sizeof(uint64_t) + 1)) == NULL) ERR("malloc");
+    if ((dirs = (idir_t*) calloc(ndirs + 1, sizeof(idir_t))) == NULL) ERR("calloc");
+    if ((keys = (idirkey_t*) malloc(ndirs * sizeof(idirkey_t) + 1)) == NULL) ERR("malloc");
+    indexWriter.preorder = pre;
+    
+    // a directory's parent is the directory of its record, one without a record is a root (the indexed directory)
+    for (uint64_t d = 0; d < ndirs; d++)
+    {
+        up[d] = indexWriter.dirs[d].id == INDEX_NODIR ? NO_PARENT : indexWriter.dirs[d].parent;
+        if (up[d] != NO_PARENT) first[up[d] + 1]++;
+    }
+    for (uint64_t d = 0; d < ndirs; d++) first[d + 1] += first[d];
+    for (uint64_t d = 0; d < ndirs; d++) stack[d] = first[d];
+    for (uint64_t d = 0; d < ndirs; d++)
+        if (up[d] != NO_PARENT) subdirs[stack[up[d]]++] = d;
+    
+    // preorder numbers make every subtree a range of directories, parents always come first
+    for (uint64_t root = 0; root < ndirs; root++)
+    {
+        if (up[root] != NO_PARENT) continue;
+        stack[top++] = root;
+        while (top > 0)
+        {
+            uint64_t d = stack[--top];
+            pre[d] = next;
+            order[next++] = d;
+            for (uint64_t k = first[d + 1]; k > first[d]; k--) stack[top++] = subdirs[k - 1];
+        }
+    }
+    
+    for (uint64_t i = 0; i < ndirs; i++)
+    {
+        uint64_t d = order[i];
+        dirs[i].id = indexWriter.dirs[d].id;
+        dirs[i].parent = up[d] == NO_PARENT ? NO_PARENT : pre[up[d]];
+        keys[i] = (idirkey_t){indexWriter.dirs[d].hash, i};
+    }
+    
+    // records count in their own directory first, then each directory is added to its parent from the bottom up
+    // the spilled columns are read once, the records are sorted by directory within the memory budget meanwhile
+    initSorter(&children, "children");
+    pthread_cleanup_push(freeSorter, &children);
+    openReader(&parents, columnTemps[WPARENTS]);
+    openReader(&types, columnTemps[WTYPES]);
+    openReader(&sizes, columnTemps[WSIZES]);
+    for (uint64_t id = 0; id < n; id++)
+    {
+        uint32_t parent;
+        uint8_t type;
+        uint64_t size;
+        
+        if (readBuffered(&parents, &parent, sizeof(uint32_t)) != sizeof(uint32_t)) ERR("read");
+        if (readBuffered(&types, &type, sizeof(uint8_t)) != sizeof(uint8_t)) ERR("read");
+        if (readBuffered(&sizes, &size, sizeof(uint64_t)) != sizeof(uint64_t)) ERR("read");
+        
+        idir_t* d = &dirs[pre[parent]];
+        addPair(&children, pre[parent], id);
+        d->children++;
+        d->typeCount[type]++;
+        if (type == dir) continue;
+        d->files++;
+        d->bytes += size;
+    }
+    closeReader(&parents);
+    closeReader(&types);
+    closeReader(&sizes);
+    for (uint64_t i = ndirs; i > 0; i--)
+    {
+        idir_t *d = &dirs[i - 1], *parent;
+        if (d->parent == NO_PARENT) continue;
+        parent = &dirs[d->parent];
+        parent->descendants += d->descendants + 1;
+        parent->files += d->files;
+        parent->bytes += d->bytes;
+        for (int type = 0; type < TYPE_COUNT; type++) parent->typeCount[type] += d->typeCount[type];
+    }
+    
+    // children of all directories in preorder, so a subtree's records are one range as well
+    for (uint64_t i = 0, total = 0; i < ndirs; i++)
+    {
+        dirs[i].firstChild = total;
+        total += dirs[i].children;
+    }
+    qsort(keys, ndirs, sizeof(idirkey_t), compareDirkeys);
+    
+    alignIndex(sizeof(uint64_t));
+    header->sections[SEC_DIRS].offset = sizeof(iheader_t) + indexWriter.offset;
+    header->sections[SEC_DIRS].length = ndirs * sizeof(idir_t);
+    writeIndex(dirs, ndirs * sizeof(idir_t));
+    header->sections[SEC_DIRKEYS].offset = sizeof(iheader_t) + indexWriter.offset;
+    header->sections[SEC_DIRKEYS].length = ndirs * sizeof(idirkey_t);
+    writeIndex(keys, ndirs * sizeof(idirkey_t));
+    header->sections[SEC_CHILDREN].offset = sizeof(iheader_t) + indexWriter.offset;
+    header->sections[SEC_CHILDREN].length = n * sizeof(uint64_t);
+    sortPairs(&children);
+    while (nextPair(&children, &pair)) writeIndex(&pair.id, sizeof(uint64_t));
+    pthread_cleanup_pop(1);
+    
+    if (DEBUGWRITEFILE) printf("[writeTree] %lu directories\n", ndirs);
+    
+    free(up);
+    free(first);
+    free(subdirs);
+    free(order);
+    free(stack);
+    free(dirs);
+    free(keys);
+}
+void freeDirs(void)
+{
+    for (uint64_t d = 0; d < indexWriter.ndirs; d++) free(indexWriter.dirs[d].path);
+    free(indexWriter.dirs);
+    free(indexWriter.dirslots);
+    free(indexWriter.preorder);
+    indexWriter.dirs = NULL;
+    indexWriter.dirslots = NULL;
+    indexWriter.preorder = NULL;
+    indexWriter.ndirs = indexWriter.capdirs = indexWriter.capdirslots = 0;
+}
+void endIndex(const ibase_t* base, const uint64_t* hidden) // base and its records hidden by a delta, NULL for a whole index
+{
+    iheader_t header;
+    uint64_t nrestarts = (indexWriter.count + INDEX_RESTART - 1) / INDEX_RESTART;
+    struct { int section; enum wcolumn column; } columns[] = {
+        {SEC_SIZES, WSIZES},
+        {SEC_UIDS, WUIDS},
+        {SEC_TYPES, WTYPES},
+        {SEC_PARENTS, WPARENTS}};
+    
+    // spilled columns are read back from their files
+    for (int column = 0; column < WCOLUMNS; column++)
+    {
+        flushWriter(&indexWriter.columns[column]);
+        discardWriter(&indexWriter.columns[column]);
+    }
+    
+    memset(&header, 0, sizeof(iheader_t));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.endian = INDEX_ENDIAN;
+    header.version = INDEX_VERSION;
+    header.restart = INDEX_RESTART;
+    header.count = indexWriter.count;
+    pthread_once(&typesOnce, initTypes);
+    header.registry = typeTrie.registry;
+    header.sections[SEC_RECORDS].offset = sizeof(iheader_t);
+    header.sections[SEC_RECORDS].length = indexWriter.offset;
+    
+    // restart table is an array of 64 bit offsets, aligned for direct access
+    alignIndex(sizeof(uint64_t));
+    header.sections[SEC_RESTARTS].offset = sizeof(iheader_t) + indexWriter.offset;
+    header.sections[SEC_RESTARTS].length = nrestarts * sizeof(uint64_t);
+    writeIndex(indexWriter.restarts, nrestarts * sizeof(uint64_t));
+    
+    writeTree(&header);
+    
+    // columns start on a cache line so vector loads of a mapped index never split one
+    for (int i = 0; i < sizeof(columns) / sizeof(columns[0]); i++)
+    {
+        alignIndex(INDEX_ALIGN);
+        header.sections[columns[i].section].offset = sizeof(iheader_t) + indexWriter.offset;
+        header.sections[columns[i].section].length = indexWriter.count * columnWidths[columns[i].column];
+        copyColumn(columns[i].column, columns[i].column == WPARENTS ? indexWriter.preorder : NULL);
+    }
+    for (int column = 0; column < WCOLUMNS; column++) remove(columnTemps[column]);
+    
+    // summary is the footer of the file, followed by the owners sorted by uid, an empty tree has no table of them
+    if (indexWriter.capowners > 0) qsort(indexWriter.owners, indexWriter.capowners, sizeof(iowner_t), compareOwners);
+    indexWriter.summary.created = time(NULL);
+    alignIndex(sizeof(uint64_t));
+    header.sections[SEC_SUMMARY].offset = sizeof(iheader_t) + indexWriter.offset;
+    header.sections[SEC_SUMMARY].length = sizeof(isummary_t) + indexWriter.summary.owners * sizeof(iowner_t);
+    writeIndex(&indexWriter.summary, sizeof(isummary_t));
+    writeIndex(indexWriter.owners, indexWriter.summary.owners * sizeof(iowner_t));
+    
+    // a delta ends with the index it changes and the records of it that are not there as they were
+    if (base != NULL)
+    {
+        alignIndex(sizeof(uint64_t));
+        header.sections[SEC_BASE].offset = sizeof(iheader_t) + indexWriter.offset;
+        header.sections[SEC_BASE].length = sizeof(ibase_t);
+        writeIndex(base, sizeof(ibase_t));
+        header.sections[SEC_HIDDEN].offset = sizeof(iheader_t) + indexWriter.offset;
+        header.sections[SEC_HIDDEN].length = base->hidden * sizeof(uint64_t);
+        writeIndex(hidden, base->hidden * sizeof(uint64_t));
+    }
+    
+    header.checksum = indexWriter.crc;
+    flushWriter(&tempfile);
+    if (pwrite(tempfile.fd, &header, sizeof(iheader_t), 0) != sizeof(iheader_t)) ERR("pwrite");
+    
+    if (DEBUGWRITEFILE) printf("[endIndex] %lu records of %lu owners in %lu bytes\n", indexWriter.count, indexWriter.summary.owners, indexWriter.offset);
+    
+    free(indexWriter.restarts);
+    free(indexWriter.owners);
+    freeDirs();
+    indexWriter.restarts = NULL;
+    indexWriter.owners = NULL;
+}
+bool checkHeader(const iheader_t* header, size_t length) // returns false if file is not a valid index
+{
+    if (length < sizeof(iheader_t)) return false;
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) return false;
+    if (header->endian != INDEX_ENDIAN || header->version != INDEX_VERSION) return false;
+    pthread_once(&typesOnce, initTypes);
+    if (header->registry != typeTrie.registry) return false; // types numbered by other FILE_TYPES
+    if (header->sections[SEC_RESTARTS].length != (header->count + INDEX_RESTART - 1) / INDEX_RESTART * sizeof(uint64_t)) return false;
+    if (header->sections[SEC_SIZES].length != header->count * sizeof(uint64_t)) return false;
+    if (header->sections[SEC_UIDS].length != header->count * sizeof(uint32_t)) return false;
+    if (header->sections[SEC_TYPES].length != header->count * sizeof(uint8_t)) return false;
+    if (header->sections[SEC_SUMMARY].length < sizeof(isummary_t)) return false;
+    if (header->sections[SEC_PARENTS].length != header->count * sizeof(uint32_t)) return false;
+    if (header->sections[SEC_DIRS].length % sizeof(idir_t) != 0) return false;
+    if (header->sections[SEC_DIRKEYS].length != header->sections[SEC_DIRS].length / sizeof(idir_t) * sizeof(idirkey_t)) return false;
+    if (header->sections[SEC_CHILDREN].length != header->count * sizeof(uint64_t)) return false;
+    if (header->sections[SEC_BASE].length != 0 && header->sections[SEC_BASE].length != sizeof(ibase_t)) return false;
+    if (header->sections[SEC_HIDDEN].length % sizeof(uint64_t) != 0) return false;
+    
+    for (int i = 0; i < INDEX_SECTIONS; i++)
+        if (header->sections[i].offset + header->sections[i].length > length) return false;
+    
+    return true;
+}
+bool mapIndex(index_t* index, const char* pathf, int advice) // maps the index file read-only
+{
+    int fd;
+    struct stat s;
+    
+    memset(index, 0, sizeof(index_t));
+    index->pathf = pathf;
+    
+    if ((fd = open(pathf, O_RDONLY)) < 0) return false;
+    if (fstat(fd, &s)) ERR("fstat");
+    
+    // mapping stays valid after the indexer renames a new index over this file
+    if (s.st_size > 0 && (index->base = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) ERR("mmap");
+    if (close(fd)) ERR("close");
+    if (s.st_size == 0) return false;
+    index->length = s.st_size;
+    
+    index->header = (const iheader_t*) index->base;
+    if (!checkHeader(index->header, index->length))
+    {
+        unmapIndex(index);
+        return false;
+    }
+    
+    index->records = index->base + index->header->sections[SEC_RECORDS].offset;
+    index->end = index->records + index->header->sections[SEC_RECORDS].length;
+    index->restarts = (const uint64_t*) (index->base + index->header->sections[SEC_RESTARTS].offset);
+    index->sizes = (const uint64_t*) (index->base + index->header->sections[SEC_SIZES].offset);
+    index->uids = (const uint32_t*) (index->base + index->header->sections[SEC_UIDS].offset);
+    index->types = index->base + index->header->sections[SEC_TYPES].offset;
+    index->summary = (const isummary_t*) (index->base + index->header->sections[SEC_SUMMARY].offset);
+    index->owners = (const iowner_t*) (index->summary + 1);
+    index->parents = (const uint32_t*) (index->base + index->header->sections[SEC_PARENTS].offset);
+    index->dirs = (const idir_t*) (index->base + index->header->sections[SEC_DIRS].offset);
+    index->ndirs = index->header->sections[SEC_DIRS].length / sizeof(idir_t);
+    index->dirkeys = (const idirkey_t*) (index->base + index->header->sections[SEC_DIRKEYS].offset);
+    index->children = (const uint64_t*) (index->base + index->header->sections[SEC_CHILDREN].offset);
+    
+    if (index->header->sections[SEC_SUMMARY].length != sizeof(isummary_t) + index->summary->owners * sizeof(iowner_t))
+    {
+        unmapIndex(index);
+        return false;
+    }
+    
+    pthread_once(&kernelsOnce, initKernels);
+    if (madvise(index->base, index->length, advice)) ERR("madvise");
+    return true;
+}
+bool openIndex(index_t* index, const char* pathf, int advice) // maps index for a query, reports errors
+{
+    if (mapCurrent(index, pathf, advice)) return true;
+    
+    printf("--Index file \"%s\" is missing, damaged or of an older format. Run \"index\" to rebuild it.\n", pathf);
+    return false;
+}
+void unmapIndex(index_t* index)
+{
+    // a view of an index and its delta owns the mappings of both
+    if (index->parts != NULL)
+    {
+        index_t* parts = (index_t*) index->parts;
+        for (int part = 0; part < index->nparts; part++) unmapIndex(&parts[part]);
+        free(parts);
+        freeView(index);
+        return;
+    }
+    
+    for (int kind = 0; kind < XKINDS; kind++)
+        if (index->secondary[kind].base != NULL && munmap((void*) index->secondary[kind].base, index->secondary[kind].length)) ERR("munmap");
+    if (index->base != NULL && munmap(index->base, index->length)) ERR("munmap");
+    memset(index->secondary, 0, sizeof(index->secondary));
+    index->base = NULL;
+}
+bool mapCurrent(index_t* index, const char* pathf, int advice) // maps the index with its secondary indexes and the delta the watcher wrote next to it
+{
+    index_t delta, *parts;
+    const ibase_t* base;
+    const uint64_t* hidden;
+    char* deltaPath;
+    bool changed;
+    
+    // the delta is mapped first, so that one written for an older index file is never used with the file that replaced it
+    if (asprintf(&deltaPath, "%s%s", pathf, DELTA_SUFFIX) < 0) ERR("asprintf");
+    changed = mapIndex(&delta, deltaPath, advice);
+    free(deltaPath);
+    if (!mapIndex(index, pathf, advice))
+    {
+        if (changed) unmapIndex(&delta);
+        return false;
+    }
+    for (int kind = 0; kind < XKINDS; kind++) mapSecondary(index, kind);
+    if (!changed) return true;
+    
+    // the delta names the index it changes by checksum, as a secondary index does
+    base = (const ibase_t*) (delta.base + delta.header->sections[SEC_BASE].offset);
+    hidden = (const uint64_t*) (delta.base + delta.header->sections[SEC_HIDDEN].offset);
+    changed = delta.header->sections[SEC_BASE].length == sizeof(ibase_t) && base->checksum == index->header->checksum && base->count == index->header->count
+              && delta.header->sections[SEC_HIDDEN].length == base->hidden * sizeof(uint64_t);
+    for (uint64_t i = 0; changed && i < base->hidden; i++) changed = hidden[i] < base->count;
+    if (!changed)
+    {
+        unmapIndex(&delta);
+        return true;
+    }
+    
+    if ((parts = (index_t*) malloc(2 * sizeof(index_t))) == NULL) ERR("malloc");
+    delta.pathf = pathf;
+    parts[0] = delta;
+    parts[1] = *index;
+    deltaView(index, parts);
+    return true;
+}
+int64_t findDirectory(const index_t* index, const char* path) // number of directory path, -1 if it is not in the index
+{
+    uint64_t hash = hashPath(path), lo = 0, hi = index->ndirs;
+    size_t length = strlen(path);
+    icursor_t cursor;
+    finfo_t fileinfo;
+    
+    while (lo < hi)
+    {
+        uint64_t mid = (lo + hi) / 2;
+        if (index->dirkeys[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    
+    // the hash is checked against the path of the directory's record, or of a record in a root
+    firstRecord(&cursor, index);
+    for (; lo < index->ndirs && index->dirkeys[lo].hash == hash; lo++)
+    {
+        const idir_t* d;
+        if (index->dirkeys[lo].dir >= index->ndirs) break;
+        d = &index->dirs[index->dirkeys[lo].dir];
+        if (d->id != INDEX_NODIR)
+        {
+            if (seekRecord(&cursor, d->id, &fileinfo) && strcmp(fileinfo.path, path) == 0) return index->dirkeys[lo].dir;
+        }
+        else if (d->children > 0 && seekRecord(&cursor, index->children[d->firstChild], &fileinfo))
+        {
+            if (strncmp(fileinfo.path, path, length) == 0 && fileinfo.path[length] == '/' && strchr(fileinfo.path + length + 1, '/') == NULL) return index->dirkeys[lo].dir;
+        }
+    }
+    
+    return -1;
+}
+void firstRecord(icursor_t* cursor, const index_t* index)
+{
+    cursor->index = index;
+    if (index->parts != NULL)
+    {
+        enterPart(cursor, 0);
+        return;
+    }
+    cursor->segment = index;
+    cursor->first = 0;
+    cursor->p = index->records;
+    cursor->next = 0;
+    cursor->pathLength = 0;
+}
+void enterPart(icursor_t* cursor, int part) // moves the cursor of a view to the start of its part
+{
+    cursor->segment = &cursor->index->parts[part];
+    cursor->first = 0;
+    for (int earlier = 0; earlier < part; earlier++) cursor->first += cursor->index->parts[earlier].header->count;
+    cursor->p = cursor->segment->records;
+    cursor->next = 0;
+    cursor->pathLength = 0;
+}
+bool decodeRecord(icursor_t* cursor, finfo_t* fileinfo) // next record of the segment, false after its last one
+{
+    const unsigned char* p = cursor->p;
+    
+    if (cursor->next == cursor->segment->header->count) return false;
+    
+    // only the suffix of the path is copied, numbers are decoded in place
+    uint64_t shared = getVarint(&p);
+    uint64_t suffix = getVarint(&p);
+    if (shared > cursor->pathLength || shared + suffix >= MAX_PATH || p + suffix >= cursor->segment->end)
+    {
+        fprintf(stderr, "WARNING! Index record %lu is damaged. Stopping...\n", cursor->next);
+        return false;
+    }
+    memcpy(cursor->path + shared, p, suffix);
+    p += suffix;
+    cursor->pathLength = shared + suffix;
+    cursor->path[cursor->pathLength] = '\0';
+    
+    uint64_t nameOffset = getVarint(&p);
+    fileinfo->path = cursor->path;
+    fileinfo->name = cursor->path + (nameOffset <= cursor->pathLength ? nameOffset : cursor->pathLength);
+    fileinfo->nameLength = cursor->path + cursor->pathLength - fileinfo->name;
+    fileinfo->size = cursor->segment->sizes[cursor->next];
+    fileinfo->uid = cursor->segment->uids[cursor->next];
+    fileinfo->type = cursor->segment->types[cursor->next];
+    
+    cursor->p = p;
+    cursor->next++;
+    return true;
+}
+bool nextRecord(icursor_t* cursor, finfo_t* fileinfo) // returns false after last record
+{
+    const index_t* view = cursor->index;
+    
+    if (view->parts == NULL) return decodeRecord(cursor, fileinfo);
+    
+    // a view goes on from part to part, past the records an earlier part replaced or removed
+    for (;;)
+    {
+        if (cursor->next == cursor->segment->header->count)
+        {
+            if (cursor->segment == &view->parts[view->nparts - 1]) return false;
+            enterPart(cursor, cursor->segment - view->parts + 1);
+            continue;
+        }
+        if (!decodeRecord(cursor, fileinfo)) return false;
+        if (!isHidden(view, cursor->first + cursor->next - 1)) return true;
+    }
+}
+bool isHidden(const index_t* view, uint64_t id) // record id of a view is replaced or removed by an earlier part
+{
+    return view->hidden != NULL && (view->hidden[id / 64] >> (id % 64) & 1);
+}
+bool seekRecord(icursor_t* cursor, uint64_t n, finfo_t* fileinfo) // decodes record n from the closest restart point
+{
+    const index_t* view = cursor->index;
+    
+    // a view numbers the records of each part after those of the parts before it
+    if (view->parts != NULL)
+    {
+        int part = 0;
+        for (uint64_t first = 0; part < view->nparts - 1 && n >= first + view->parts[part].header->count; part++) first += view->parts[part].header->count;
+        if (cursor->segment != &view->parts[part]) enterPart(cursor, part);
+        n -= cursor->first;
+    }
+    
+    uint64_t block = n / INDEX_RESTART;
+    
+    if (n >= cursor->segment->header->count) return false;
+    
+    // records up to the next restart point are decoded forward, anything else starts over from a restart point
+    if (cursor->next > n || cursor->next < block * INDEX_RESTART)
+    {
+        cursor->p = cursor->segment->records + cursor->segment->restarts[block];
+        cursor->next = block * INDEX_RESTART;
+        cursor->pathLength = 0;
+    }
+    
+    while (cursor->next <= n)
+        if (!decodeRecord(cursor, fileinfo)) return false;
+    
+    return true;
+}
+bool verifyIndex(const char* pathf) // checks header and checksum of the whole file
+{
+    index_t index;
+    bool valid;
+    
+    if (!mapIndex(&index, pathf, MADV_SEQUENTIAL)) return false;
+    
+    valid = crc32(0, index.base + sizeof(iheader_t), index.length - sizeof(iheader_t)) == index.header->checksum;
+    
+    unmapIndex(&index);
+    return valid;
+}
+void greater64Scalar(const uint64_t* column, uint64_t n, uint64_t value, uint64_t* bitmap)
+{
+    for (uint64_t i = 0; i < n; i++)
+        bitmap[i / 64] |= (uint64_t)(column[i] > value) << (i % 64);
+}
+void equal32Scalar(const uint32_t* column, uint64_t n, uint32_t value, uint64_t* bitmap)
+{
+    for (uint64_t i = 0; i < n; i++)
+        bitmap[i / 64] |= (uint64_t)(column[i] == value) << (i % 64);
+}
+bool matchScalar(const matcher_t* matcher, const char* name, size_t n)
+{
+    size_t length = matcher->length;
+    
+    if (length == 0) return true;
+    char first = matcher->part[0], last = matcher->part[length - 1];
+    for (size_t i = 0; i + length <= n; i++)
+    {
+        char a = name[i], b = name[i + length - 1];
+        if (matcher->fold) a = tolower((unsigned char) a), b = tolower((unsigned char) b);
+        if (a == first && b == last && matchAt(matcher, name + i)) return true;
+    }
+    
+    return false;
+}
+#if HAVE_X86
+// vector kernels fill whole 64 bit words of the bitmap and leave the tail to the scalar ones
+__attribute__((target("sse4.2"))) void greater64Sse(const uint64_t* column, uint64_t n, uint64_t value, uint64_t* bitmap)
+{
+    // there is no unsigned compare, flipping the sign bit of both sides makes the signed one work
+    const __m128i bias = _mm_set1_epi64x(INT64_MIN);
+    const __m128i v = _mm_set1_epi64x(value ^ INT64_MIN);
+    uint64_t words = n / 64;
+    
+    for (uint64_t w = 0; w < words; w++)
+    {
+        uint64_t word = 0;
+        for (int k = 0; k < 64; k += 2)
+        {
+            __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(column + w * 64 + k)), bias);
+            word |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(x, v))) << k;
+        }
+        bitmap[w] = word;
+    }
+    greater64Scalar(column + words * 64, n % 64, value, bitmap + words);
+}
+__attribute__((target("sse4.2"))) void equal32Sse(const uint32_t* column, uint64_t n, uint32_t value, uint64_t* bitmap)
+{
+    const __m128i v = _mm_set1_epi32(value);
+    uint64_t words = n / 64;
+    
+    for (uint64_t w = 0; w < words; w++)
+    {
+        uint64_t word = 0;
+        for (int k = 0; k < 64; k += 4)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*)(column + w * 64 + k));
+            word |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, v))) << k;
+        }
+        bitmap[w] = word;
+    }
+    equal32Scalar(column + words * 64, n % 64, value, bitmap + words);
+}
+__attribute__((target("sse4.2"))) bool matchSse(const matcher_t* matcher, const char* name, size_t n)
+{
+    size_t length = matcher->length;
+    
+    if (length == 0) return true;
+    if (length > n) return false;
+    
+    // folding sets bit 5 of every byte, that never hides a match and matchAt() rejects the extra candidates
+    const __m128i fold = _mm_set1_epi8(matcher->fold ? 0x20 : 0);
+    const __m128i first = _mm_or_si128(_mm_set1_epi8(matcher->part[0]), fold);
+    const __m128i last = _mm_or_si128(_mm_set1_epi8(matcher->part[length - 1]), fold);
+    
+    // blocks of 16 candidate positions, bytes read past the name are masked off
+    for (size_t i = 0; i + length <= n; i += 16)
+    {
+        __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i*)(name + i)), fold);
+        __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i*)(name + i + length - 1)), fold);
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        
+        if (n - length - i < 15) mask &= (2u << (n - length - i)) - 1;
+        for (; mask != 0; mask &= mask - 1)
+            if (matchAt(matcher, name + i + __builtin_ctz(mask))) return true;
+    }
+    
+    return false;
+}
+__attribute__((target("avx2"))) void greater64Avx2(const uint64_t* column, uint64_t n, uint64_t value, uint64_t* bitmap)
+{
+    const __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i v = _mm256_set1_epi64x(value ^ INT64_MIN);
+    uint64_t words = n / 64;
+    
+    for (uint64_t w = 0; w < words; w++)
+    {
+        uint64_t word = 0;
+        for (int k = 0; k < 64; k += 4)
+        {
+            __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(column + w * 64 + k)), bias);
+            word |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, v))) << k;
+        }
+        bitmap[w] = word;
+    }
+    greater64Scalar(column + words * 64, n % 64, value, bitmap + words);
+}
+__attribute__((target("avx2"))) void equal32Avx2(const uint32_t* column, uint64_t n, uint32_t value, uint64_t* bitmap)
+{
+    const __m256i v = _mm256_set1_epi32(value);
+    uint64_t words = n / 64;
+    
+    for (uint64_t w = 0; w < words; w++)
+    {
+        uint64_t word = 0;
+        for (int k = 0; k < 64; k += 8)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(column + w * 64 + k));
+            word |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, v))) << k;
+        }
+        bitmap[w] = word;
+    }
+    equal32Scalar(column + words * 64, n % 64, value, bitmap + words);
+}
+__attribute__((target("avx2"))) bool matchAvx2(const matcher_t* matcher, const char* name, size_t n)
+{
+    size_t length = matcher->length;
+    
+    if (length == 0) return true;
+    if (length > n) return false;
+    
+    const __m256i fold = _mm256_set1_epi8(matcher->fold ? 0x20 : 0);
+    const __m256i first = _mm256_or_si256(_mm256_set1_epi8(matcher->part[0]), fold);
+    const __m256i last = _mm256_or_si256(_mm256_set1_epi8(matcher->part[length - 1]), fold);
+    
+    for (size_t i = 0; i + length <= n; i += 32)
+    {
+        __m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(name + i)), fold);
+        __m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(name + i + length - 1)), fold);
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        
+        if (n - length - i < 31) mask &= (2u << (n - length - i)) - 1;
+        for (; mask != 0; mask &= mask - 1)
+            if (matchAt(matcher, name + i + __builtin_ctz(mask))) return true;
+    }
+    
+    return false;
+}
+#endif
+void initKernels(void) // picks column scan functions at runtime
+{
+    kernels = (kernels_t){greater64Scalar, equal32Scalar, matchScalar, "scalar"};
+    
+#if HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels = (kernels_t){greater64Avx2, equal32Avx2, matchAvx2, "avx2"};
+    else if (__builtin_cpu_supports("sse4.2"))
+        kernels = (kernels_t){greater64Sse, equal32Sse, matchSse, "sse4.2"};
+#endif
+    
+    if (DEBUGMAIN) printf("[initKernels] Using %s column kernels\n", kernels.name);
+}
+void writeFile(int fd, const void* buf, size_t length)
+{
+    for (size_t done = 0; done < length; )
+    {
+        ssize_t state;
+        if ((state = write(fd, (const char*)buf + done, length - done)) <= 0) ERR("write");
+        done += state;
+    }
+}
+void writeXheader(bwriter_t* writer, const index_t* index, uint64_t count)
+{
+    xheader_t header;
+    
+    memset(&header, 0, sizeof(xheader_t));
+    memcpy(header.magic, XINDEX_MAGIC, sizeof(XINDEX_MAGIC));
+    header.endian = INDEX_ENDIAN;
+    header.version = INDEX_VERSION;
+    header.checksum = index->header->checksum;
+    header.count = count;
+    writeBuffered(writer, &header, sizeof(xheader_t));
+}
+int compareSizes(const void* a, const void* b)
+{
+    const xsize_t *x = (const xsize_t*) a, *y = (const xsize_t*) b;
+    
+    if (x->size != y->size) return x->size < y->size ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+int compareIds(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    
+    return (x > y) - (x < y);
+}
+void initSorter(xsorter_t* sorter, const char* name) // pairs are kept in memory up to half the memory budget
+{
+    memset(sorter, 0, sizeof(xsorter_t));
+    sorter->name = name;
+    
+    // the other half is left to the directory tables and the buffers of the writers
+    sorter->limit = memoryBudget / 2 / sizeof(xsize_t);
+}
+void addPair(xsorter_t* sorter, uint64_t key, uint64_t id)
+{
+    if (sorter->count == sorter->limit) spillRun(sorter);
+    
+    // memory grows with the pairs, a small tree never takes the whole budget
+    if (sorter->count == sorter->cap)
+    {
+        sorter->cap = sorter->cap ? 2 * sorter->cap : 4096;
+        if (sorter->cap > sorter->limit) sorter->cap = sorter->limit;
+        if ((sorter->pairs = (xsize_t*) realloc(sorter->pairs, sorter->cap * sizeof(xsize_t))) == NULL) ERR("realloc");
+    }
+    sorter->pairs[sorter->count++] = (xsize_t){key, id};
+}
+void runPath(const xsorter_t* sorter, int run, char* path) // path[MAX_FILE] of a run file
+{
+    snprintf(path, MAX_FILE, "./.temp-%s-%d", sorter->name, run);
+}
+void spillRun(xsorter_t* sorter) // sorts the collected pairs and writes them as the next run
+{
+    bwriter_t run;
+    char path[MAX_FILE];
+    
+    qsort(sorter->pairs, sorter->count, sizeof(xsize_t), compareSizes);
+    
+    // runs are only read back by this indexing, so they are not synced
+    runPath(sorter, sorter->nruns++, path);
+    openWriter(&run, path, 0600);
+    writeBuffered(&run, sorter->pairs, sorter->count * sizeof(xsize_t));
+    flushWriter(&run);
+    discardWriter(&run);
+    
+    if (DEBUGWRITEFILE) printf("[spillRun] %lu pairs spilled to %s\n", sorter->count, path);
+    sorter->count = 0;
+}
+void openRuns(xsorter_t* sorter, int first, int last) // starts merging runs first to last - 1
+{
+    char path[MAX_FILE];
+    
+    sorter->nreaders = last - first;
+    sorter->nheap = 0;
+    if ((sorter->readers = (breader_t*) calloc(sorter->nreaders, sizeof(breader_t))) == NULL) ERR("calloc");
+    if ((sorter->heads = (xsize_t*) malloc(sorter->nreaders * sizeof(xsize_t))) == NULL) ERR("malloc");
+    if ((sorter->heap = (int*) malloc(sorter->nreaders * sizeof(int))) == NULL) ERR("malloc");
+    
+    for (int r = 0; r < sorter->nreaders; r++)
+    {
+        runPath(sorter, first + r, path);
+        openReader(&sorter->readers[r], path);
+        if (readBuffered(&sorter->readers[r], &sorter->heads[r], sizeof(xsize_t)) == sizeof(xsize_t)) sorter->heap[sorter->nheap++] = r;
+    }
+    
+    // runs are few, insertion into the heap one by one is enough
+    for (int i = 1; i < sorter->nheap; i++)
+        for (int j = i; j > 0 && compareSizes(&sorter->heads[sorter->heap[j]], &sorter->heads[sorter->heap[(j - 1) / 2]]) < 0; j = (j - 1) / 2)
+        {
+            int swap = sorter->heap[j];
+            sorter->heap[j] = sorter->heap[(j - 1) / 2];
+            sorter->heap[(j - 1) / 2] = swap;
+        }
+}
+bool mergePair(xsorter_t* sorter, xsize_t* pair) // smallest head of the runs being merged, false once all are done
+{
+    int* heap = sorter->heap;
+    
+    if (sorter->nheap == 0) return false;
+    *pair = sorter->heads[heap[0]];
+    
+    // the reader of the smallest head moves on, or leaves the heap at the end of its run
+    if (readBuffered(&sorter->readers[heap[0]], &sorter->heads[heap[0]], sizeof(xsize_t)) != sizeof(xsize_t)) heap[0] = heap[--sorter->nheap];
+    for (int i = 0, child; (child = 2 * i + 1) < sorter->nheap; i = child)
+    {
+        if (child + 1 < sorter->nheap && compareSizes(&sorter->heads[heap[child + 1]], &sorter->heads[heap[child]]) < 0) child++;
+        if (compareSizes(&sorter->heads[heap[i]], &sorter->heads[heap[child]]) <= 0) break;
+        int swap = heap[i]; heap[i] = heap[child]; heap[child] = swap;
+    }
+    
+    return true;
+}
+void closeRuns(xsorter_t* sorter)
+{
+    for (int r = 0; r < sorter->nreaders; r++) closeReader(&sorter->readers[r]);
+    free(sorter->readers);
+    free(sorter->heads);
+    free(sorter->heap);
+    sorter->readers = NULL;
+    sorter->heads = NULL;
+    sorter->heap = NULL;
+    sorter->nreaders = sorter->nheap = 0;
+}
+void sortPairs(xsorter_t* sorter) // ends collecting, the pairs are then returned in order by nextPair()
+{
+    char path[MAX_FILE];
+    xsize_t pair;
+    
+    // pairs that fit the budget are sorted in place and never touch the disk
+    if (sorter->nruns == 0)
+    {
+        if (sorter->count > 0) qsort(sorter->pairs, sorter->count, sizeof(xsize_t), compareSizes); // nothing added, nothing allocated
+        sorter->next = 0;
+        return;
+    }
+    if (sorter->count > 0) spillRun(sorter);
+    free(sorter->pairs);
+    sorter->pairs = NULL;
+    sorter->count = sorter->cap = 0;
+    
+    // too many runs for one merge are merged in groups into longer runs first
+    while (sorter->nruns - sorter->merged > MERGE_FANIN)
+    {
+        bwriter_t run;
+        
+        openRuns(sorter, sorter->merged, sorter->merged + MERGE_FANIN);
+        runPath(sorter, sorter->nruns++, path);
+        openWriter(&run, path, 0600);
+        while (mergePair(sorter, &pair)) writeBuffered(&run, &pair, sizeof(xsize_t));
+        flushWriter(&run);
+        discardWriter(&run);
+        closeRuns(sorter);
+        
+        for (int r = sorter->merged; r < sorter->merged + MERGE_FANIN; r++)
+        {
+            runPath(sorter, r, path);
+            remove(path);
+        }
+        sorter->merged += MERGE_FANIN;
+    }
+    
+    openRuns(sorter, sorter->merged, sorter->nruns);
+}
+bool nextPair(xsorter_t* sorter, xsize_t* pair)
+{
+    if (sorter->nruns > 0) return mergePair(sorter, pair);
+    
+    if (sorter->next == sorter->count) return false;
+    *pair = sorter->pairs[sorter->next++];
+    return true;
+}
+void rewindPairs(xsorter_t* sorter) // nextPair() starts again from the smallest pair
+{
+    sorter->next = 0;
+    if (sorter->nruns == 0) return;
+    
+    closeRuns(sorter);
+    openRuns(sorter, sorter->merged, sorter->nruns);
+}
+void freeSorter(void* voidSorter) // also cleanup function, removes the runs
+{
+    xsorter_t* sorter = voidSorter;
+    char path[MAX_FILE];
+    
+    closeRuns(sorter);
+    for (int r = sorter->merged; r < sorter->nruns; r++)
+    {
+        runPath(sorter, r, path);
+        remove(path);
+    }
+    free(sorter->pairs);
+    memset(sorter, 0, sizeof(xsorter_t));
+    malloc_trim(0); // buffers this large may have come from the heap, which would otherwise keep them
+}
+const unsigned char* dropPages(const unsigned char* from, const unsigned char* to) // releases the whole pages of a mapping between from and to, returns where the next call starts
+{
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t) from + page - 1) & ~(page - 1), last = (uintptr_t) to & ~(page - 1);
+    
+    // pages of a file mapping stay in the page cache, they only stop counting for this process
+    if (last <= first) return from;
+    if (madvise((void*) first, last - first, MADV_DONTNEED)) ERR("madvise");
+    return (const unsigned char*) last;
+}
+void dropDecoded(const icursor_t* cursor, const unsigned char** dropped) // dropPages() of records and columns behind the cursor, dropped[DROP_SECTIONS]
+{
+    const index_t* index = cursor->index;
+    
+    // a first call starts each section at its beginning
+    if (dropped[0] == NULL)
+    {
+        dropped[0] = index->records;
+        dropped[1] = (const unsigned char*) index->sizes;
+        dropped[2] = (const unsigned char*) index->uids;
+        dropped[3] = index->types;
+    }
+    dropped[0] = dropPages(dropped[0], cursor->p);
+    dropped[1] = dropPages(dropped[1], (const unsigned char*) (index->sizes + cursor->next));
+    dropped[2] = dropPages(dropped[2], (const unsigned char*) (index->uids + cursor->next));
+    dropped[3] = dropPages(dropped[3], index->types + cursor->next);
+}
+void buildSizeIndex(const index_t* index, bwriter_t* writer) // record numbers sorted by size
+{
+    uint64_t n = index->header->count;
+    const unsigned char* dropped = (const unsigned char*) index->sizes;
+    xsorter_t sorter;
+    xsize_t pair;
+    
+    // file holds the sorted sizes for binary search, then the record numbers in the same order
+    initSorter(&sorter, "size");
+    for (uint64_t i = 0; i < n; i++)
+    {
+        addPair(&sorter, index->sizes[i], i);
+        if ((i + 1) % DROP_CHUNK == 0) dropped = dropPages(dropped, (const unsigned char*) (index->sizes + i + 1));
+    }
+    sortPairs(&sorter);
+    
+    writeXheader(writer, index, n);
+    while (nextPair(&sorter, &pair)) writeBuffered(writer, &pair.size, sizeof(uint64_t));
+    rewindPairs(&sorter);
+    while (nextPair(&sorter, &pair)) writeBuffered(writer, &pair.id, sizeof(uint64_t));
+    
+    freeSorter(&sorter);
+}
+void buildOwnerIndex(const index_t* index, bwriter_t* writer) // record numbers of each owner
+{
+    uint64_t n = index->header->count, nowners = index->summary->owners;
+    const unsigned char* dropped = (const unsigned char*) index->uids;
+    xowner_t* owners;
+    xsorter_t sorter;
+    xsize_t pair;
+    
+    // owners of the summary are sorted by uid and already know their counts
+    if ((owners = (xowner_t*) calloc(nowners + 1, sizeof(xowner_t))) == NULL) ERR("calloc");
+    for (uint64_t o = 0, first = 0; o < nowners; first += owners[o++].count)
+    {
+        owners[o].uid = index->owners[o].uid;
+        owners[o].first = first;
+        owners[o].count = index->owners[o].count;
+    }
+    
+    // posting lists are the records sorted by owner, each one stays in record order
+    initSorter(&sorter, "owner");
+    for (uint64_t i = 0; i < n; i++)
+    {
+        addPair(&sorter, index->uids[i], i);
+        if ((i + 1) % DROP_CHUNK == 0) dropped = dropPages(dropped, (const unsigned char*) (index->uids + i + 1));
+    }
+    sortPairs(&sorter);
+    
+    writeXheader(writer, index, nowners);
+    writeBuffered(writer, owners, nowners * sizeof(xowner_t));
+    while (nextPair(&sorter, &pair)) writeBuffered(writer, &pair.id, sizeof(uint64_t));
+    
+    freeSorter(&sorter);
+    free(owners);
+}
+int nameTrigrams(const char* name, uint32_t* trigrams) // distinct folded trigrams of name, returns their number
+{
+    int n = 0, length = strlen(name);
+    
+    // folded trigrams serve case sensitive queries too, candidates are verified anyway
+    for (int i = 0; i + 3 <= length; i++)
+    {
+        uint32_t trigram = (unsigned char) tolower(name[i]) << 16 | (unsigned char) tolower(name[i+1]) << 8 | (unsigned char) tolower(name[i+2]);
+        int j;
+        for (j = 0; j < n && trigrams[j] != trigram; j++);
+        if (j == n) trigrams[n++] = trigram;
+    }
+    
+    return n;
+}
+xtrigram_t* findTrigram(tritable_t* table, uint32_t trigram) // inserts if missing
+{
+    uint64_t i;
+    
+    if (2 * table->used >= table->cap) // keep table at most half full
+    {
+        xtrigram_t* old = table->slots;
+        uint64_t oldcap = table->cap;
+        
+        table->cap = oldcap ? 2 * oldcap : 4096;
+        if ((table->slots = (xtrigram_t*) calloc(table->cap, sizeof(xtrigram_t))) == NULL) ERR("calloc");
+        for (uint64_t j = 0; j < oldcap; j++)
+        {
+            if (old[j].count == 0) continue;
+            for (i = (old[j].trigram * 2654435761u) & (table->cap - 1); table->slots[i].count != 0; i = (i + 1) & (table->cap - 1));
+            table->slots[i] = old[j];
+        }
+        free(old);
+    }
+    
+    for (i = (trigram * 2654435761u) & (table->cap - 1); table->slots[i].count != 0; i = (i + 1) & (table->cap - 1))
+        if (table->slots[i].trigram == trigram) return &table->slots[i];
+    
+    table->slots[i].trigram = trigram;
+    table->used++;
+    return &table->slots[i];
+}
+int compareTrigrams(const void* a, const void* b)
+{
+    const xtrigram_t *x = (const xtrigram_t*) a, *y = (const xtrigram_t*) b;
+    
+    // empty slots sort last
+    if ((x->count == 0) != (y->count == 0)) return x->count == 0 ? 1 : -1;
+    return (x->trigram > y->trigram) - (x->trigram < y->trigram);
+}
+void buildTrigramIndex(const index_t* index, bwriter_t* writer) // posting lists of record numbers by name trigrams
+{
+    tritable_t table = {NULL, 0, 0};
+    icursor_t cursor;
+    finfo_t fileinfo;
+    uint32_t trigrams[MAX_FILE];
+    uint64_t *end, *previous, offset = 0, passes = 0;
+    unsigned char *postings = NULL, width[10];
+    const unsigned char* dropped[DROP_SECTIONS] = {NULL};
+    size_t maxVarint = putVarint(width, index->header->count); // no delta needs more bytes
+    
+    // first pass counts the records of each trigram to size the posting lists
+    firstRecord(&cursor, index);
+    for (uint64_t id = 0; nextRecord(&cursor, &fileinfo); id++)
+    {
+        int n = nameTrigrams(fileinfo.name, trigrams);
+        for (int i = 0; i < n; i++) findTrigram(&table, trigrams[i])->count++;
+        if ((id + 1) % DROP_CHUNK == 0) dropDecoded(&cursor, dropped);
+    }
+    
+    // directory is sorted by trigram and written first, its offsets are filled in once the lists are
+    if (table.cap > 0) qsort(table.slots, table.cap, sizeof(xtrigram_t), compareTrigrams); // names too short for a trigram leave no table
+    if ((end = (uint64_t*) malloc((table.used + 1) * sizeof(uint64_t))) == NULL) ERR("malloc");
+    if ((previous = (uint64_t*) calloc(table.used + 1, sizeof(uint64_t))) == NULL) ERR("calloc");
+    writeXheader(writer, index, table.used);
+    writeBuffered(writer, table.slots, table.used * sizeof(xtrigram_t));
+    
+    // lists of a range of trigrams are built in memory with room for the longest varints, one more pass for each range that fits the budget
+    for (uint64_t low = 0, high; low < table.used; low = high, passes++)
+    {
+        uint64_t total = 0;
+        for (high = low; high < table.used && (high == low || total + (uint64_t) table.slots[high].count * maxVarint <= memoryBudget / 2); high++)
+        {
+            table.slots[high].offset = end[high] = total;
+            total += (uint64_t) table.slots[high].count * maxVarint;
+        }
+        if ((postings = (unsigned char*) realloc(postings, total + 1)) == NULL) ERR("realloc");
+        
+        // each record number is appended to its lists as the delta to the previous one
+        memset(dropped, 0, sizeof(dropped));
+        firstRecord(&cursor, index);
+        for (uint64_t id = 0; nextRecord(&cursor, &fileinfo); id++)
+        {
+            int n = nameTrigrams(fileinfo.name, trigrams);
+            for (int i = 0; i < n; i++)
+            {
+                uint64_t lo = low, hi = high;
+                if (trigrams[i] < table.slots[low].trigram || trigrams[i] > table.slots[high - 1].trigram) continue;
+                while (hi - lo > 1)
+                {
+                    uint64_t mid = (lo + hi) / 2;
+                    if (table.slots[mid].trigram <= trigrams[i]) lo = mid;
+                    else hi = mid;
+                }
+                end[lo] += putVarint(postings + end[lo], id - previous[lo]);
+                previous[lo] = id;
+            }
+            if ((id + 1) % DROP_CHUNK == 0) dropDecoded(&cursor, dropped);
+        }
+        
+        // lists are compacted while written
+        for (uint64_t t = low; t < high; t++)
+        {
+            uint64_t length = end[t] - table.slots[t].offset;
+            writeBuffered(writer, postings + table.slots[t].offset, length);
+            table.slots[t].offset = offset;
+            offset += length;
+        }
+    }
+    
+    flushWriter(writer);
+    if (pwrite(writer->fd, table.slots, table.used * sizeof(xtrigram_t), sizeof(xheader_t)) != table.used * sizeof(xtrigram_t)) ERR("pwrite");
+    
+    if (DEBUGWRITEFILE) printf("[buildTrigramIndex] %lu trigrams, %lu bytes of posting lists in %lu passes\n", table.used, offset, passes);
+    
+    free(previous);
+    free(end);
+    free(postings);
+    free(table.slots);
+}
+void buildSecondary(const char* pathf) // writes secondary indexes of a new index file next to it
+{
+    index_t index;
+    char* path;
+    bwriter_t writer;
+    struct { const char* temp; void (*build)(const index_t*, bwriter_t*); } secondary[XKINDS] = {
+        [XSIZE] = {"./.temp-size", buildSizeIndex},
+        [XOWNER] = {"./.temp-owner", buildOwnerIndex},
+        [XTRIGRAM] = {"./.temp-tri", buildTrigramIndex}};
+    
+    if (!mapIndex(&index, pathf, MADV_SEQUENTIAL)) return;
+    
+    for (int kind = 0; kind < XKINDS; kind++)
+    {
+        openWriter(&writer, secondary[kind].temp, 0666);
+        secondary[kind].build(&index, &writer);
+        flushWriter(&writer);
+        discardWriter(&writer);
+        
+        if (asprintf(&path, "%s%s", pathf, xsuffixes[kind]) < 0) ERR("asprintf");
+        if (rename(secondary[kind].temp, path)) ERR("rename");
+        free(path);
+    }
+    
+    if (DEBUGWRITEFILE) printf("[buildSecondary] Secondary indexes of %lu records written.\n", index.header->count);
+    unmapIndex(&index);
+}
+void mapSecondary(index_t* index, enum xkind kind) // attaches secondary index file if it belongs to index
+{
+    char* path;
+    int fd;
+    struct stat s;
+    void* base;
+    const xheader_t* header;
+    
+    if (asprintf(&path, "%s%s", index->pathf, xsuffixes[kind]) < 0) ERR("asprintf");
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) return;
+    
+    if (fstat(fd, &s)) ERR("fstat");
+    if (s.st_size < sizeof(xheader_t))
+    {
+        if (close(fd)) ERR("close");
+        return;
+    }
+    if ((base = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) ERR("mmap");
+    if (close(fd)) ERR("close");
+    
+    // secondary index is rewritten after the index, in between it belongs to the previous one
+    header = (const xheader_t*) base;
+    if (memcmp(header->magic, XINDEX_MAGIC, sizeof(XINDEX_MAGIC)) != 0 || header->endian != INDEX_ENDIAN ||
+        header->version != INDEX_VERSION || header->checksum != index->header->checksum)
+    {
+        if (munmap(base, s.st_size)) ERR("munmap");
+        return;
+    }
+    
+    index->secondary[kind].base = base;
+    index->secondary[kind].length = s.st_size;
+}
+uint64_t* lookupNames(const index_t* index, const char* part, uint64_t* count) // candidates for a name part or NULL
+{
+    uint32_t trigrams[MAX_FILE];
+    const xtrigram_t* lists[MAX_FILE];
+    const void* base;
+    const xheader_t* header;
+    const xtrigram_t* directory;
+    const unsigned char *postings, *p;
+    uint64_t* ids = NULL;
+    size_t length;
+    int n;
+    
+    *count = 0;
+    
+    // parts shorter than a trigram are matched by a scan
+    if ((n = nameTrigrams(part, trigrams)) == 0) return NULL;
+    if ((base = index->secondary[XTRIGRAM].base) == NULL) return NULL;
+    length = index->secondary[XTRIGRAM].length;
+    header = (const xheader_t*) base;
+    directory = (const xtrigram_t*) (header + 1);
+    postings = (const unsigned char*) (directory + header->count);
+    if (length < sizeof(xheader_t) + header->count * sizeof(xtrigram_t)) goto stale;
+    
+    for (int i = 0; i < n; i++)
+    {
+        uint64_t lo = 0, hi = header->count;
+        while (lo < hi)
+        {
+            uint64_t mid = (lo + hi) / 2;
+            if (directory[mid].trigram < trigrams[i]) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == header->count || directory[lo].trigram != trigrams[i]) // no name has this trigram
+        {
+            if ((ids = (uint64_t*) malloc(sizeof(uint64_t))) == NULL) ERR("malloc");
+            goto stale;
+        }
+        if (directory[lo].offset > length) goto stale;
+        lists[i] = &directory[lo];
+    }
+    
+    // shortest list gives the candidates, every other list can only remove some
+    for (int i = 1; i < n; i++)
+        for (int j = i; j > 0 && lists[j]->count < lists[j-1]->count; j--)
+        {
+            const xtrigram_t* swap = lists[j];
+            lists[j] = lists[j-1];
+            lists[j-1] = swap;
+        }
+    
+    if ((ids = (uint64_t*) malloc(lists[0]->count * sizeof(uint64_t) + 1)) == NULL) ERR("malloc");
+    p = postings + lists[0]->offset;
+    for (uint64_t k = 0, id = 0; k < lists[0]->count; k++) ids[k] = id += getVarint(&p);
+    *count = lists[0]->count;
+    
+    for (int i = 1; i < n && *count > 0; i++)
+    {
+        uint64_t kept = 0, k = 0, id = 0;
+        p = postings + lists[i]->offset;
+        if (lists[i]->count > 0) id = getVarint(&p), k = 1;
+        
+        for (uint64_t c = 0; c < *count; c++)
+        {
+            while (id < ids[c] && k < lists[i]->count) id += getVarint(&p), k++;
+            if (id == ids[c]) ids[kept++] = ids[c];
+        }
+        *count = kept;
+    }
+    
+    if (DEBUGMAIN) printf("[lookupNames] %d trigrams, %lu candidates\n", n, *count);
+    
+stale:
+    return ids;
+}
+uint64_t* lookupRecords(const index_t* index, void* value, int option, uint64_t* count) // sorted candidate records or NULL if a scan is better
+{
+    uint64_t n = index->header->count, first = 0, lo, hi;
+    uint64_t* ids = NULL;
+    const void* base;
+    const xheader_t* header;
+    const uint64_t* postings;
+    size_t length;
+    
+    if (index->parts != NULL) return viewRecords(index, value, option, count);
+    if (option == 1) return lookupNames(index, ((matcher_t*) value)->part, count);
+    
+    *count = 0;
+    if ((base = index->secondary[option == 0 ? XSIZE : XOWNER].base) == NULL) return NULL;
+    length = index->secondary[option == 0 ? XSIZE : XOWNER].length;
+    header = (const xheader_t*) base;
+    
+    if (option == 0) // largerthan, matches are the tail of the sorted sizes
+    {
+        const uint64_t* sizes = (const uint64_t*) (header + 1);
+        if (header->count != n || length != sizeof(xheader_t) + 2 * n * sizeof(uint64_t)) goto stale;
+        postings = sizes + n;
+        
+        for (lo = 0, hi = n; lo < hi; )
+        {
+            uint64_t mid = (lo + hi) / 2;
+            if (sizes[mid] > (uint64_t) *(long*)value) hi = mid;
+            else lo = mid + 1;
+        }
+        first = lo;
+        *count = n - lo;
+    }
+    else // owner, posting list of the uid
+    {
+        const xowner_t* owners = (const xowner_t*) (header + 1);
+        if (length != sizeof(xheader_t) + header->count * sizeof(xowner_t) + n * sizeof(uint64_t)) goto stale;
+        postings = (const uint64_t*) (owners + header->count);
+        
+        for (lo = 0, hi = header->count; lo < hi; )
+        {
+            uint64_t mid = (lo + hi) / 2;
+            if (owners[mid].uid < *(long*)value) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo < header->count && owners[lo].uid == *(long*)value)
+        {
+            first = owners[lo].first;
+            *count = owners[lo].count;
+            if (first + *count > n) goto stale;
+        }
+    }
+    
+    // large results are cheaper to get from a column scan, which also keeps them in path order
+    if (*count <= n / XINDEX_SCAN)
+    {
+        if ((ids = (uint64_t*) malloc(*count * sizeof(uint64_t) + 1)) == NULL) ERR("malloc");
+        memcpy(ids, postings + first, *count * sizeof(uint64_t));
+        if (option == 0) qsort(ids, *count, sizeof(uint64_t), compareIds);
+    }
+    
+stale:
+    return ids;
+}
+uint64_t* viewRecords(const index_t* view, void* value, int option, uint64_t* count) // candidates of a view from the secondary index of its last part, NULL for a scan
+{
+    const index_t* last = &view->parts[view->nparts - 1];
+    uint64_t *ids, *found, nfound, first = 0;
+    
+    *count = 0;
+    for (int part = 0; part < view->nparts - 1; part++) first += view->parts[part].header->count;
+    
+    // every record of the other parts is a candidate, a delta is small next to the index it changes
+    if (first > view->header->count / XINDEX_SCAN || (found = lookupRecords(last, value, option, &nfound)) == NULL) return NULL;
+    if ((ids = (uint64_t*) malloc((first + nfound) * sizeof(uint64_t) + 1)) == NULL) ERR("malloc");
+    for (uint64_t id = 0; id < first; id++)
+        if (!isHidden(view, id)) ids[(*count)++] = id;
+    for (uint64_t i = 0; i < nfound; i++)
+        if (!isHidden(view, first + found[i])) ids[(*count)++] = first + found[i];
+    
+    free(found);
+    return ids;
+}
+void dequePush(deque_t* dq, dirtask_t task) // owner pushes newest task
+{
+    pthread_mutex_lock(&dq->mx);
+    
+    if (dq->count == dq->cap) // buffer full - double it and unwrap the circular part
+    {
+        dirtask_t* tasks;
+        if ((tasks = (dirtask_t*) malloc(2 * dq->cap * sizeof(dirtask_t))) == NULL) ERR("malloc");
+        for (int i = 0; i < dq->count; i++) tasks[i] = dq->tasks[(dq->head + i) % dq->cap];
+        free(dq->tasks);
+        dq->tasks = tasks;
+        dq->head = 0;
+        dq->cap *= 2;
+    }
+    
+    dq->tasks[(dq->head + dq->count) % dq->cap] = task;
+    dq->count++;
+    
+    pthread_mutex_unlock(&dq->mx);
+}
+bool dequePop(deque_t* dq, dirtask_t* task) // owner pops newest task (depth first)
+{
+    bool found = false;
+    
+    pthread_mutex_lock(&dq->mx);
+    if (dq->count > 0)
+    {
+        dq->count--;
+        *task = dq->tasks[(dq->head + dq->count) % dq->cap];
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->mx);
+    
+    return found;
+}
+bool dequeSteal(deque_t* dq, dirtask_t* task) // thief takes oldest task (largest subtree)
+{
+    bool found = false;
+    
+    pthread_mutex_lock(&dq->mx);
+    if (dq->count > 0)
+    {
+        *task = dq->tasks[dq->head];
+        dq->head = (dq->head + 1) % dq->cap;
+        dq->count--;
+        found = true;
+    }
+    pthread_mutex_unlock(&dq->mx);
+    
+    return found;
+}
+void initQueue(bqueue_t* q, int producers)
+{
+    memset(q, 0, sizeof(bqueue_t));
+    if ((q->slots = (qslot_t*) malloc(PIPE_QUEUE * sizeof(qslot_t))) == NULL) ERR("malloc");
+    for (size_t i = 0; i < PIPE_QUEUE; i++) q->slots[i].seq = i;
+    q->mask = PIPE_QUEUE - 1;
+    q->producers = producers;
+}
+bool queueTryPush(bqueue_t* q, batch_t* batch) // lock-free, false if the queue is full
+{
+    size_t pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    qslot_t* slot;
+    
+    // a slot is free for position pos when its seq is pos, the position is claimed by moving head past it
+    for (;;)
+    {
+        slot = &q->slots[pos & q->mask];
+        long diff = (long)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        
+        if (diff == 0 && __atomic_compare_exchange_n(&q->head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        else if (diff < 0) return false; // slot still holds the batch of the previous round
+        else if (diff > 0) pos = __atomic_load_n(&q->head, __ATOMIC_RELAXED); // another producer took it
+    }
+    
+    slot->batch = batch;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE); // publish to consumers
+    return true;
+}
+bool queueTryPop(bqueue_t* q, batch_t** batch) // lock-free, false if the queue is empty
+{
+    size_t pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    qslot_t* slot;
+    
+    // a slot holds the batch of position pos when its seq is pos + 1
+    for (;;)
+    {
+        slot = &q->slots[pos & q->mask];
+        long diff = (long)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        
+        if (diff == 0 && __atomic_compare_exchange_n(&q->tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        else if (diff < 0) return false;
+        else if (diff > 0) pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    }
+    
+    *batch = slot->batch;
+    __atomic_store_n(&slot->seq, pos + q->mask + 1, __ATOMIC_RELEASE); // free for the next round
+    return true;
+}
+bool queuePush(walker_t* walker, bqueue_t* q, batch_t* batch) // waits while full, false if stopped
+{
+    // backpressure - a full queue holds the producer back until the next stage catches up
+    while (!queueTryPush(q, batch))
+    {
+        if (__atomic_load_n(&walker->stop, __ATOMIC_RELAXED)) return false;
+        __atomic_add_fetch(&q->fullWaits, 1, __ATOMIC_RELAXED);
+        sched_yield();
+    }
+    
+    long depth = (long)(__atomic_load_n(&q->head, __ATOMIC_RELAXED) - __atomic_load_n(&q->tail, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&q->pushed, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&q->depthSum, depth, __ATOMIC_RELAXED);
+    for (long max = __atomic_load_n(&q->maxDepth, __ATOMIC_RELAXED); depth > max; )
+        if (__atomic_compare_exchange_n(&q->maxDepth, &max, depth, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    return true;
+}
+bool queuePop(walker_t* walker, bqueue_t* q, batch_t** batch) // waits while empty, false once closed or stopped
+{
+    while (!queueTryPop(q, batch))
+    {
+        // producers push everything before they leave, so once none are left one more try decides
+        if (__atomic_load_n(&q->producers, __ATOMIC_ACQUIRE) == 0) return queueTryPop(q, batch);
+        if (__atomic_load_n(&walker->stop, __ATOMIC_RELAXED)) return false;
+        __atomic_add_fetch(&q->emptyWaits, 1, __ATOMIC_RELAXED);
+        pthread_testcancel(); // the serializer is the indexer thread, which is cancelled on quick exit
+        sched_yield();
+    }
+    return true;
+}
+void closeProducer(bqueue_t* q) // the queue is closed when its last producer is done
+{
+    __atomic_sub_fetch(&q->producers, 1, __ATOMIC_RELEASE);
+}
+batch_t* newBatch(const char* path) // empty batch for entries of directory path
+{
+    batch_t* batch;
+    
+    if ((batch = (batch_t*) malloc(sizeof(batch_t))) == NULL) ERR("malloc");
+    batch->count = 0;
+    batch->sniff = 0;
+    batch->dirfd = -1;
+    
+    // path is already absolute and resolved (the root by walkDir, the rest built here)
+    // so a child path is the parent path with its name appended, no realpath() is needed
+    batch->length = strlen(path);
+    if ((batch->path = (char*) malloc(batch->length + NAME_MAX + 2)) == NULL) ERR("malloc");
+    memcpy(batch->path, path, batch->length);
+    if (batch->length == 0 || batch->path[batch->length - 1] != '/') batch->path[batch->length++] = '/'; // root is "/"
+    
+    return batch;
+}
+void freeBatch(batch_t* batch)
+{
+    if (batch->dirfd >= 0 && close(batch->dirfd)) ERR("close");
+    free(batch->path);
+    free(batch);
+}
+void addEntry(batch_t* batch, const char* name, const struct stat* s, enum ftype ftype, bool sniff)
+{
+    entry_t* e = &batch->entries[batch->count];
+    
+    // only recognised types are indexed, but every sniffed regular file is remembered in the cache
+    e->sniff = sniff;
+    e->indexed = typeIndexed[ftype];
+    e->cached = S_ISREG(s->st_mode) && ftype != error; // unreadable files are retried next time
+    if (!e->sniff && !e->cached && !e->indexed) return;
+    strcpy(e->name, name);
+    
+    if (DEBUGINDEXING && e->indexed) printf("\n[addEntry] Abs. Path: %.*s%s \n", (int)batch->length, batch->path, e->name);
+    if (DEBUGINDEXING && e->indexed) printf("[addEntry] Size: %lo \n[addEntry] UID: %d\n", s->st_size, s->st_uid);
+    
+    e->uid = s->st_uid;
+    e->sig.dev = s->st_dev;
+    e->sig.ino = s->st_ino;
+    e->sig.mtime = s->st_mtim;
+    e->sig.size = s->st_size;
+    e->sig.type = ftype;
+    
+    batch->sniff += sniff;
+    batch->count++;
+}
+void passBatch(walker_t* walker, batch_t* batch, int dirfd) // hands a batch of directory dirfd to the next stage
+{
+    // batches of files known from the cache skip the classifiers
+    bqueue_t* q = batch->sniff > 0 ? &walker->classify : &walker->serialize;
+    
+    // classifiers open files relative to their directory, by path if the descriptor limit is reached
+    if (batch->sniff > 0) batch->dirfd = fcntl(dirfd, F_DUPFD_CLOEXEC, 0);
+    
+    __atomic_add_fetch(&walker->passed, 1, __ATOMIC_SEQ_CST); // before the serializer can see it
+    if (!queuePush(walker, q, batch)) freeBatch(batch); // stopped, nobody would write it
+}
+int statEntry(int dirfd, const char* name, struct stat* s) // lstat() of only the fields the index needs
+{
+    struct statx x;
+    
+    // a minimal mask lets file systems skip attributes that are expensive to get (glibc falls back to fstatat on old kernels)
+    if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT, STATX_TYPE|STATX_UID|STATX_SIZE|STATX_MTIME|STATX_INO, &x)) return -1;
+    
+    memset(s, 0, sizeof(struct stat));
+    s->st_mode = x.stx_mode;
+    s->st_uid = x.stx_uid;
+    s->st_size = x.stx_size;
+    s->st_ino = x.stx_ino;
+    s->st_dev = makedev(x.stx_dev_major, x.stx_dev_minor);
+    s->st_mtim.tv_sec = x.stx_mtime.tv_sec;
+    s->st_mtim.tv_nsec = x.stx_mtime.tv_nsec;
+    return 0;
+}
+void readDirectory(walker_t* walker, worker_t* worker, dirtask_t* task)
+{
+    struct stat s;
+    enum ftype ftype;
+    batch_t* batch;
+    long length;
+    int fd;
+    uint64_t start = nowNs(), statNs = 0, waitNs = 0, calls = 3, t; // open, close and the getdents64() that finds the end
+    
+    // unreadable directory, its record has already been added while reading its parent
+    if ((fd = open(task->path, O_RDONLY|O_DIRECTORY|O_CLOEXEC)) < 0) return;
+    batch = newBatch(task->path);
+    
+    // a large buffer reads most directories with one system call, a read error ends the directory like readdir() would
+    while (!__atomic_load_n(&walker->stop, __ATOMIC_RELAXED) && (length = syscall(SYS_getdents64, fd, worker->dents, DENTS_BUFFER)) > 0)
+    {
+        calls++;
+        for (long offset = 0; offset < length; offset += ((dent_t*)(worker->dents + offset))->reclen)
+        {
+            dent_t* dp = (dent_t*)(worker->dents + offset);
+            if (strcmp(dp->name, ".") == 0 || strcmp(dp->name, "..") == 0) continue;
+            
+            // only directories and regular files are indexed, the rest is skipped without a stat when d_type tells
+            if (dp->type != DT_DIR && dp->type != DT_REG && dp->type != DT_UNKNOWN)
+            {
+                __atomic_add_fetch(&walker->unstated, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            
+            // symbolic links are not followed (as with FTW_PHYS) and vanished entries are ignored
+            // the entry is looked up relative to the open directory instead of walking the whole path again
+            t = nowNs();
+            calls++;
+            bool vanished = statEntry(fd, dp->name, &s) != 0;
+            statNs += nowNs() - t;
+            if (vanished) continue;
+            
+            if (S_ISDIR(s.st_mode))
+            {
+                addEntry(batch, dp->name, &s, dir, false);
+                
+                // queue the subdirectory on own deque, idle workers will steal it
+                dirtask_t subdir = { NULL, task->level + 1 };
+                strcpy(batch->path + batch->length, dp->name);
+                if ((subdir.path = strdup(batch->path)) == NULL) ERR("strdup"); // free'd by the worker that reads it
+                __atomic_add_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST);
+                dequePush(&walker->deques[worker->id], subdir);
+            }
+            else if (S_ISREG(s.st_mode))
+            {
+                // the signature is read by a classifier only if the file is new or was modified since the last indexing
+                if ((ftype = cachedType(walker->cache, &s)) != error)
+                {
+                    __atomic_add_fetch(&walker->reused, 1, __ATOMIC_RELAXED);
+                    __atomic_add_fetch(&metrics.total.reused, 1, __ATOMIC_RELAXED);
+                }
+                addEntry(batch, dp->name, &s, ftype, ftype == error);
+            }
+            
+            if (batch->count == BATCH_MAX)
+            {
+                t = nowNs(); // waiting for a full queue is not counted as walking
+                passBatch(walker, batch, fd);
+                waitNs += nowNs() - t;
+                batch = newBatch(task->path);
+            }
+        }
+    }
+    
+    t = nowNs();
+    if (batch->count > 0) passBatch(walker, batch, fd);
+    else freeBatch(batch);
+    waitNs += nowNs() - t;
+    if (close(fd)) ERR("close");
+    
+    // one update per directory keeps the counters off the per entry path
+    __atomic_add_fetch(&metrics.total.dirs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&metrics.total.syscalls, calls, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&metrics.total.ns[MSTAT], statNs, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&metrics.total.ns[MWALK], nowNs() - start - statNs - waitNs, __ATOMIC_RELAXED);
+}
+void* walkWork(void* voidArgs)
+{
+    worker_t* worker = voidArgs;
+    walker_t* walker = worker->walker;
+    dirtask_t task;
+    
+    if ((worker->dents = (char*) malloc(DENTS_BUFFER)) == NULL) ERR("malloc");
+    
+    while (!__atomic_load_n(&walker->stop, __ATOMIC_RELAXED))
+    {
+        // no directory is started while a checkpoint is taken, the ones being read are finished first
+        if (__atomic_load_n(&walker->pause, __ATOMIC_SEQ_CST))
+        {
+            __atomic_add_fetch(&walker->parked, 1, __ATOMIC_SEQ_CST);
+            while (__atomic_load_n(&walker->pause, __ATOMIC_SEQ_CST) && !__atomic_load_n(&walker->stop, __ATOMIC_RELAXED)) sched_yield();
+            __atomic_sub_fetch(&walker->parked, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        
+        bool found = dequePop(&walker->deques[worker->id], &task);
+        
+        // own deque is empty - try to steal from the others
+        for (int i = 1; !found && i < walker->nthreads; i++)
+            found = dequeSteal(&walker->deques[(worker->id + i) % walker->nthreads], &task);
+        
+        if (found)
+        {
+            readDirectory(walker, worker, &task);
+            free(task.path);
+            __atomic_sub_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST);
+        }
+        else if (__atomic_load_n(&walker->pending, __ATOMIC_SEQ_CST) == 0) break; // whole tree is read
+        else sched_yield(); // other workers are still reading, wait for new directories
+    }
+    
+    free(worker->dents);
+    __atomic_add_fetch(&walker->parked, 1, __ATOMIC_SEQ_CST); // a finished walker never starts a directory again
+    closeProducer(&walker->classify);
+    closeProducer(&walker->serialize);
+    if (DEBUGTHREAD) printf("[walkWork] Walker %d finished.\n", worker->id);
+    return NULL;
+}
+bool initUring(uring_t* ring) // false if io_uring is not available, files are then read one by one
+{
+    memset(ring, 0, sizeof(uring_t));
+    ring->fd = -1;
+#if HAVE_URING
+    struct io_uring_params params;
+    struct io_uring_rsrc_register files;
+    
+    // raw system calls, so that there is no dependency on liburing
+    memset(&params, 0, sizeof(params));
+    if ((ring->fd = syscall(SYS_io_uring_setup, URING_ENTRIES, &params)) < 0) return false; // old kernel or disabled
+    
+    // both rings in one mapping, files opened straight into the fixed file table (5.19 and later)
+    memset(&files, 0, sizeof(files));
+    files.nr = BATCH_MAX;
+    files.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_FILES2, &files, sizeof(files)) < 0)
+    {
+        freeUring(ring);
+        return false;
+    }
+    
+    ring->ringsLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    if (params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) > ring->ringsLength)
+        ring->ringsLength = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesLength = params.sq_entries * sizeof(struct io_uring_sqe);
+    if ((ring->rings = mmap(NULL, ring->ringsLength, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING)) == MAP_FAILED) ERR("mmap");
+    if ((ring->sqes = mmap(NULL, ring->sqesLength, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES)) == MAP_FAILED) ERR("mmap");
+    
+    char* rings = ring->rings;
+    ring->sqHead = (unsigned*)(rings + params.sq_off.head);
+    ring->sqTail = (unsigned*)(rings + params.sq_off.tail);
+    ring->sqMask = *(unsigned*)(rings + params.sq_off.ring_mask);
+    ring->cqHead = (unsigned*)(rings + params.cq_off.head);
+    ring->cqTail = (unsigned*)(rings + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(rings + params.cq_off.cqes);
+    
+    // submission entries are always used in ring order
+    unsigned* array = (unsigned*)(rings + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) array[i] = i;
+    
+    if ((ring->sigs = (unsigned char*) malloc(BATCH_MAX * SIG_LENGTH)) == NULL) ERR("malloc");
+    
+    if (DEBUGINDEXING) printf("[initUring] io_uring with %u entries\n", params.sq_entries);
+    return true;
+#else
+    return false;
+#endif
+}
+void freeUring(uring_t* ring)
+{
+    if (ring->sqes && munmap(ring->sqes, ring->sqesLength)) ERR("munmap");
+    if (ring->rings && munmap(ring->rings, ring->ringsLength)) ERR("munmap");
+    if (ring->fd >= 0 && close(ring->fd)) ERR("close");
+    ring->fd = -1;
+    free(ring->sigs);
+    ring->sigs = NULL;
+}
+void sniffUring(uring_t* ring, batch_t* batch) // reads the signatures of a batch with all reads in flight at once
+{
+#if HAVE_URING
+    int files[BATCH_MAX], opened[BATCH_MAX], length[BATCH_MAX];
+    int nfiles = 0, flags = O_RDONLY|O_NOATIME; // fixed files have no descriptor, O_CLOEXEC is refused
+    uint64_t calls = 0, bytes = 0;
+    
+    for (int i = 0; i < batch->count; i++)
+        if (batch->entries[i].sniff) files[nfiles++] = i;
+    
+    // a second round without O_NOATIME for the files of other users that refused it
+    while (nfiles > 0)
+    {
+        unsigned tail = *ring->sqTail;
+        int total = 3 * nfiles, done = 0, retry = 0;
+        
+        // each file is a chain openat -> read -> close through slot k of the fixed file table
+        // the close is hard linked so that a failed or short read still releases the slot
+        for (int k = 0; k < nfiles; k++)
+        {
+            struct io_uring_sqe* sqe = &ring->sqes[tail++ & ring->sqMask];
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = batch->dirfd;
+            sqe->addr = (uintptr_t)batch->entries[files[k]].name;
+            sqe->open_flags = flags;
+            sqe->file_index = k + 1;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = 3 * k;
+            
+            sqe = &ring->sqes[tail++ & ring->sqMask];
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = k;
+            sqe->addr = (uintptr_t)(ring->sigs + k * SIG_LENGTH);
+            sqe->len = SIG_LENGTH;
+            sqe->flags = IOSQE_FIXED_FILE|IOSQE_IO_HARDLINK;
+            sqe->user_data = 3 * k + 1;
+            
+            sqe = &ring->sqes[tail++ & ring->sqMask];
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->file_index = k + 1;
+            sqe->user_data = 3 * k + 2;
+        }
+        __atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+        
+        // one system call submits the whole batch and waits for it
+        for (int submitted = 0; submitted < total; )
+        {
+            int state = syscall(SYS_io_uring_enter, ring->fd, total - submitted, total - submitted, IORING_ENTER_GETEVENTS, NULL, 0);
+            calls++;
+            if (state < 0 && errno != EINTR) ERR("io_uring_enter");
+            if (state > 0) submitted += state;
+        }
+        
+        while (done < total)
+        {
+            unsigned head = *ring->cqHead;
+            
+            if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+            {
+                if (syscall(SYS_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) ERR("io_uring_enter");
+                calls++;
+                continue;
+            }
+            for (; head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE); head++, done++)
+            {
+                struct io_uring_cqe* cqe = &ring->cqes[head & ring->cqMask];
+                if (cqe->user_data % 3 == 0) opened[cqe->user_data / 3] = cqe->res;
+                else if (cqe->user_data % 3 == 1) length[cqe->user_data / 3] = cqe->res;
+            }
+            __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+        }
+        
+        for (int k = 0; k < nfiles; k++)
+        {
+            entry_t* e = &batch->entries[files[k]];
+            
+            if (opened[k] == -EPERM && (flags & O_NOATIME)) files[retry++] = files[k];
+            else if (opened[k] < 0 || length[k] < 0) e->sig.type = error;
+            else e->sig.type = signatureType(ring->sigs + k * SIG_LENGTH, length[k]);
+            if (opened[k] >= 0 && length[k] > 0) bytes += length[k];
+        }
+        nfiles = retry;
+        flags &= ~O_NOATIME;
+    }
+    __atomic_add_fetch(&metrics.total.syscalls, calls, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&metrics.total.sniffedBytes, bytes, __ATOMIC_RELAXED);
+#endif
+}
+void sniffBatch(uring_t* ring, batch_t* batch) // finds the types of entries that need it
+{
+    if (ring->fd >= 0 && batch->dirfd >= 0) sniffUring(ring, batch);
+    else for (int i = 0; i < batch->count; i++)
+    {
+        entry_t* e = &batch->entries[i];
+        if (!e->sniff) continue;
+        
+        // blocking reads, the other classifiers keep going meanwhile
+        strcpy(batch->path + batch->length, e->name);
+        e->sig.type = batch->dirfd >= 0 ? getType(batch->dirfd, e->name) : getType(AT_FDCWD, batch->path);
+    }
+    
+    for (int i = 0; i < batch->count; i++)
+    {
+        entry_t* e = &batch->entries[i];
+        if (!e->sniff) continue;
+        
+        e->indexed = typeIndexed[e->sig.type];
+        e->cached = e->sig.type != error; // unreadable files are retried next time
+    }
+}
+void* classifyWork(void* voidWalker) // reads signatures of new and modified files
+{
+    walker_t* walker = voidWalker;
+    batch_t* batch;
+    uring_t ring;
+    
+    // without io_uring (old kernel or disabled) the files of a batch are read one after another
+    if (!initUring(&ring) && DEBUGINDEXING) printf("[classifyWork] io_uring not available, reading files one by one\n");
+    
+    // a slow open() or read() stalls only this classifier, walkers and the serializer keep going
+    while (queuePop(walker, &walker->classify, &batch))
+    {
+        uint64_t start = nowNs();
+        sniffBatch(&ring, batch);
+        __atomic_add_fetch(&walker->sniffed, batch->sniff, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&metrics.total.sniffed, batch->sniff, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&metrics.total.ns[MCLASSIFY], nowNs() - start, __ATOMIC_RELAXED);
+        
+        if (!queuePush(walker, &walker->serialize, batch)) freeBatch(batch);
+    }
+    
+    freeUring(&ring);
+    closeProducer(&walker->serialize);
+    if (DEBUGTHREAD) printf("[classifyWork] Classifier finished.\n");
+    return NULL;
+}
+void writeBatch(batch_t* batch) // serializer, the only writer of the temp files
+{
+    for (int i = 0; i < batch->count; i++)
+    {
+        entry_t* e = &batch->entries[i];
+        if (e->cached) addToCacheFile(&e->sig);
+        if (!e->indexed) continue;
+        
+        // the directory part of the buffer is already in place, only the name changes
+        strcpy(batch->path + batch->length, e->name);
+        addToTempFile(batch->path, e->name, e->sig.size, e->uid, e->sig.type);
+    }
+}
+void printQueue(const char* name, const bqueue_t* q)
+{
+    printf("[walkDir] %s queue: %ld batches, depth avg %.1f max %ld, producers waited %ld times, consumers %ld times\n",
+           name, q->pushed, q->pushed ? (double)q->depthSum / q->pushed : 0.0, q->maxDepth, q->fullWaits, q->emptyWaits);
+}
+void stopWalkers(void* voidWalker) // cleanup function for walker threads
+{
+    walker_t* walker = voidWalker;
+    dirtask_t task;
+    batch_t* batch;
+    
+    // workers are never cancelled, they check the stop flag and finish their directory or batch
+    __atomic_store_n(&walker->stop, 1, __ATOMIC_SEQ_CST);
+    for (; walker->joined < 2 * walker->nthreads; walker->joined++)
+        if (pthread_join(walker->tids[walker->joined], NULL)) ERR("pthread_join");
+    
+    for (int i = 0; i < walker->nthreads; i++)
+    {
+        while (dequePop(&walker->deques[i], &task)) free(task.path); // left over when cancelled
+        free(walker->deques[i].tasks);
+        pthread_mutex_destroy(&walker->deques[i].mx);
+    }
+    while (queueTryPop(&walker->classify, &batch)) freeBatch(batch);
+    while (queueTryPop(&walker->serialize, &batch)) freeBatch(batch);
+    if (walker->writing) freeBatch(walker->writing);
+    free(walker->classify.slots);
+    free(walker->serialize.slots);
+    free(walker->deques);
+    free(walker->tids);
+}
+void freeTasks(dirtask_t* tasks, uint64_t ntasks)
+{
+    for (uint64_t i = 0; i < ntasks; i++) free(tasks[i].path);
+    free(tasks);
+}
+void serializeBatch(walker_t* walker) // writes and frees the batch taken by the serializer
+{
+    uint64_t start = nowNs(), records = tempfile.records;
+    
+    writeBatch(walker->writing);
+    __atomic_add_fetch(&metrics.total.entries, tempfile.records - records, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&metrics.total.ns[MWRITE], nowNs() - start, __ATOMIC_RELAXED);
+    freeBatch(walker->writing);
+    walker->writing = NULL;
+    walker->written++;
+}
+void saveCheckpoint(const walker_t* walker) // frontier and committed length of every temp file, the walkers must be parked
+{
+    ckheader_t header;
+    bwriter_t writer;
+    uint64_t nrestarts = (indexWriter.count + INDEX_RESTART - 1) / INDEX_RESTART;
+    
+    // everything the checkpoint counts as written is on disk before the checkpoint is
+    flushWriter(&tempfile);
+    flushWriter(&cachefile);
+    if (fdatasync(tempfile.fd) || fdatasync(cachefile.fd)) ERR("fdatasync");
+    for (int column = 0; column < WCOLUMNS; column++)
+    {
+        flushWriter(&indexWriter.columns[column]);
+        if (fdatasync(indexWriter.columns[column].fd)) ERR("fdatasync");
+    }
+    
+    memset(&header, 0, sizeof(ckheader_t));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.endian = INDEX_ENDIAN;
+    header.version = INDEX_VERSION;
+    header.registry = typeTrie.registry;
+    header.stateSize = sizeof(iwriter_t);
+    header.index = tempfile.bytes;
+    for (int column = 0; column < WCOLUMNS; column++) header.columns[column] = indexWriter.columns[column].bytes;
+    header.cache = cachefile.bytes;
+    header.cacheRecords = cachefile.records;
+    for (int i = 0; i < walker->nthreads; i++) header.ntasks += walker->deques[i].count;
+    header.rootLength = strlen(walker->root);
+    header.pathfLength = strlen(walker->pathf);
+    
+    // writer state is saved as it is, the pointers in it are replaced by the arrays that follow when it is loaded
+    openWriter(&writer, CHECKPOINT_TEMP, 0600);
+    writeBuffered(&writer, &header, sizeof(ckheader_t));
+    writeBuffered(&writer, walker->root, header.rootLength);
+    writeBuffered(&writer, walker->pathf, header.pathfLength);
+    writeBuffered(&writer, &indexWriter, sizeof(iwriter_t));
+    writeBuffered(&writer, indexWriter.restarts, nrestarts * sizeof(uint64_t));
+    writeBuffered(&writer, indexWriter.owners, indexWriter.capowners * sizeof(iowner_t));
+    writeBuffered(&writer, indexWriter.dirs, indexWriter.ndirs * sizeof(wdir_t));
+    for (uint64_t d = 0; d < indexWriter.ndirs; d++) writeBuffered(&writer, indexWriter.dirs[d].path, indexWriter.dirs[d].length);
+    writeBuffered(&writer, indexWriter.dirslots, indexWriter.capdirslots * sizeof(uint64_t));
+    
+    // frontier is every directory still queued, oldest first
+    for (int i = 0; i < walker->nthreads; i++)
+        for (int k = 0; k < walker->deques[i].count; k++)
+        {
+            const dirtask_t* task = &walker->deques[i].tasks[(walker->deques[i].head + k) % walker->deques[i].cap];
+            uint32_t meta[2] = { task->level, strlen(task->path) };
+            writeBuffered(&writer, meta, sizeof(meta));
+            writeBuffered(&writer, task->path, meta[1]);
+        }
+    
+    // synced before it replaces the previous checkpoint, a crash leaves one or the other
+    closeWriter(&writer);
+    if (rename(CHECKPOINT_TEMP, CHECKPOINT_FILE)) ERR("rename");
+    
+    if (DEBUGINDEXING) printf("[saveCheckpoint] %lu records, %lu directories left\n", indexWriter.count, header.ntasks);
+}
+void checkpointWalk(walker_t* walker) // parks the walkers between directories, writes what they handed on and saves a checkpoint
+{
+    int state;
+    
+    __atomic_store_n(&walker->pause, 1, __ATOMIC_SEQ_CST);
+    
+    // a directory is then either written completely or still queued, so the deques are the whole frontier
+    while (__atomic_load_n(&walker->parked, __ATOMIC_SEQ_CST) < walker->nthreads || walker->written < __atomic_load_n(&walker->passed, __ATOMIC_SEQ_CST))
+    {
+        if (queueTryPop(&walker->serialize, &walker->writing)) serializeBatch(walker);
+        else
+        {
+            pthread_testcancel();
+            sched_yield();
+        }
+    }
+    
+    // a checkpoint is either saved completely or not at all
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    saveCheckpoint(walker);
+    pthread_setcancelstate(state, NULL);
+    
+    walker->checkpointed = time(NULL);
+    __atomic_store_n(&walker->pause, 0, __ATOMIC_SEQ_CST);
+}
+bool committedFile(const char* path, uint64_t length) // path is there with at least length bytes
+{
+    struct stat s;
+    return stat(path, &s) == 0 && (uint64_t) s.st_size >= length;
+}
+bool loadCheckpoint(const char* pathd, const char* pathf, dirtask_t** tasks, uint64_t* ntasks) // restores the temp files and writer of an interrupted indexing of the same tree, false to start over
+{
+    ckheader_t header;
+    iwriter_t state;
+    breader_t reader;
+    struct stat s;
+    char *root, stored[MAX_PATH];
+    uint64_t nrestarts, loaded = 0;
+    bool valid;
+    
+    if (access(CHECKPOINT_FILE, F_OK) || lstat(pathd, &s) || !S_ISDIR(s.st_mode)) return false;
+    if ((root = realpath(pathd, NULL)) == NULL) return false;
+    pthread_once(&typesOnce, initTypes);
+    openReader(&reader, CHECKPOINT_FILE);
+    
+    // only the same indexing is resumed, by a program writing the same format
+    valid = readBuffered(&reader, &header, sizeof(ckheader_t)) == sizeof(ckheader_t);
+    valid = valid && memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 && header.endian == INDEX_ENDIAN;
+    valid = valid && header.version == INDEX_VERSION && header.registry == typeTrie.registry && header.stateSize == sizeof(iwriter_t);
+    valid = valid && header.rootLength == strlen(root) && readBuffered(&reader, stored, header.rootLength) == header.rootLength && memcmp(stored, root, header.rootLength) == 0;
+    valid = valid && header.pathfLength == strlen(pathf) && readBuffered(&reader, stored, header.pathfLength) == header.pathfLength && memcmp(stored, pathf, header.pathfLength) == 0;
+    valid = valid && committedFile("./.temp", header.index) && committedFile("./.temp-cache", header.cache);
+    for (int column = 0; column < WCOLUMNS; column++) valid = valid && committedFile(columnTemps[column], header.columns[column]);
+    free(root);
+    if (!valid || readBuffered(&reader, &state, sizeof(iwriter_t)) != sizeof(iwriter_t))
+    {
+        closeReader(&reader);
+        return false;
+    }
+    
+    // arrays of the writer follow it in the order saveCheckpoint() wrote them
+    nrestarts = (state.count + INDEX_RESTART - 1) / INDEX_RESTART;
+    if ((state.restarts = (uint64_t*) malloc(state.caprestarts * sizeof(uint64_t) + 1)) == NULL) ERR("malloc");
+    if ((state.owners = (iowner_t*) malloc(state.capowners * sizeof(iowner_t) + 1)) == NULL) ERR("malloc");
+    if ((state.dirs = (wdir_t*) malloc(state.capdirs * sizeof(wdir_t) + 1)) == NULL) ERR("malloc");
+    if ((state.dirslots = (uint64_t*) malloc(state.capdirslots * sizeof(uint64_t) + 1)) == NULL) ERR("malloc");
+    if ((*tasks = (dirtask_t*) malloc(header.ntasks * sizeof(dirtask_t) + 1)) == NULL) ERR("malloc");
+    state.preorder = NULL;
+    *ntasks = 0;
+    
+    if (nrestarts > state.caprestarts || state.ndirs > state.capdirs) goto damaged;
+    if (readBuffered(&reader, state.restarts, nrestarts * sizeof(uint64_t)) != nrestarts * sizeof(uint64_t)) goto damaged;
+    if (readBuffered(&reader, state.owners, state.capowners * sizeof(iowner_t)) != state.capowners * sizeof(iowner_t)) goto damaged;
+    if (readBuffered(&reader, state.dirs, state.ndirs * sizeof(wdir_t)) != state.ndirs * sizeof(wdir_t)) goto damaged;
+    while (loaded < state.ndirs)
+    {
+        wdir_t* d = &state.dirs[loaded++];
+        if ((d->path = (char*) malloc(d->length + 1)) == NULL) ERR("malloc");
+        d->path[d->length] = '\0';
+        if (readBuffered(&reader, d->path, d->length) != d->length) goto damaged;
+    }
+    if (readBuffered(&reader, state.dirslots, state.capdirslots * sizeof(uint64_t)) != state.capdirslots * sizeof(uint64_t)) goto damaged;
+    for (; *ntasks < header.ntasks; (*ntasks)++)
+    {
+        dirtask_t* task = &(*tasks)[*ntasks];
+        uint32_t meta[2];
+        if (readBuffered(&reader, meta, sizeof(meta)) != sizeof(meta) || meta[1] >= MAX_PATH) goto damaged;
+        if ((task->path = (char*) malloc(meta[1] + 1)) == NULL) ERR("malloc");
+        task->level = meta[0];
+        task->path[meta[1]] = '\0';
+        if (readBuffered(&reader, task->path, meta[1]) != meta[1])
+        {
+            free(task->path);
+            goto damaged;
+        }
+    }
+    closeReader(&reader);
+    
+    // temp files are cut back to what the checkpoint counts as written, the rest is written again
+    free(indexWriter.restarts);
+    free(indexWriter.owners);
+    freeDirs();
+    indexWriter = state;
+    resumeWriter(&tempfile, "./.temp", header.index);
+    resumeWriter(&cachefile, "./.temp-cache", header.cache);
+    cachefile.records = header.cacheRecords;
+    for (int column = 0; column < WCOLUMNS; column++) resumeWriter(&indexWriter.columns[column], columnTemps[column], header.columns[column]);
+    
+    if (DEBUGINDEXING) printf("[loadCheckpoint] %lu records, %lu directories left\n", indexWriter.count, *ntasks);
+    return true;
+    
+damaged:
+    for (uint64_t d = 0; d < loaded; d++) free(state.dirs[d].path);
+    freeTasks(*tasks, *ntasks);
+    free(state.restarts);
+    free(state.owners);
+    free(state.dirs);
+    free(state.dirslots);
+    closeReader(&reader);
+    *tasks = NULL;
+    *ntasks = 0;
+    return false;
+}
+void walkDir(const char* pathd, const char* pathf, int nthreads, sigcache_t* cache, dirtask_t* frontier, uint64_t nfrontier) // frontier of a checkpoint or NULL to start at pathd
+{
+    walker_t walker;
+    worker_t workers[MAX_THREADS];
+    struct stat s;
+    char* root;
+    
+    if (lstat(pathd, &s))
+    {
+        printf("%s: cannot access\n", pathd);
+        freeTasks(frontier, nfrontier);
+        return;
+    }
+    
+    if (!S_ISDIR(s.st_mode)) // pathd is a single file
+    {
+        enum ftype ftype;
+        freeTasks(frontier, nfrontier); // only directories are checkpointed
+        const char* fname = strrchr(pathd, '/') ? strrchr(pathd, '/') + 1 : pathd;
+        
+        if (S_ISREG(s.st_mode) && typeIndexed[ftype = getType(AT_FDCWD, pathd)])
+            if ((root = realpath(pathd, NULL)) != NULL)
+            {
+                addToTempFile(root, fname, s.st_size, s.st_uid, ftype);
+                free(root);
+            }
+        return;
+    }
+    
+    // the root is the only path resolved, the paths below it are built by appending names
+    if ((root = realpath(pathd, NULL)) == NULL)
+    {
+        printf("%s: cannot access\n", pathd);
+        freeTasks(frontier, nfrontier);
+        return;
+    }
+    
+    // initialize walker shared by all worker threads
+    memset(&walker, 0, sizeof(walker_t));
+    walker.nthreads = nthreads;
+    walker.cache = cache;
+    walker.root = root;
+    walker.pathf = pathf;
+    walker.checkpointed = time(NULL);
+    if ((walker.deques = (deque_t*) calloc(nthreads, sizeof(deque_t))) == NULL) ERR("calloc");
+    if ((walker.tids = (pthread_t*) calloc(2 * nthreads, sizeof(pthread_t))) == NULL) ERR("calloc");
+    initQueue(&walker.classify, nthreads); // fed by walkers
+    initQueue(&walker.serialize, 2 * nthreads); // fed by walkers and classifiers
+    for (int i = 0; i < nthreads; i++)
+    {
+        if (pthread_mutex_init(&walker.deques[i].mx, NULL)) ERR("Couldn't initialize mutex!");
+        if ((walker.deques[i].tasks = (dirtask_t*) malloc(DEQUE_INIT * sizeof(dirtask_t))) == NULL) ERR("malloc");
+        walker.deques[i].cap = DEQUE_INIT;
+    }
+    
+    // root directory itself is not indexed, only its contents
+    // a resumed walk starts from the directories its checkpoint had left, spread over the walkers
+    if (frontier == NULL)
+    {
+        dirtask_t rootTask = { NULL, 0 };
+        if ((rootTask.path = strdup(root)) == NULL) ERR("strdup");
+        walker.pending = 1;
+        dequePush(&walker.deques[0], rootTask);
+    }
+    for (uint64_t i = 0; i < nfrontier; i++) dequePush(&walker.deques[i % nthreads], frontier[i]);
+    walker.pending += nfrontier;
+    free(frontier);
+    
+    // walkers and classifiers inherit the blocked signal mask of the indexer thread
+    for (int i = 0; i < nthreads; i++)
+    {
+        workers[i].walker = &walker;
+        workers[i].id = i;
+        if (pthread_create(&walker.tids[i], NULL, walkWork, &workers[i])) ERR("pthread_create");
+    }
+    for (int i = 0; i < nthreads; i++)
+        if (pthread_create(&walker.tids[nthreads + i], NULL, classifyWork, &walker)) ERR("pthread_create");
+    
+    // the indexer thread is the serializer, it writes batches until both earlier stages are done
+    // and saves a checkpoint now and then, stop and join the workers if it is cancelled meanwhile
+    pthread_cleanup_push(free, root);
+    pthread_cleanup_push(stopWalkers, &walker);
+    while (queuePop(&walker, &walker.serialize, &walker.writing))
+    {
+        serializeBatch(&walker);
+        if (time(NULL) - walker.checkpointed >= CHECKPOINT_INTERVAL) checkpointWalk(&walker);
+        else if (time(NULL) - buildProgress.published >= PROGRESS_INTERVAL) publishProgress(pathf);
+    }
+    pthread_cleanup_pop(1);
+    pthread_cleanup_pop(1);
+    
+    if (DEBUGINDEXING) printf("[walkDir] Signatures read: %ld, reused from cache: %ld, skipped by d_type: %ld\n", walker.sniffed, walker.reused, walker.unstated);
+    if (DEBUGINDEXING) printQueue("Classify", &walker.classify);
+    if (DEBUGINDEXING) printQueue("Serialize", &walker.serialize);
+}
+void indexDir(const char* pathd, const char* pathf, int nthreads)
+{
+    sigcache_t cache;
+    char *cachePath, *deltaPath;
+    dirtask_t* frontier = NULL;
+    uint64_t nfrontier = 0, startNs = nowNs(), finishNs;
+    mcounters_t start;
+    
+    loadCounters(&start, &metrics.total);
+    
+    // signatures of the previous indexing, files not modified since are not read again
+    if (asprintf(&cachePath, "%s%s", pathf, CACHE_SUFFIX) < 0) ERR("asprintf");
+    if (asprintf(&deltaPath, "%s%s", pathf, DELTA_SUFFIX) < 0) ERR("asprintf");
+    loadSigCache(&cache, cachePath);
+    
+    // an indexing of the same tree interrupted by exit! or a crash goes on from its last checkpoint
+    waitReaders();
+    if (loadCheckpoint(pathd, pathf, &frontier, &nfrontier)) printf("--Resuming interrupted indexing, %lu records written and %lu directories left.\n", indexWriter.count, nfrontier);
+    else
+    {
+        // open temp files for writing and assign to global file descriptors
+        // walker threads will write to the files at each step
+        remove(CHECKPOINT_FILE);
+        openWriter(&tempfile, "./.temp", 0777);
+        openWriter(&cachefile, "./.temp-cache", 0666);
+        beginIndex();
+        beginCache();
+    }
+    publishProgress(pathf);
+    
+    // prepare cleanup for quick exit
+    pthread_cleanup_push(free, cachePath);
+    pthread_cleanup_push(free, deltaPath);
+    pthread_cleanup_push(freeSigCache, &cache);
+    pthread_cleanup_push(quickexit, &tempfile);
+    
+    if (DEBUGSIMULATION) 
+    {
+        printf("[indexDir] Simulating 5 second long indexing.\n");
+        sleep(5); // to simulate a 5 second long indexing procedure
+    }
+
+    //start tree walk process
+    walkDir(pathd, pathf, nthreads, &cache, frontier, nfrontier);
+    publishProgress(NULL); // later partial queries answer from the index, earlier ones read only the records published
+    finishNs = nowNs();
+    endIndex(NULL, NULL);
+    endCache();
+    remove(CHECKPOINT_FILE); // the temp file is complete, there is nothing left to resume
+
+    // close temp files
+    closeWriter(&tempfile);
+    closeWriter(&cachefile);
+    
+    int state = 0;
+    // atomically rename temp file to actual file
+    // protect renaming operation against cancellation
+    // loop while EBUSY so that if indexfile is open in another stream it waits?
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    do
+    {
+        if ( (state = rename(".temp", pathf)) == EBUSY) sleep(1);
+    } while (state == EBUSY);
+    if (state != 0) ERR("rename");
+    if (unlink(deltaPath) && errno != ENOENT) ERR("unlink"); // changes the watcher wrote are in the new index
+    if (rename(".temp-cache", cachePath)) ERR("rename");
+    buildSecondary(pathf);
+    publishSnapshot(pathf);
+    __atomic_add_fetch(&metrics.total.ns[MWRITE], nowNs() - finishNs, __ATOMIC_RELAXED); // columns, tree and secondary indexes
+    finishMetrics(&start, startNs);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+    pthread_cleanup_pop(0);
+    pthread_cleanup_pop(1);
+    pthread_cleanup_pop(1);
+    pthread_cleanup_pop(1);
+}
+unsigned long hashPath(const char* path)
+{
+    return hashPrefix(path, strlen(path));
+}
+unsigned long hashPrefix(const char* path, size_t length) // hashPath() of the first length bytes of path
+{
+    unsigned long h = 14695981039346656037UL; // FNV-1a
+    for (size_t i = 0; i < length; i++) h = (h ^ (unsigned char)path[i]) * 1099511628211UL;
+    return h;
+}
+bool isUnder(const char* path, const char* dirpath) // checks if path is dirpath or lies below it
+{
+    size_t length = strlen(dirpath);
+    return strncmp(path, dirpath, length) == 0 && (path[length] == '\0' || path[length] == '/');
+}
+wentry_t* findEntry(watch_t* watch, const char* path)
+{
+    wentry_t* e = watch->buckets[hashPath(path) & (watch->nbuckets - 1)];
+    while (e != NULL && strcmp(e->path, path) != 0) e = e->next;
+    return e;
+}
+wentry_t* putEntry(watch_t* watch, const char* path)
+{
+    wentry_t* e;
+    unsigned long h;
+
+    if ((e = findEntry(watch, path)) != NULL) return e;
+
+    if (watch->count >= 2 * watch->nbuckets) // keep chains short - double the table
+    {
+        wentry_t** buckets;
+        if ((buckets = (wentry_t**) calloc(2 * watch->nbuckets, sizeof(wentry_t*))) == NULL) ERR("calloc");
+        for (long i = 0; i < watch->nbuckets; i++)
+            while ((e = watch->buckets[i]) != NULL)
+            {
+                watch->buckets[i] = e->next;
+                h = hashPath(e->path) & (2 * watch->nbuckets - 1);
+                e->next = buckets[h];
+                buckets[h] = e;
+            }
+        free(watch->buckets);
+        watch->buckets = buckets;
+        watch->nbuckets *= 2;
+    }
+
+    if ((e = (wentry_t*) calloc(1, sizeof(wentry_t))) == NULL) ERR("calloc");
+    if ((e->path = strdup(path)) == NULL) ERR("strdup");
+    e->sig.type = error;
+    e->id = WATCH_NORECORD;
+    h = hashPath(path) & (watch->nbuckets - 1);
+    e->next = watch->buckets[h];
+    watch->buckets[h] = e;
+    watch->count++;
+
+    return e;
+}
+void dropTree(watch_t* watch, const char* path, bool unseenOnly) // removes path and everything below it
+{
+    // forget the watches of removed directories, IN_IGNORED of those is skipped
+    for (int wd = 0; wd < watch->nwd; wd++)
+        if (watch->wdPaths[wd] != NULL && isUnder(watch->wdPaths[wd], path) && strcmp(watch->wdPaths[wd], watch->root) != 0)
+        {
+            wentry_t* e = findEntry(watch, watch->wdPaths[wd]);
+            if (unseenOnly && e != NULL && e->seen) continue;
+            inotify_rm_watch(watch->fd, wd);
+            free(watch->wdPaths[wd]);
+            watch->wdPaths[wd] = NULL;
+        }
+
+    for (long i = 0; i < watch->nbuckets; i++)
+        for (wentry_t** pe = &watch->buckets[i]; *pe != NULL; )
+        {
+            wentry_t* e = *pe;
+            if (isUnder(e->path, path) && !(unseenOnly && e->seen))
+            {
+                *pe = e->next;
+                if (e->id != WATCH_NORECORD) addDropped(watch, e->id);
+                free(e->path);
+                free(e);
+                watch->count--;
+                watch->dirty = true;
+            }
+            else pe = &e->next;
+        }
+}
+void moveTree(watch_t* watch, const char* from, const char* to) // renames from and everything below it
+{
+    wentry_t* moved = NULL;
+    char* path;
+
+    dropTree(watch, to, false); // rename replaces an existing destination
+
+    // unlink moved entries first, their hash changes with the path
+    for (long i = 0; i < watch->nbuckets; i++)
+        for (wentry_t** pe = &watch->buckets[i]; *pe != NULL; )
+        {
+            wentry_t* e = *pe;
+            if (isUnder(e->path, from))
+            {
+                *pe = e->next;
+                e->next = moved;
+                moved = e;
+                watch->count--;
+            }
+            else pe = &e->next;
+        }
+
+    while (moved != NULL)
+    {
+        wentry_t* e = moved;
+        moved = e->next;
+        if (asprintf(&path, "%s%s", to, e->path + strlen(from)) < 0) ERR("asprintf");
+        wentry_t* n = putEntry(watch, path);
+        n->uid = e->uid;
+        n->isDir = e->isDir;
+        n->seen = e->seen;
+        n->sig = e->sig;
+        markChanged(watch, n);
+        if (e->id != WATCH_NORECORD) addDropped(watch, e->id);
+        free(path);
+        free(e->path);
+        free(e);
+    }
+
+    // kernel keeps the watches of moved directories, only their paths change
+    for (int wd = 0; wd < watch->nwd; wd++)
+        if (watch->wdPaths[wd] != NULL && isUnder(watch->wdPaths[wd], from))
+        {
+            if (asprintf(&path, "%s%s", to, watch->wdPaths[wd] + strlen(from)) < 0) ERR("asprintf");
+            free(watch->wdPaths[wd]);
+            watch->wdPaths[wd] = path;
+        }
+
+    // events not applied yet refer to the old names
+    for (long i = 0; i < watch->npending; i++)
+        if (isUnder(watch->pending[i], from))
+        {
+            if (asprintf(&path, "%s%s", to, watch->pending[i] + strlen(from)) < 0) ERR("asprintf");
+            free(watch->pending[i]);
+            watch->pending[i] = path;
+        }
+
+    watch->dirty = true;
+}
+void scanDir(watch_t* watch, const char* path, bool rescan) // watches a directory and reads its contents
+{
+    DIR* dirp;
+    struct dirent* dp;
+    char* child;
+    int wd;
+
+    // add the watch before reading so that no entry created meanwhile is missed
+    if ((wd = inotify_add_watch(watch->fd, path, WATCH_MASK)) < 0)
+    {
+        if (errno == ENOSPC) fprintf(stderr, "WARNING! inotify watch limit reached, changes in %s are not tracked.\n", path);
+    }
+    else
+    {
+        if (wd >= watch->nwd) // grow watch descriptor table
+        {
+            int nwd = 2 * wd + 16;
+            if ((watch->wdPaths = (char**) realloc(watch->wdPaths, nwd * sizeof(char*))) == NULL) ERR("realloc");
+            memset(watch->wdPaths + watch->nwd, 0, (nwd - watch->nwd) * sizeof(char*));
+            watch->nwd = nwd;
+        }
+        free(watch->wdPaths[wd]);
+        if ((watch->wdPaths[wd] = strdup(path)) == NULL) ERR("strdup");
+    }
+
+    if ((dirp = opendir(path)) == NULL) return;
+
+    while ((dp = readdir(dirp)) != NULL)
+    {
+        if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0) continue;
+        if (asprintf(&child, "%s/%s", path, dp->d_name) < 0) ERR("asprintf");
+        updatePath(watch, child, rescan);
+        free(child);
+    }
+
+    if (closedir(dirp)) ERR("closedir");
+}
+void updatePath(watch_t* watch, const char* path, bool rescan) // brings the entry of path up to date
+{
+    struct stat s;
+    wentry_t* e;
+    enum ftype ftype;
+    bool newDir = false;
+
+    if (strcmp(path, watch->root) == 0) // root is never an entry
+    {
+        if (rescan) scanDir(watch, path, rescan);
+        return;
+    }
+
+    // vanished entries, symbolic links and special files are not indexed
+    if (lstat(path, &s) || (!S_ISDIR(s.st_mode) && !S_ISREG(s.st_mode)))
+    {
+        if (findEntry(watch, path) != NULL) dropTree(watch, path, false);
+        return;
+    }
+
+    // an entry replaced by one of the other kind is removed with its subtree
+    if ((e = findEntry(watch, path)) != NULL && e->isDir != (bool)S_ISDIR(s.st_mode))
+    {
+        dropTree(watch, path, false);
+        e = NULL;
+    }
+    if (e == NULL)
+    {
+        e = putEntry(watch, path);
+        e->isDir = S_ISDIR(s.st_mode);
+        newDir = e->isDir;
+    }
+
+    if (e->isDir) ftype = dir;
+    else if (e->sig.dev == s.st_dev && e->sig.ino == s.st_ino && e->sig.size == s.st_size
+             && e->sig.mtime.tv_sec == s.st_mtim.tv_sec && e->sig.mtime.tv_nsec == s.st_mtim.tv_nsec) ftype = e->sig.type;
+    else if ((ftype = cachedType(&watch->cache, &s)) == error) // file new or modified
+    {
+        ftype = getType(AT_FDCWD, path);
+        watch->sniffed++;
+    }
+
+    // only what a record holds is a change, a new mtime alone is kept for the signature cache
+    if (newDir || e->uid != s.st_uid || e->sig.size != s.st_size || e->sig.type != ftype) markChanged(watch, e);
+
+    e->uid = s.st_uid;
+    e->seen = true;
+    e->sig.dev = s.st_dev;
+    e->sig.ino = s.st_ino;
+    e->sig.mtime = s.st_mtim;
+    e->sig.size = s.st_size;
+    e->sig.type = ftype;
+
+    if (e->isDir && (newDir || rescan)) scanDir(watch, path, rescan);
+}
+void rescanTree(watch_t* watch, const char* path) // re-reads a subtree, used by a requested or periodic indexing
+{
+    if (DEBUGWATCH) printf("[rescanTree] Rescanning %s\n", path);
+
+    for (long i = 0; i < watch->nbuckets; i++)
+        for (wentry_t* e = watch->buckets[i]; e != NULL; e = e->next)
+            if (isUnder(e->path, path)) e->seen = false;
+
+    updatePath(watch, path, true);
+    dropTree(watch, path, true); // entries not seen again were deleted meanwhile
+}
+void rescanDir(watch_t* watch, const char* path) // re-reads the entries of one directory, those gone are removed with their subtrees
+{
+    size_t length = strlen(path);
+    char** gone = NULL;
+    long ngone = 0;
+
+    if (DEBUGWATCH) printf("[rescanDir] Rescanning %s\n", path);
+
+    // only the entries right in path are marked, those below are rechecked on their own
+    for (long i = 0; i < watch->nbuckets; i++)
+        for (wentry_t* e = watch->buckets[i]; e != NULL; e = e->next)
+            if (strncmp(e->path, path, length) == 0 && e->path[length] == '/' && strchr(e->path + length + 1, '/') == NULL) e->seen = false;
+
+    scanDir(watch, path, false);
+
+    // an entry not seen again was deleted or moved away, with everything below it
+    for (long i = 0; i < watch->nbuckets; i++)
+        for (wentry_t* e = watch->buckets[i]; e != NULL; e = e->next)
+            if (!e->seen && strncmp(e->path, path, length) == 0 && e->path[length] == '/')
+            {
+                if ((gone = (char**) realloc(gone, (ngone + 1) * sizeof(char*))) == NULL) ERR("realloc");
+                if ((gone[ngone++] = strdup(e->path)) == NULL) ERR("strdup");
+                e->seen = true;
+            }
+    for (long i = 0; i < ngone; i++)
+    {
+        dropTree(watch, gone[i], false);
+        free(gone[i]);
+    }
+    free(gone);
+}
+void recheckTree(watch_t* watch) // after lost events, re-reads only the directories that changed and stats the other entries
+{
+    // an overflow of the event queue does not tell which watches lost events; a lost create, delete or
+    // rename changed the mtime of its directory, so only those directories are read again, but a lost
+    // write shows only on the file itself and every entry is still stat'ed, unchanged files are not read
+    wentry_t** entries;
+    char** paths;
+    struct timespec* mtimes;
+    long npaths = 0;
+
+    if (DEBUGWATCH) printf("[recheckTree] Rechecking %ld entries under %s\n", watch->count, watch->root);
+
+    // mtimes are taken before any directory is read again, reading one updates those of its entries
+    if ((entries = (wentry_t**) malloc((watch->count + 1) * sizeof(wentry_t*))) == NULL) ERR("malloc");
+    for (long i = 0; i < watch->nbuckets; i++)
+        for (wentry_t* e = watch->buckets[i]; e != NULL; e = e->next) entries[npaths++] = e;
+    qsort(entries, npaths, sizeof(wentry_t*), compareEntries); // a directory comes before its entries
+    if ((paths = (char**) malloc((npaths + 1) * sizeof(char*))) == NULL) ERR("malloc");
+    if ((mtimes = (struct timespec*) malloc((npaths + 1) * sizeof(struct timespec))) == NULL) ERR("malloc");
+    for (long i = 0; i < npaths; i++)
+    {
+        if ((paths[i] = strdup(entries[i]->path)) == NULL) ERR("strdup");
+        mtimes[i] = entries[i]->sig.mtime;
+    }
+    free(entries);
+
+    rescanDir(watch, watch->root); // root has no entry to compare
+    for (long i = 0; i < npaths; i++)
+    {
+        wentry_t* e;
+
+        // entries removed with a directory read again are skipped
+        if (findEntry(watch, paths[i]) != NULL)
+        {
+            updatePath(watch, paths[i], false);
+            if ((e = findEntry(watch, paths[i])) != NULL && e->isDir && (e->sig.mtime.tv_sec != mtimes[i].tv_sec || e->sig.mtime.tv_nsec != mtimes[i].tv_nsec)) rescanDir(watch, paths[i]);
+        }
+        free(paths[i]);
+    }
+    free(paths);
+    free(mtimes);
+}
+void addPending(watch_t* watch, const char* path)
+{
+    if (watch->npending == watch->cappending)
+    {
+        watch->cappending = watch->cappending ? 2 * watch->cappending : 64;
+        if ((watch->pending = (char**) realloc(watch->pending, watch->cappending * sizeof(char*))) == NULL) ERR("realloc");
+    }
+    if ((watch->pending[watch->npending++] = strdup(path)) == NULL) ERR("strdup");
+    if (watch->npending == 1) watch->since = time(NULL);
+}
+void markChanged(watch_t* watch, wentry_t* e) // lists the entry for the next delta
+{
+    watch->dirty = true;
+    if (e->changed) return;
+    
+    if (watch->nchanged == watch->capchanged)
+    {
+        watch->capchanged = watch->capchanged ? 2 * watch->capchanged : 64;
+        if ((watch->changed = (char**) realloc(watch->changed, watch->capchanged * sizeof(char*))) == NULL) ERR("realloc");
+    }
+    if ((watch->changed[watch->nchanged++] = strdup(e->path)) == NULL) ERR("strdup");
+    e->changed = true;
+}
+void addDropped(watch_t* watch, uint64_t id) // record of a removed entry, hidden by the next delta
+{
+    if (watch->ndropped == watch->capdropped)
+    {
+        watch->capdropped = watch->capdropped ? 2 * watch->capdropped : 64;
+        if ((watch->dropped = (uint64_t*) realloc(watch->dropped, watch->capdropped * sizeof(uint64_t))) == NULL) ERR("realloc");
+    }
+    watch->dropped[watch->ndropped++] = id;
+    watch->dirty = true;
+}
+void numberEntries(watch_t* watch, const char* pathf) // finds the record of every entry in the index file, those that differ from theirs are changed
+{
+    index_t index;
+    icursor_t cursor;
+    finfo_t fileinfo;
+    wentry_t* e;
+    
+    if (!mapIndex(&index, pathf, MADV_SEQUENTIAL)) return; // the first flush writes it whole
+    
+    // entries the scan found are changed only if the index file has them otherwise
+    for (long i = 0; i < watch->nchanged; i++) free(watch->changed[i]);
+    watch->nchanged = 0;
+    for (long i = 0; i < watch->nbuckets; i++)
+        for (e = watch->buckets[i]; e != NULL; e = e->next) e->changed = false;
+    
+    firstRecord(&cursor, &index);
+    while (nextRecord(&cursor, &fileinfo))
+    {
+        if ((e = findEntry(watch, fileinfo.path)) == NULL || e->id != WATCH_NORECORD) addDropped(watch, cursor.next - 1);
+        else
+        {
+            e->id = cursor.next - 1;
+            if (e->uid != fileinfo.uid || e->sig.size != fileinfo.size || e->sig.type != fileinfo.type) markChanged(watch, e);
+        }
+    }
+    for (long i = 0; i < watch->nbuckets; i++)
+        for (e = watch->buckets[i]; e != NULL; e = e->next)
+            if (e->id == WATCH_NORECORD && typeIndexed[e->sig.type]) markChanged(watch, e);
+    
+    // a damaged record stops the decoding, the index file is then written whole
+    watch->numbered = cursor.next == index.header->count;
+    watch->records = index.header->count;
+    watch->checksum = index.header->checksum;
+    unmapIndex(&index);
+}
+int comparePaths(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+int compareEntries(const void* a, const void* b)
+{
+    return strcmp((*(wentry_t* const*)a)->path, (*(wentry_t* const*)b)->path);
+}
+void applyPending(watch_t* watch) // updates every path that had events since last call, once
+{
+    qsort(watch->pending, watch->npending, sizeof(char*), comparePaths);
+
+    for (long i = 0; i < watch->npending; i++)
+    {
+        if (i == 0 || strcmp(watch->pending[i], watch->pending[i-1]) != 0) updatePath(watch, watch->pending[i], false);
+        if (i > 0) free(watch->pending[i-1]);
+    }
+    if (watch->npending > 0) free(watch->pending[watch->npending-1]);
+
+    watch->npending = 0;
+}
+void readEvents(watch_t* watch)
+{
+    char buf[WATCH_BUFFER] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event* ev;
+    char *path, *movedFrom = NULL;
+    uint32_t cookie = 0;
+    ssize_t length;
+
+    while ((length = read(watch->fd, buf, sizeof(buf))) > 0)
+        for (char* p = buf; p < buf + length; p += sizeof(struct inotify_event) + ev->len)
+        {
+            ev = (const struct inotify_event*) p;
+
+            if (ev->mask & IN_Q_OVERFLOW) // events were lost, nothing is known about which entries changed
+            {
+                if (DEBUGWATCH) printf("[readEvents] Event queue overflow.\n");
+                watch->overflow = true;
+                continue;
+            }
+            if (ev->wd < 0 || ev->wd >= watch->nwd || watch->wdPaths[ev->wd] == NULL) continue;
+            if (ev->mask & IN_IGNORED) // directory deleted or moved out of the tree
+            {
+                free(watch->wdPaths[ev->wd]);
+                watch->wdPaths[ev->wd] = NULL;
+                continue;
+            }
+            if (ev->len == 0) continue; // event on the watched directory itself, its parent reports it too
+
+            if (asprintf(&path, "%s/%s", watch->wdPaths[ev->wd], ev->name) < 0) ERR("asprintf");
+            if (DEBUGWATCH) printf("[readEvents] Event 0x%x on %s\n", ev->mask, path);
+
+            if (movedFrom != NULL && (!(ev->mask & IN_MOVED_TO) || ev->cookie != cookie))
+            {
+                addPending(watch, movedFrom); // moved out of the tree - it will be removed
+                free(movedFrom);
+                movedFrom = NULL;
+            }
+
+            if (ev->mask & IN_MOVED_FROM) // wait for the matching IN_MOVED_TO
+            {
+                movedFrom = path;
+                cookie = ev->cookie;
+                continue;
+            }
+            else if ((ev->mask & IN_MOVED_TO) && movedFrom != NULL) // rename inside the tree
+            {
+                moveTree(watch, movedFrom, path);
+                free(movedFrom);
+                movedFrom = NULL;
+            }
+
+            addPending(watch, path);
+            free(path);
+        }
+
+    if (length < 0 && errno != EAGAIN) ERR("read");
+
+    if (movedFrom != NULL)
+    {
+        addPending(watch, movedFrom);
+        free(movedFrom);
+    }
+
+    if (watch->overflow && watch->npending == 0) watch->since = time(NULL);
+}
+void pruneChanged(watch_t* watch) // sorts the changed paths, without repeats and removed entries
+{
+    long kept = 0;
+    
+    qsort(watch->changed, watch->nchanged, sizeof(char*), comparePaths);
+    for (long i = 0; i < watch->nchanged; i++)
+    {
+        if ((kept > 0 && strcmp(watch->changed[i], watch->changed[kept-1]) == 0) || findEntry(watch, watch->changed[i]) == NULL) free(watch->changed[i]);
+        else watch->changed[kept++] = watch->changed[i];
+    }
+    watch->nchanged = kept;
+}
+void writeWhole(watch_t* watch, const char* pathf) // rewrites the index file and the signature cache from the entry table
+{
+    char *cachePath, *deltaPath;
+    wentry_t** sorted;
+    long count = 0;
+
+    if (asprintf(&cachePath, "%s%s", pathf, CACHE_SUFFIX) < 0) ERR("asprintf");
+    if (asprintf(&deltaPath, "%s%s", pathf, DELTA_SUFFIX) < 0) ERR("asprintf");
+    waitReaders();
+    openWriter(&tempfile, "./.temp", 0777);
+    openWriter(&cachefile, "./.temp-cache", 0666);
+
+    pthread_cleanup_push(free, cachePath);
+    pthread_cleanup_push(free, deltaPath);
+    pthread_cleanup_push(quickexit, &tempfile);
+    beginIndex();
+    beginCache();
+
+    // indexed entries are written in path order so that paths share prefixes
+    if ((sorted = (wentry_t**) malloc((watch->count + 1) * sizeof(wentry_t*))) == NULL) ERR("malloc");
+    pthread_cleanup_push(free, sorted);
+
+    for (long i = 0; i < watch->nbuckets; i++)
+        for (wentry_t* e = watch->buckets[i]; e != NULL; e = e->next)
+        {
+            if (!e->isDir && e->sig.type != error) addToCacheFile(&e->sig);
+            e->changed = false;
+            e->id = WATCH_NORECORD;
+            if (typeIndexed[e->sig.type]) sorted[count++] = e;
+        }
+    
+    qsort(sorted, count, sizeof(wentry_t*), compareEntries);
+    for (long i = 0; i < count; i++) 
+    {
+        addToTempFile(sorted[i]->path, strrchr(sorted[i]->path, '/') + 1, sorted[i]->sig.size, sorted[i]->uid, sorted[i]->sig.type);
+        sorted[i]->id = i;
+    }
+    endIndex(NULL, NULL);
+    endCache();
+    pthread_cleanup_pop(1);
+
+    closeWriter(&tempfile);
+    closeWriter(&cachefile);
+
+    // atomically replace the index, protected against cancellation; a delta left
+    // next to it names the old one and is ignored until it is removed
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    if (rename(".temp", pathf)) ERR("rename");
+    if (unlink(deltaPath) && errno != ENOENT) ERR("unlink");
+    if (rename(".temp-cache", cachePath)) ERR("rename");
+    buildSecondary(pathf);
+    publishSnapshot(pathf);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+    pthread_cleanup_pop(0);
+    pthread_cleanup_pop(1);
+    pthread_cleanup_pop(1);
+
+    // every entry now has its record, later changes are counted from here
+    for (long i = 0; i < watch->nchanged; i++) free(watch->changed[i]);
+    watch->nchanged = 0;
+    watch->ndropped = 0;
+    watch->records = count;
+    watch->checksum = indexWriter.crc;
+    watch->numbered = true;
+    if (DEBUGWATCH) printf("[writeWhole] Index rewritten with %ld entries.\n", watch->count);
+}
+void writeDelta(watch_t* watch, const char* pathf) // writes the changed entries and the records they hide next to the index file
+{
+    char* deltaPath;
+    uint64_t* hidden;
+    long nhidden = 0, written = 0;
+
+    // records of changed entries are replaced, those of removed ones are gone
+    if ((hidden = (uint64_t*) malloc((watch->nchanged + watch->ndropped + 1) * sizeof(uint64_t))) == NULL) ERR("malloc");
+    for (long i = 0; i < watch->nchanged; i++)
+    {
+        wentry_t* e = findEntry(watch, watch->changed[i]);
+        if (e->id != WATCH_NORECORD) hidden[nhidden++] = e->id;
+    }
+    memcpy(hidden + nhidden, watch->dropped, watch->ndropped * sizeof(uint64_t));
+    nhidden += watch->ndropped;
+    qsort(hidden, nhidden, sizeof(uint64_t), compareIds);
+
+    if (asprintf(&deltaPath, "%s%s", pathf, DELTA_SUFFIX) < 0) ERR("asprintf");
+    waitReaders();
+    openWriter(&tempfile, "./.temp", 0777);
+
+    pthread_cleanup_push(free, deltaPath);
+    pthread_cleanup_push(free, hidden);
+    pthread_cleanup_push(quickexit, &tempfile);
+    beginIndex();
+
+    // changed paths are sorted already, the index file, its cache and secondary indexes stay as they are
+    for (long i = 0; i < watch->nchanged; i++)
+    {
+        wentry_t* e = findEntry(watch, watch->changed[i]);
+        if (!typeIndexed[e->sig.type]) continue;
+        addToTempFile(e->path, strrchr(e->path, '/') + 1, e->sig.size, e->uid, e->sig.type);
+        written++;
+    }
+    ibase_t base = {watch->checksum, 0, watch->records, nhidden};
+    endIndex(&base, hidden);
+    closeWriter(&tempfile);
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    if (rename(".temp", deltaPath)) ERR("rename");
+    publishSnapshot(pathf);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
+    pthread_cleanup_pop(0);
+    pthread_cleanup_pop(1);
+    pthread_cleanup_pop(1);
+    if (DEBUGWATCH) printf("[writeDelta] Delta of %ld entries hiding %ld of %lu records.\n", written, nhidden, watch->records);
+}
+void flushWatch(watch_t* watch, const char* pathf) // writes the changes as a delta, or the whole index file once they are many
+{
+    // a delta grows with every change since the last whole write, past a share of the index it is merged in
+    pruneChanged(watch);
+    if (watch->numbered && watch->nchanged + watch->ndropped <= watch->records / WATCH_COMPACT) writeDelta(watch, pathf);
+    else writeWhole(watch, pathf);
+    watch->dirty = false;
+}
+void freeWatch(void* voidWatch) // also cleanup function for thread during quick exit
+{
+    watch_t* watch = voidWatch;
+
+    for (long i = 0; i < watch->nbuckets; i++)
+        while (watch->buckets[i] != NULL)
+        {
+            wentry_t* e = watch->buckets[i];
+            watch->buckets[i] = e->next;
+            free(e->path);
+            free(e);
+        }
+    for (int wd = 0; wd < watch->nwd; wd++) free(watch->wdPaths[wd]);
+    for (long i = 0; i < watch->npending; i++) free(watch->pending[i]);
+    for (long i = 0; i < watch->nchanged; i++) free(watch->changed[i]);
+
+    freeSigCache(&watch->cache);
+    free(watch->buckets);
+    free(watch->wdPaths);
+    free(watch->pending);
+    free(watch->changed);
+    free(watch->dropped);
+    free(watch->root);
+    if (watch->fd >= 0) close(watch->fd);
+    if (watch->sfd >= 0) close(watch->sfd);
+}
+void watchTree(thread_t* threadArgs) // keeps the index up to date from filesystem events
+{
+    watch_t watch;
+    sigset_t mask;
+    struct signalfd_siginfo si;
+    struct pollfd fds[2];
+    char* cachePath;
+
+    memset(&watch, 0, sizeof(watch_t));
+    watch.fd = watch.sfd = -1;
+    pthread_cleanup_push(freeWatch, &watch);
+
+    if ((watch.root = realpath(threadArgs->pathd, NULL)) == NULL) ERR("realpath");
+    if ((watch.fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0) ERR("inotify_init1");
+
+    // signals of the indexer thread are read from a descriptor so they can be polled with the events
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    sigaddset(&mask, SIGALRM);
+    if ((watch.sfd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0) ERR("signalfd");
+
+    if ((watch.buckets = (wentry_t**) calloc(WATCH_BUCKETS, sizeof(wentry_t*))) == NULL) ERR("calloc");
+    watch.nbuckets = WATCH_BUCKETS;
+
+    // watch every directory, types of files indexed before are taken from the signature cache
+    if (asprintf(&cachePath, "%s%s", threadArgs->pathf, CACHE_SUFFIX) < 0) ERR("asprintf");
+    loadSigCache(&watch.cache, cachePath);
+    free(cachePath);
+
+    pthread_mutex_lock(threadArgs->pmxIndexer);
+    updatePath(&watch, watch.root, true);
+    numberEntries(&watch, threadArgs->pathf);
+    if (!watch.numbered || watch.nchanged + watch.ndropped > 0) flushWatch(&watch, threadArgs->pathf); // index was stale
+    pthread_mutex_unlock(threadArgs->pmxIndexer);
+    freeSigCache(&watch.cache);
+    watch.dirty = false;
+
+    if (DEBUGWATCH) printf("[watchTree] Watching %ld entries under %s\n", watch.count, watch.root);
+
+    fds[0].fd = watch.fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = watch.sfd;
+    fds[1].events = POLLIN;
+
+    while (true)
+    {
+        // apply changes once events calm down, or after WATCH_MAXDELAY at the latest
+        int timeout = -1;
+        if (watch.npending > 0 || watch.overflow) timeout = time(NULL) - watch.since >= WATCH_MAXDELAY ? 0 : WATCH_DEBOUNCE;
+
+        if (poll(fds, 2, timeout) < 0)
+        {
+            if (errno == EINTR) continue;
+            ERR("poll");
+        }
+
+        if (fds[0].revents & POLLIN) readEvents(&watch);
+
+        if ((watch.npending > 0 || watch.overflow) && (!(fds[0].revents & POLLIN) || time(NULL) - watch.since >= WATCH_MAXDELAY))
+        {
+            pthread_mutex_lock(threadArgs->pmxIndexer);
+            applyPending(&watch);
+            if (watch.overflow) recheckTree(&watch); // lost events could be anywhere, only what changed is read again
+            watch.overflow = false;
+            if (watch.dirty) flushWatch(&watch, threadArgs->pathf);
+            pthread_mutex_unlock(threadArgs->pmxIndexer);
+        }
+
+        if (!(fds[1].revents & POLLIN)) continue;
+        if (read(watch.sfd, &si, sizeof(si)) != sizeof(si)) ERR("read");
+
+        if (DEBUGTHREAD) // debug messages
+        {
+            if (si.ssi_signo == SIGUSR1) printf("[watchTree] SIGUSR1 (index) received from user.\n");
+            if (si.ssi_signo == SIGUSR2) printf("[watchTree] SIGUSR2 (exit) received from user.\n");
+            if (si.ssi_signo == SIGALRM) printf("[watchTree] SIGALRM (periodic indexing) triggered.\n");
+        }
+
+        if (si.ssi_signo == SIGUSR2) // exit - finish applying what is pending
+        {
+            pthread_mutex_lock(threadArgs->pmxIndexer);
+            applyPending(&watch);
+            if (watch.dirty) flushWatch(&watch, threadArgs->pathf);
+            pthread_mutex_unlock(threadArgs->pmxIndexer);
+            break;
+        }
+
+        // requested or periodic indexing - rescan everything, only changed files are read
+        printf("--Starting indexing.\n");
+        printf("> Enter command (\"help\" for list of commands): \n");
+
+        pthread_mutex_lock(threadArgs->pmxIndexer);
+        applyPending(&watch);
+        rescanTree(&watch, watch.root);
+        watch.overflow = false;
+        flushWatch(&watch, threadArgs->pathf);
+        pthread_mutex_unlock(threadArgs->pmxIndexer);
+
+        printf("--Indexing complete.\n");
+        if (threadArgs->exitFlag == 0) printf("> Enter command (\"help\" for list of commands): \n");
+
+        if (threadArgs->t > 0) alarm(threadArgs->t);
+    }
+
+    pthread_cleanup_pop(1);
+}
+void* threadWork(void* voidArgs)
+{
+    thread_t* threadArgs = voidArgs;
+    long timeElapsed = threadArgs->newIndex>0 ? 0 : time(NULL) - threadArgs->pIndexStat->st_mtime;
+    long timeLeft = threadArgs->newIndex>0 ? threadArgs->t : threadArgs->t - timeElapsed;
+    int sigNo = 0;
+
+    if (DEBUGTHREAD) // debug messages
+    {
+        printf("[threadWork] Thread with TID: %lu started.\n", (unsigned long)threadArgs->tid);
+        if (threadArgs->newIndex == 1) printf("[threadWork] Index file \"%s\" does not exist.\n", threadArgs->pathf);
+        else if (threadArgs->newIndex == 2) printf("[threadWork] Indexing initiated by user.\n");
+        else if (threadArgs->newIndex == 3) printf("[threadWork] Resuming indexing from \"%s\".\n", CHECKPOINT_FILE);
+        else if (threadArgs->newIndex == 0)
+        {
+            printf("[threadWork] Index file \"%s\" exists. Last modification: %ld\n", threadArgs->pathf, threadArgs->pIndexStat->st_mtime);
+            printf("[threadWork] Current time: %ld\n", time(NULL));
+            printf("[threadWork] Time elapsed since last indexing is: %ld seconds.\n", timeElapsed);
+            printf("[threadWork] Will wait for: %d - %ld = %ld seconds before re-indexing.\n", threadArgs->t, timeElapsed, timeLeft);
+        }
+    }
+
+    if (threadArgs->newIndex != 0) // 1:start-up without old index file / 2:user initiated indexing / 3:start-up with an interrupted indexing
+    {
+        printf("--Starting indexing.\n");
+        if (threadArgs->newIndex == 2) printf("> Enter command (\"help\" for list of commands): \n");
+        
+        pthread_mutex_lock(threadArgs->pmxIndexer);
+        indexDir(threadArgs->pathd, threadArgs->pathf, threadArgs->j);
+        pthread_mutex_unlock(threadArgs->pmxIndexer);
+        
+        printf("--Indexing complete.\n");
+        if (threadArgs->newIndex != 1 && threadArgs->exitFlag == 0) printf("> Enter command (\"help\" for list of commands): \n");
+        
+        // if necessary, inform main thread that start-up indexing is finished
+        if (threadArgs->newIndex == 1) pthread_kill(threadArgs->mtid, SIGUSR1);
+
+        // set alarm for periodic indexing
+        if (threadArgs->t > 0) alarm(threadArgs->t);        
+    }
+    else if (threadArgs->t > 0) // start-up with old index file and perodic indexing set
+    { 
+        if(timeLeft > 0) // index file not old enough - set alarm to wait until it's old enough
+        {
+            if (DEBUGTHREAD) printf("[threadWork] Setting alarm for %ld seconds and waiting for periodic indexing.\n", timeLeft);
+            alarm(timeLeft);
+        }
+        else // index file too old - directly trigger indexing in periodic indexing loop
+        {
+            pthread_kill(threadArgs->tid, SIGALRM); 
+            printf("--Index file too old.\n");
+        }
+    }
+    
+    timeLeft = threadArgs->t;
+
+    // in watch mode changes are applied as they happen, periodic indexing is handled there too
+    if (threadArgs->watch) watchTree(threadArgs);
+
+    // enter periodic indexing loop if it is set
+    while (threadArgs->t > 0 && !threadArgs->watch)
+    {
+        // wait for a signal
+        do
+        {
+            sigwait(threadArgs->pMask, &sigNo);
+        } while (sigNo != SIGUSR1 && sigNo != SIGUSR2 && sigNo != SIGALRM);
+        
+        if (DEBUGTHREAD) // debug messages
+        {
+            if (sigNo == SIGUSR1) printf("[threadWork] SIGUSR1 (index) received from user.\n");
+            if (sigNo == SIGUSR2) printf("[threadWork] SIGUSR2 (exit) received from user.\n");
+            if (sigNo == SIGALRM) printf("[threadWork] SIGALRM (periodic indexing) triggered.\n");
+        }
+
+        if (sigNo == SIGUSR2) break; // exit signal received - end the thread
+
+        printf("--Starting indexing.\n");
+        printf("> Enter command (\"help\" for list of commands): \n");
+
+        pthread_mutex_lock(threadArgs->pmxIndexer);
+        indexDir(threadArgs->pathd, threadArgs->pathf, threadArgs->j);
+        pthread_mutex_unlock(threadArgs->pmxIndexer);
+        
+        printf("--Indexing complete.\n");
+        if (threadArgs->exitFlag == 0) printf("> Enter command (\"help\" for list of commands): \n");
+
+        // set new alarm for periodic indexing
+        if (DEBUGTHREAD) printf("[threadWork] Setting alarm for %ld seconds and waiting for periodic indexing.\n", timeLeft);
+        alarm(timeLeft);
+    }
+    
+    if (DEBUGTHREAD) printf("[threadWork] Ending thread.\n");
+    return NULL;
+}
+void u_index(thread_t* threadArgs)
+{
+    int mxStatus = 0;
+            // check if there's an indexing operation currently in progress
+            if ( (mxStatus = pthread_mutex_trylock(threadArgs->pmxIndexer) ) == EBUSY)
+            {
+                printf ("--There's already an indexing process running...\n");
+                return;
+            }
+            else if ( mxStatus == 0 )
+            {
+                if(threadArgs->t == 0 && !threadArgs->watch)  // perodic indexing and watch disabled: there's no active thread
+                {
+                    // create a thread for indexing
+                    threadArgs->newIndex = 2;
+                    if (DEBUGMAIN) printf("[main] Creating new thread to start indexing...\n");
+                    if (pthread_create(&threadArgs->tid, NULL, threadWork, threadArgs)) ERR("pthread_create");
+                }
+                else // periodic indexing or watch enabled: there's an active thread
+                {
+                    // send SIGUSR1 to active thread to start indexing
+                    if (DEBUGMAIN) printf("[main] Sending SIGUSR1 to thread to start indexing...\n");
+                    pthread_kill(threadArgs->tid, SIGUSR1);
+                }
+                
+                pthread_mutex_unlock(threadArgs->pmxIndexer);
+            }
+            else ERR("pthread_mutex_lock");
+}
+void u_count(const index_t* index, const char* buf, FILE* out)
+{
+    const uint64_t* counts = index->summary->typeCount;
+    idir_t totals;
+    
+    // with a path the counts are the rollup of its subtree
+    if (buf[5] == ' ')
+    {
+        if (!dirArgument(index, buf + 6, &totals, out)) return;
+        counts = totals.typeCount;
+    }
+    fprintf(out, "--Files count: dir:%lu, jpg:%lu, png:%lu, gzip:%lu, zip: %lu", counts[dir], counts[jpeg], counts[png], counts[gzip], counts[zip]);
+    
+    // the types added later are listed only when there are any
+    for (int type = zip + 1; type < other; type++)
+        if (counts[type] > 0) fprintf(out, ", %s: %lu", typeToText(type), counts[type]);
+    fprintf(out, "\n");
+}
+void u_stats(const index_t* index, FILE* out)
+{
+    char created[32], bytes[16];
+    time_t t;
+
+    t = index->summary->created;
+    strftime(created, sizeof(created), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    fprintf(out, "--Index \"%s\": %lu records, %s, written %s (%ld s ago)\n", index->pathf, index->header->count, formatSize(index->length, bytes), created, time(NULL) - t);
+    
+    fprintf(out, "  %-8s %12s %14s\n", "type", "count", "bytes");
+    for (int type = 0; type < TYPE_COUNT; type++)
+        if (index->summary->typeCount[type] > 0)
+            fprintf(out, "  %-8s %12lu %14lu\n", typeToText(type), index->summary->typeCount[type], index->summary->typeBytes[type]);
+    
+    fprintf(out, "  %-8s %12s %14s\n", "owner", "count", "bytes");
+    for (uint64_t i = 0; i < index->summary->owners; i++)
+        fprintf(out, "  %-8u %12lu %14lu\n", index->owners[i].uid, index->owners[i].count, index->owners[i].bytes);
+    
+    printMetrics(out);
+}
+void loadCounters(mcounters_t* to, mcounters_t* from) // consistent enough copy of counters the indexing threads are adding to
+{
+    uint64_t* x = (uint64_t*) from;
+    uint64_t* y = (uint64_t*) to;
+    
+    for (size_t i = 0; i < sizeof(mcounters_t) / sizeof(uint64_t); i++) y[i] = __atomic_load_n(&x[i], __ATOMIC_RELAXED);
+}
+void finishMetrics(const mcounters_t* start, uint64_t startNs) // keeps what the indexing that began at start added
+{
+    mcounters_t now;
+    uint64_t *x = (uint64_t*) &now, *y = (uint64_t*) &metrics.last;
+    const uint64_t* z = (const uint64_t*) start;
+    
+    loadCounters(&now, &metrics.total);
+    pthread_mutex_lock(&metrics.mx);
+    for (size_t i = 0; i < sizeof(mcounters_t) / sizeof(uint64_t); i++) y[i] = x[i] - z[i];
+    metrics.lastNs = nowNs() - startNs;
+    metrics.indexings++;
+    pthread_mutex_unlock(&metrics.mx);
+}
+void recordQuery(const char* buf, uint64_t startNs) // adds the latency of command buf, run since startNs
+{
+    uint64_t ns = nowNs() - startNs;
+    int bucket = 0;
+    
+    for (int i = 0; i < QUERY_COMMANDS; i++)
+    {
+        size_t length = strlen(queryNames[i]);
+        if (strncmp(buf, queryNames[i], length) != 0 || (buf[length] != ' ' && buf[length] != '\n')) continue;
+        
+        while (bucket < LATENCY_BUCKETS - 1 && ns >= (1000UL << bucket)) bucket++;
+        pthread_mutex_lock(&metrics.mx);
+        metrics.queries[i].count++;
+        metrics.queries[i].ns += ns;
+        metrics.queries[i].buckets[bucket]++;
+        pthread_mutex_unlock(&metrics.mx);
+        return;
+    }
+}
+double latencyQuantile(const mlatency_t* latency, double q) // upper bound of the bucket holding quantile q, in ms
+{
+    uint64_t seen = 0;
+    
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+        if ((seen += latency->buckets[bucket]) >= q * latency->count) return (1UL << bucket) / 1000.0;
+    return (1UL << (LATENCY_BUCKETS - 1)) / 1000.0;
+}
+void printMetrics(FILE* out) // counters of the indexings and queries since start
+{
+    metrics_t m;
+    char bytes[16];
+    
+    pthread_mutex_lock(&metrics.mx);
+    m = metrics;
+    pthread_mutex_unlock(&metrics.mx);
+    loadCounters(&m.total, &metrics.total);
+    
+    if (m.indexings == 0) fprintf(out, "--No indexing finished since start.\n");
+    else
+    {
+        // rates are of the last indexing, a slow one shows in which stage its time went
+        double seconds = m.lastNs / 1e9;
+        fprintf(out, "--Last indexing (%lu since start): %lu entries in %.2f s (%.0f entries/s), %lu directories, %.2f syscalls per entry\n",
+                m.indexings, m.last.entries, seconds, seconds > 0 ? m.last.entries / seconds : 0.0, m.last.dirs, m.last.entries ? (double) m.last.syscalls / m.last.entries : 0.0);
+        fprintf(out, "  signatures read %lu (%s), reused %lu\n", m.last.sniffed, formatSize(m.last.sniffedBytes, bytes), m.last.reused);
+        fprintf(out, "  thread time");
+        for (int phase = 0; phase < MPHASES; phase++) fprintf(out, " %s %.2f s%s", phaseNames[phase], m.last.ns[phase] / 1e9, phase < MPHASES - 1 ? "," : "\n");
+    }
+    
+    fprintf(out, "  %-10s %8s %10s %10s %10s\n", "command", "count", "mean ms", "p50 ms", "p99 ms");
+    for (int i = 0; i < QUERY_COMMANDS; i++)
+        if (m.queries[i].count > 0)
+            fprintf(out, "  %-10s %8lu %10.3f %10.3f %10.3f\n", queryNames[i], m.queries[i].count, m.queries[i].ns / 1e6 / m.queries[i].count,
+                    latencyQuantile(&m.queries[i], 0.5), latencyQuantile(&m.queries[i], 0.99));
+}
+void writeMetrics(const char* pathf) // writes pathf METRICS_SUFFIX in Prometheus text format, replacing it at once
+{
+    metrics_t m;
+    struct stat s;
+    char *path, *temp;
+    FILE* out;
+    
+    pthread_mutex_lock(&metrics.mx);
+    m = metrics;
+    pthread_mutex_unlock(&metrics.mx);
+    loadCounters(&m.total, &metrics.total);
+    
+    if (asprintf(&path, "%s%s", pathf, METRICS_SUFFIX) < 0 || asprintf(&temp, "%s.tmp", path) < 0) ERR("asprintf");
+    if ((out = fopen(temp, "w")) == NULL)
+    {
+        free(path);
+        free(temp);
+        return; // a collector reading it is not worth stopping for
+    }
+    
+    fprintf(out, "# HELP mole_indexings_total Indexings finished since start.\n# TYPE mole_indexings_total counter\n");
+    fprintf(out, "mole_indexings_total %lu\n", m.indexings);
+    fprintf(out, "# HELP mole_entries_total Records written to the index.\n# TYPE mole_entries_total counter\n");
+    fprintf(out, "mole_entries_total %lu\n", m.total.entries);
+    fprintf(out, "# HELP mole_directories_total Directories read.\n# TYPE mole_directories_total counter\n");
+    fprintf(out, "mole_directories_total %lu\n", m.total.dirs);
+    fprintf(out, "# HELP mole_syscalls_total System calls of the walkers and classifiers.\n# TYPE mole_syscalls_total counter\n");
+    fprintf(out, "mole_syscalls_total %lu\n", m.total.syscalls);
+    fprintf(out, "# HELP mole_sniffed_files_total Files whose signature was read.\n# TYPE mole_sniffed_files_total counter\n");
+    fprintf(out, "mole_sniffed_files_total %lu\n", m.total.sniffed);
+    fprintf(out, "# HELP mole_sniffed_bytes_total Bytes of signatures read.\n# TYPE mole_sniffed_bytes_total counter\n");
+    fprintf(out, "mole_sniffed_bytes_total %lu\n", m.total.sniffedBytes);
+    fprintf(out, "# HELP mole_reused_files_total Files typed from the signature cache.\n# TYPE mole_reused_files_total counter\n");
+    fprintf(out, "mole_reused_files_total %lu\n", m.total.reused);
+    fprintf(out, "# HELP mole_stage_seconds_total Thread time of each indexing stage.\n# TYPE mole_stage_seconds_total counter\n");
+    for (int phase = 0; phase < MPHASES; phase++) fprintf(out, "mole_stage_seconds_total{stage=\"%s\"} %.6f\n", phaseNames[phase], m.total.ns[phase] / 1e9);
+    
+    fprintf(out, "# HELP mole_last_indexing_seconds Wall time of the last indexing.\n# TYPE mole_last_indexing_seconds gauge\n");
+    fprintf(out, "mole_last_indexing_seconds %.6f\n", m.lastNs / 1e9);
+    fprintf(out, "# HELP mole_last_indexing_entries_per_second Records written per second by the last indexing.\n# TYPE mole_last_indexing_entries_per_second gauge\n");
+    fprintf(out, "mole_last_indexing_entries_per_second %.1f\n", m.lastNs ? m.last.entries / (m.lastNs / 1e9) : 0.0);
+    fprintf(out, "# HELP mole_last_indexing_syscalls_per_entry System calls per record of the last indexing.\n# TYPE mole_last_indexing_syscalls_per_entry gauge\n");
+    fprintf(out, "mole_last_indexing_syscalls_per_entry %.3f\n", m.last.entries ? (double) m.last.syscalls / m.last.entries : 0.0);
+    if (stat(pathf, &s) == 0)
+    {
+        fprintf(out, "# HELP mole_index_age_seconds Time since the index file was written.\n# TYPE mole_index_age_seconds gauge\n");
+        fprintf(out, "mole_index_age_seconds %ld\n", time(NULL) - s.st_mtime);
+    }
+    
+    // buckets are cumulative in this format
+    fprintf(out, "# HELP mole_query_seconds Latency of the query commands.\n# TYPE mole_query_seconds histogram\n");
+    for (int i = 0; i < QUERY_COMMANDS; i++)
+    {
+        uint64_t seen = 0;
+        for (int bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++)
+        {
+            seen += m.queries[i].buckets[bucket];
+            fprintf(out, "mole_query_seconds_bucket{command=\"%s\",le=\"%g\"} %lu\n", queryNames[i], (1UL << bucket) / 1e6, seen);
+        }
+        fprintf(out, "mole_query_seconds_bucket{command=\"%s\",le=\"+Inf\"} %lu\n", queryNames[i], m.queries[i].count);
+        fprintf(out, "mole_query_seconds_sum{command=\"%s\"} %.6f\n", queryNames[i], m.queries[i].ns / 1e9);
+        fprintf(out, "mole_query_seconds_count{command=\"%s\"} %lu\n", queryNames[i], m.queries[i].count);
+    }
+    
+    if (fclose(out) == EOF || rename(temp, path)) remove(temp);
+    free(path);
+    free(temp);
+}
+void* metricsWork(void* voidArgs) // rewrites the metrics file every METRICS_INTERVAL until cancelled
+{
+    thread_t* threadArgs = voidArgs;
+    
+    while (true)
+    {
+        sleep(METRICS_INTERVAL);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        writeMetrics(threadArgs->pathf);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    }
+    return NULL;
+}
+void u_du(const index_t* index, const char* buf, FILE* out)
+{
+    uint64_t files = 0, total = 0, dirs = index->summary->typeCount[dir];
+    char bytes[16];
+    idir_t totals;
+
+    if (buf[2] == ' ') // a subtree has its totals precomputed
+    {
+        if (!dirArgument(index, buf + 3, &totals, out)) return;
+        files = totals.files;
+        total = totals.bytes;
+        dirs = totals.typeCount[dir];
+    }
+    else // sizes of directories themselves are not counted
+    {
+        for (int type = 0; type < TYPE_COUNT; type++)
+        {
+            if (type == dir) continue;
+            files += index->summary->typeCount[type];
+            total += index->summary->typeBytes[type];
+        }
+    }
+    fprintf(out, "--Total size: %lu bytes (%s) in %lu files and %lu directories\n", total, formatSize(total, bytes), files, dirs);
+}
+bool dirArgument(const index_t* index, const char* arg, idir_t* totals, FILE* out) // totals of the directory named by a command argument, reports if it is not indexed
+{
+    char path[MAX_PATH];
+    size_t length;
+    int64_t d;
+    bool found;
+    
+    while (isspace((unsigned char) *arg)) arg++;
+    length = strlen(arg);
+    while (length > 0 && isspace((unsigned char) arg[length - 1])) length--;
+    while (length > 0 && arg[length - 1] == '/') length--; // "/" is the empty path, the parent of the top level
+    if (length >= MAX_PATH)
+    {
+        fprintf(out, "--Invalid command or arguments missing.\n");
+        return false;
+    }
+    memcpy(path, arg, length);
+    path[length] = '\0';
+    
+    if (index->parts != NULL) found = viewTotals(index, path, totals);
+    else if ((found = (d = findDirectory(index, path)) >= 0)) *totals = index->dirs[d];
+    if (!found) fprintf(out, "--Directory %s is not in the index.\n", length > 0 ? path : "/");
+    return found;
+}
+bool viewTotals(const index_t* view, const char* path, idir_t* totals) // rollup of directory path in a view, false if it is not in the view
+{
+    const index_t* last = &view->parts[view->nparts - 1];
+    uint64_t first = 0;
+    icursor_t cursor;
+    finfo_t fileinfo;
+    int64_t found;
+    bool listed = false;
+    
+    for (int part = 0; part < view->nparts - 1; part++) first += view->parts[part].header->count;
+    memset(totals, 0, sizeof(idir_t));
+    
+    // the last part is a whole index, its rollup is corrected by the records of the subtree an earlier part hides
+    if ((found = findDirectory(last, path)) >= 0)
+    {
+        const idir_t* d = &last->dirs[found];
+        *totals = *d;
+        listed = d->id == INDEX_NODIR || !isHidden(view, first + d->id);
+        for (uint64_t w = first / 64; view->hidden != NULL && w * 64 < first + last->header->count; w++)
+            for (uint64_t word = view->hidden[w], id; word != 0; word &= word - 1)
+            {
+                if ((id = w * 64 + __builtin_ctzll(word)) < first) continue;
+                id -= first;
+                if (last->parents[id] < found || last->parents[id] > found + d->descendants) continue;
+                if (last->types[id] == dir) totals->typeCount[dir]--;
+                else
+                {
+                    totals->files--;
+                    totals->bytes -= last->sizes[id];
+                    if (last->types[id] < TYPE_COUNT) totals->typeCount[last->types[id]]--;
+                }
+            }
+    }
+    
+    // the other parts are counted record by record, a directory only they have is in the view as well
+    firstRecord(&cursor, view);
+    while (nextRecord(&cursor, &fileinfo) && (cursor.segment != last || last->ndirs == 0))
+    {
+        if (strcmp(fileinfo.path, path) == 0) listed = listed || fileinfo.type == dir;
+        else if (isUnder(fileinfo.path, path))
+        {
+            listed = true;
+            if (fileinfo.type == dir) totals->typeCount[dir]++;
+            else
+            {
+                totals->files++;
+                totals->bytes += fileinfo.size;
+                if (fileinfo.type < TYPE_COUNT) totals->typeCount[fileinfo.type]++;
+            }
+        }
+    }
+    return listed;
+}
+void u_largerthan(const index_t* index, const char* buf, FILE* out)
+{
+    long x;
+    if ( (x = strtol(buf+11, NULL, 10)) < 0 ) fprintf(out, "You must enter a positive integer value for x.\n");
+    else if (x > 0)
+    {
+        listRecords(index, (void*)&x, 0, out);
+    }
+    else fprintf(out, "--Invalid command or arguments missing.\n");
+}
+void u_namepart(const index_t* index, const char* buf, FILE* out)
+{
+    int length;
+    bool fold = false;
+    char y[MAX_FILE];
+    matcher_t matcher;
+
+    // "-i" before the name part turns on case insensitive matching
+    if (memcmp(buf+9, "-i ", 3) == 0) 
+    {
+        fold = true;
+        buf += 3;
+    }
+    strcpy(y, buf+9);
+    length = strlen(y);
+    y[length-1] = '\0'; // get rid of the \n character
+
+    if (strlen(y) > MAX_FILE-1) 
+    {
+        fprintf(out, "Name part string exceeds maximum file length of %d characters.\n", MAX_FILE-1);
+    }
+    else if (strlen(y) > 0)
+    {
+        initMatcher(&matcher, y, fold);
+        listRecords(index, (void*)&matcher, 1, out);
+    }
+    else fprintf(out, "--Invalid command or arguments missing.\n");
+}
+void u_owner(const index_t* index, const char* buf, FILE* out)
+{
+    long uid;
+            
+    if ( (uid = strtol(buf+5, NULL, 10)) < 0 ) fprintf(out, "You must enter a positive integer value for x.\n");
+    else if (uid > 0)
+    {
+        listRecords(index, (void*)&uid, 2, out);
+    }
+    else fprintf(out, "--Invalid command or arguments missing.\n");
+}
+void u_query(const index_t* index, const char* buf, FILE* out) // compound query answered in one pass
+{
+    query_t* query;
+    qrecord_t record;
+    pager_t pager;
+    uint64_t *ids, count, n = index->header->count;
+    
+    if ((query = (query_t*) malloc(sizeof(query_t))) == NULL) ERR("malloc");
+    
+    if (!parseQuery(query, index, buf + 5))
+    {
+        fprintf(out, "--Invalid query: %s.\n", query->error);
+        free(query);
+        return;
+    }
+    planNode(query, query->root);
+    if (DEBUGMAIN) printPlan(query, query->root, 0);
+    
+    openPager(&pager, out);
+    firstRecord(&record.cursor, index);
+    record.damaged = false;
+    ids = pushdownQuery(query, &count);
+    
+    // a view without candidates is scanned, the columns of its parts are not numbered as its records
+    while (index->parts != NULL && ids == NULL && nextRecord(&record.cursor, &record.fileinfo))
+    {
+        record.id = record.cursor.first + record.cursor.next - 1;
+        record.decoded = true;
+        if (evalNode(query, query->root, &record)) pageRecord(&pager, &record.fileinfo);
+    }
+    
+    // records are visited in index order, a path is decoded only when a string predicate or the output needs it, of a view always
+    for (uint64_t k = 0; k < (ids != NULL ? count : n) && !record.damaged && (index->parts == NULL || ids != NULL); k++)
+    {
+        record.id = ids != NULL ? ids[k] : k;
+        record.decoded = false;
+        if (index->parts != NULL && !(record.decoded = seekRecord(&record.cursor, record.id, &record.fileinfo))) break;
+        if (!evalNode(query, query->root, &record)) continue;
+        if (!record.decoded && !(record.decoded = seekRecord(&record.cursor, record.id, &record.fileinfo))) break;
+        pageRecord(&pager, &record.fileinfo);
+    }
+    
+    closePager(&pager);
+    free(ids);
+    free(query);
+}
+int queryError(query_t* query, const char* what) // keeps the first error, returns -1
+{
+    if (query->error[0] != '\0') return -1;
+    
+    if (query->end) snprintf(query->error, sizeof(query->error), "%s at the end", what);
+    else snprintf(query->error, sizeof(query->error), "%s at \"%s\"", what, query->token);
+    return -1;
+}
+int newQnode(query_t* query, enum qkind kind) // -1 if the query has too many nodes
+{
+    if (query->count == QUERY_NODES) return queryError(query, "too many conditions");
+    
+    memset(&query->nodes[query->count], 0, sizeof(qnode_t));
+    query->nodes[query->count].kind = kind;
+    query->nodes[query->count].first = -1;
+    query->nodes[query->count].next = -1;
+    return query->count++;
+}
+void addOperand(query_t* query, int node, int operand) // operands of the same operator are merged into node
+{
+    int* last = &query->nodes[node].first;
+    
+    while (*last >= 0) last = &query->nodes[*last].next;
+    
+    // a and (b and c) is a and b and c, so the planner can order all three
+    if (query->nodes[operand].kind == query->nodes[node].kind) *last = query->nodes[operand].first;
+    else *last = operand;
+}
+bool nextToken(query_t* query) // reads the next token of the query, false at the end
+{
+    const char* p = query->p;
+    size_t length = 0;
+    
+    while (isspace((unsigned char) *p)) p++;
+    query->quoted = *p == '"';
+    
+    if (query->quoted) // quotes keep spaces and operators in a name or path
+    {
+        for (p++; *p != '\0' && *p != '"' && length < MAX_PATH - 1; ) query->token[length++] = *p++;
+        if (*p == '"') p++;
+    }
+    else if (*p == '(' || *p == ')') query->token[length++] = *p++;
+    else if (*p != '\0' && strchr("<>=!", *p))
+    {
+        while (*p != '\0' && strchr("<>=!", *p) && length < 2) query->token[length++] = *p++;
+    }
+    else
+    {
+        while (*p != '\0' && !isspace((unsigned char) *p) && !strchr("()<>=!\"", *p) && length < MAX_PATH - 1) query->token[length++] = *p++;
+    }
+    
+    query->token[length] = '\0';
+    query->p = p;
+    query->end = length == 0 && !query->quoted;
+    return !query->end;
+}
+bool isToken(const query_t* query, const char* keyword) // current token is keyword, in any case and without quotes
+{
+    return !query->quoted && strcasecmp(query->token, keyword) == 0;
+}
+int parseOr(query_t* query)
+{
+    int node, operand;
+    
+    if ((operand = parseAnd(query)) < 0 || !isToken(query, "or")) return operand;
+    if ((node = newQnode(query, QOR)) < 0) return -1;
+    addOperand(query, node, operand);
+    
+    while (isToken(query, "or"))
+    {
+        nextToken(query);
+        if ((operand = parseAnd(query)) < 0) return -1;
+        addOperand(query, node, operand);
+    }
+    
+    return node;
+}
+int parseAnd(query_t* query)
+{
+    int node, operand;
+    
+    // "and" may be left out, conditions written one after another must all be true
+    if ((operand = parseUnary(query)) < 0 || query->end || isToken(query, "or") || isToken(query, ")")) return operand;
+    if ((node = newQnode(query, QAND)) < 0) return -1;
+    addOperand(query, node, operand);
+    
+    while (!query->end && !isToken(query, "or") && !isToken(query, ")"))
+    {
+        if (isToken(query, "and")) nextToken(query);
+        if ((operand = parseUnary(query)) < 0) return -1;
+        addOperand(query, node, operand);
+    }
+    
+    return node;
+}
+int parseUnary(query_t* query)
+{
+    int node;
+    
+    if (isToken(query, "not"))
+    {
+        nextToken(query);
+        if ((node = newQnode(query, QNOT)) < 0 || (query->nodes[node].first = parseUnary(query)) < 0) return -1;
+        return node;
+    }
+    if (isToken(query, "("))
+    {
+        nextToken(query);
+        if ((node = parseOr(query)) < 0) return -1;
+        if (!isToken(query, ")")) return queryError(query, "missing )");
+        nextToken(query);
+        return node;
+    }
+    
+    return parsePredicate(query);
+}
+int parsePredicate(query_t* query)
+{
+    const char* fields[] = {"size", "owner", "type", "name", "iname", "path"};
+    const enum qkind kinds[] = {QSIZE, QOWNER, QTYPE, QNAME, QNAME, QPATH};
+    const char* ops[] = {"<", "<=", "=", "!=", ">=", ">"};
+    int field, op, node, predicate;
+    qnode_t* x;
+    char* end;
+    
+    for (field = 0; field < 6 && !isToken(query, fields[field]); field++);
+    if (field == 6) return queryError(query, query->end ? "condition missing" : "unknown condition");
+    nextToken(query);
+    
+    // the operator may be left out for equality, only sizes are ordered
+    for (op = 0; op < 6 && (query->quoted || strcmp(query->token, ops[op]) != 0); op++);
+    if (isToken(query, "==")) op = QEQ;
+    if (op < 6) nextToken(query);
+    else op = QEQ;
+    if (kinds[field] != QSIZE && op != QEQ && op != QNE) return queryError(query, "only = and != compare this value");
+    if (query->end) return queryError(query, "value missing");
+    
+    if ((predicate = node = newQnode(query, kinds[field])) < 0) return -1;
+    x = &query->nodes[node];
+    x->op = op;
+    
+    switch (x->kind)
+    {
+        case QSIZE:
+            if (!parseSize(query->token, &x->value)) return queryError(query, "size expected");
+            break;
+        case QOWNER:
+            errno = 0;
+            x->value = strtoul(query->token, &end, 10);
+            if (!isdigit((unsigned char) query->token[0]) || *end != '\0' || errno || x->value > UINT32_MAX) return queryError(query, "uid expected");
+            break;
+        case QTYPE:
+            for (x->value = 0; x->value < TYPE_COUNT && strcasecmp(query->token, typeNames[x->value]) != 0; x->value++);
+            if (x->value == TYPE_COUNT) return queryError(query, "unknown file type");
+            break;
+        case QNAME:
+            if (query->token[0] == '\0') return queryError(query, "name part expected");
+            if (strlen(query->token) > MAX_FILE - 1) return queryError(query, "name part too long");
+            initMatcher(&x->matcher, query->token, field == 4);
+            break;
+        default: // path, trailing slashes are dropped so that "/" is a prefix of every path
+        {
+            size_t length = strlen(query->token);
+            while (length > 0 && query->token[length - 1] == '/') length--;
+            if (query->textLength + length + 1 > QUERY_TEXT) return queryError(query, "query too long");
+            memcpy(query->text + query->textLength, query->token, length);
+            query->text[query->textLength + length] = '\0';
+            x->prefix = query->text + query->textLength;
+            query->textLength += length + 1;
+        }
+    }
+    nextToken(query);
+    
+    // != of the other fields is the negation of =
+    if (x->kind != QSIZE && op == QNE)
+    {
+        x->op = QEQ;
+        if ((node = newQnode(query, QNOT)) < 0) return -1;
+        query->nodes[node].first = predicate;
+    }
+    
+    return node;
+}
+bool parseSize(const char* text, uint64_t* size) // number with an optional K, M, G or T suffix
+{
+    const char* units = "KMGT";
+    const char* unit;
+    char* end;
+    
+    errno = 0;
+    *size = strtoull(text, &end, 10);
+    if (!isdigit((unsigned char) text[0]) || errno) return false;
+    if (*end == '\0') return true;
+    
+    // sizes are counted in 1024s, like formatSize() prints them
+    if ((unit = strchr(units, toupper((unsigned char) *end))) == NULL || end[1] != '\0') return false;
+    for (int i = 0; i <= unit - units; i++)
+    {
+        if (*size > UINT64_MAX / 1024) return false;
+        *size *= 1024;
+    }
+    return true;
+}
+bool parseQuery(query_t* query, const index_t* index, const char* text) // builds the query tree or sets query->error
+{
+    query->index = index;
+    query->count = 0;
+    query->textLength = 0;
+    query->error[0] = '\0';
+    query->pushed = -1;
+    query->p = text;
+    
+    nextToken(query);
+    if ((query->root = parseOr(query)) >= 0 && !query->end) queryError(query, "unexpected text");
+    
+    return query->error[0] == '\0';
+}
+bool compareSize(uint64_t size, enum qop op, uint64_t value)
+{
+    switch (op)
+    {
+        case QLT: return size < value;
+        case QLE: return size <= value;
+        case QEQ: return size == value;
+        case QNE: return size != value;
+        case QGE: return size >= value;
+        default : return size > value;
+    }
+}
+void planNode(query_t* query, int node) // estimates cost and selectivity, orders the operands of AND and OR
+{
+    qnode_t* x = &query->nodes[node];
+    const index_t* index = query->index;
+    uint64_t n = index->header->count;
+    int operands[QUERY_NODES], count = 0;
+    double reach = 1;
+    
+    switch (x->kind)
+    {
+        case QSIZE: // from an even sample of the size column, of a view the one of its largest part
+        {
+            const index_t* sampled = index;
+            for (int part = 0; index->parts != NULL && part < index->nparts; part++)
+                if (sampled == index || index->parts[part].header->count > sampled->header->count) sampled = &index->parts[part];
+            uint64_t step = sampled->header->count / QUERY_SAMPLE + 1, samples = 0, hits = 0;
+            for (uint64_t i = 0; i < sampled->header->count; i += step, samples++) hits += compareSize(sampled->sizes[i], x->op, x->value);
+            x->cost = COST_COLUMN;
+            x->selectivity = samples > 0 ? (double) hits / samples : 0;
+            break;
+        }
+        case QOWNER: // exact, from the owners in the summary
+        {
+            uint64_t lo = 0, hi = index->summary->owners;
+            while (lo < hi)
+            {
+                uint64_t mid = (lo + hi) / 2;
+                if (index->owners[mid].uid < x->value) lo = mid + 1;
+                else hi = mid;
+            }
+            x->cost = COST_COLUMN;
+            x->selectivity = lo < index->summary->owners && index->owners[lo].uid == x->value && n > 0 ? (double) index->owners[lo].count / n : 0;
+            break;
+        }
+        case QTYPE: // exact, from the type counts in the summary
+            x->cost = COST_COLUMN;
+            x->selectivity = n > 0 ? (double) index->summary->typeCount[x->value] / n : 0;
+            break;
+        case QNAME: // names are not counted anywhere, most name parts are rare
+            x->cost = COST_DECODE + COST_MATCH;
+            x->selectivity = x->matcher.length > 0 ? 0.05 : 1;
+            break;
+        case QPATH:
+            x->cost = COST_DECODE + COST_COLUMN;
+            x->selectivity = x->prefix[0] != '\0' ? 0.5 : 1;
+            break;
+        case QNOT:
+            planNode(query, x->first);
+            x->cost = query->nodes[x->first].cost;
+            x->selectivity = 1 - query->nodes[x->first].selectivity;
+            break;
+        default: // AND and OR
+            for (int operand = x->first; operand >= 0; operand = query->nodes[operand].next)
+            {
+                planNode(query, operand);
+                operands[count++] = operand;
+            }
+            
+            // for independent operands evaluation stops soonest in order of cost per record decided:
+            // AND is decided by a false operand, OR by a true one
+            for (int i = 1; i < count; i++)
+                for (int j = i; j > 0; j--)
+                {
+                    const qnode_t *a = &query->nodes[operands[j - 1]], *b = &query->nodes[operands[j]];
+                    double decidedA = x->kind == QAND ? 1 - a->selectivity : a->selectivity;
+                    double decidedB = x->kind == QAND ? 1 - b->selectivity : b->selectivity;
+                    if (a->cost * decidedB <= b->cost * decidedA) break;
+                    int swap = operands[j]; operands[j] = operands[j - 1]; operands[j - 1] = swap;
+                }
+            
+            x->first = count > 0 ? operands[0] : -1;
+            x->cost = 0;
+            for (int i = 0; i < count; i++)
+            {
+                qnode_t* operand = &query->nodes[operands[i]];
+                operand->next = i + 1 < count ? operands[i + 1] : -1;
+                x->cost += reach * operand->cost;
+                reach *= x->kind == QAND ? operand->selectivity : 1 - operand->selectivity;
+            }
+            x->selectivity = x->kind == QAND ? reach : 1 - reach;
+    }
+}
+void printPlan(const query_t* query, int node, int depth)
+{
+    const char* kinds[] = {"and", "or", "not", "size", "owner", "type", "name", "path"};
+    const char* ops[] = {"<", "<=", "=", "!=", ">=", ">"};
+    const qnode_t* x = &query->nodes[node];
+    
+    printf("[printPlan] %*s%s", 2 * depth, "", kinds[x->kind]);
+    if (x->kind == QSIZE) printf(" %s %lu", ops[x->op], x->value);
+    else if (x->kind == QOWNER) printf(" %lu", x->value);
+    else if (x->kind == QTYPE) printf(" %s", typeToText(x->value));
+    else if (x->kind == QNAME) printf(" %s%s", x->matcher.fold ? "-i " : "", x->matcher.part);
+    else if (x->kind == QPATH) printf(" %s", x->prefix);
+    printf(" (cost %.2f, selectivity %.3f)\n", x->cost, x->selectivity);
+    
+    for (int operand = x->first; operand >= 0; operand = query->nodes[operand].next) printPlan(query, operand, depth + 1);
+}
+uint64_t* pushdownQuery(query_t* query, uint64_t* count) // candidate records from a secondary index or the tree, NULL for a scan
+{
+    const qnode_t* root = &query->nodes[query->root];
+    uint64_t *best = NULL, *ids, found;
+    
+    query->pushed = -1;
+    
+    // every match of an AND matches each of its operands, so the shortest list of candidates of one will do
+    for (int node = root->kind == QAND ? root->first : query->root; node >= 0; node = root->kind == QAND ? query->nodes[node].next : -1)
+    {
+        const qnode_t* x = &query->nodes[node];
+        long value;
+        
+        if (x->kind == QSIZE && (x->op == QGT || (x->op == QGE && x->value > 0)) && x->value <= LONG_MAX)
+        {
+            value = x->op == QGT ? x->value : x->value - 1;
+            ids = lookupRecords(query->index, (void*)&value, 0, &found);
+        }
+        else if (x->kind == QOWNER)
+        {
+            value = x->value;
+            ids = lookupRecords(query->index, (void*)&value, 2, &found);
+        }
+        else if (x->kind == QNAME) ids = lookupRecords(query->index, (void*)&x->matcher, 1, &found);
+        else if (x->kind == QPATH) ids = subtreeRecords(query->index, x->prefix, &found);
+        else continue;
+        
+        if (ids == NULL) continue; // no secondary index or too many candidates to beat a scan
+        if (best == NULL || found < *count)
+        {
+            free(best);
+            best = ids;
+            *count = found;
+            query->pushed = x->kind == QPATH ? node : -1;
+        }
+        else free(ids);
+    }
+    
+    if (DEBUGMAIN && best != NULL) printf("[pushdownQuery] %lu candidates from a secondary index\n", *count);
+    return best;
+}
+uint64_t* subtreeRecords(const index_t* index, const char* path, uint64_t* count) // records at path and below, NULL if it is not a directory
+{
+    const idir_t *d, *last;
+    uint64_t* ids;
+    int64_t found;
+    
+    if ((found = findDirectory(index, path)) < 0) return NULL;
+    
+    // the subtree's directories are numbered consecutively, and so are their children
+    d = &index->dirs[found];
+    last = &index->dirs[found + d->descendants];
+    *count = last->firstChild + last->children - d->firstChild;
+    if ((ids = (uint64_t*) malloc((*count + 1) * sizeof(uint64_t))) == NULL) ERR("malloc");
+    memcpy(ids, index->children + d->firstChild, *count * sizeof(uint64_t));
+    if (d->id != INDEX_NODIR) ids[(*count)++] = d->id; // the directory itself is at path too
+    
+    // sorted, so that the records are decoded moving forward
+    qsort(ids, *count, sizeof(uint64_t), compareIds);
+    return ids;
+}
+bool evalNode(const query_t* query, int node, qrecord_t* record)
+{
+    const qnode_t* x = &query->nodes[node];
+    const index_t* index = query->index;
+    
+    switch (x->kind)
+    {
+        case QAND:
+            for (int operand = x->first; operand >= 0; operand = query->nodes[operand].next)
+                if (!evalNode(query, operand, record)) return false;
+            return true;
+        case QOR:
+            for (int operand = x->first; operand >= 0; operand = query->nodes[operand].next)
+                if (evalNode(query, operand, record)) return true;
+            return false;
+        case QNOT:
+            return !evalNode(query, x->first, record) && !record->damaged;
+        case QSIZE: // a view has no columns, its records are always decoded
+            return compareSize(record->decoded ? record->fileinfo.size : index->sizes[record->id], x->op, x->value);
+        case QOWNER:
+            return (record->decoded ? record->fileinfo.uid : index->uids[record->id]) == x->value;
+        case QTYPE:
+            return (record->decoded ? record->fileinfo.type : index->types[record->id]) == x->value;
+        default: // string predicates need the path, records are decoded forward from the closest restart point
+            if (node == query->pushed) return true;
+            if (!record->decoded && !(record->decoded = seekRecord(&record->cursor, record->id, &record->fileinfo)))
+            {
+                record->damaged = true;
+                return false;
+            }
+            if (x->kind == QNAME) return kernels.match(&x->matcher, record->fileinfo.name, record->fileinfo.nameLength);
+            return isUnder(record->fileinfo.path, x->prefix);
+    }
+}
+void u_top(const index_t* index, const char* buf, FILE* out) // largest files, from a bounded heap
+{
+    icursor_t cursor;
+    finfo_t fileinfo;
+    pager_t pager;
+    xsize_t* largest;
+    uint64_t count;
+    long k;
+    char* end;
+    
+    k = strtol(buf + 4, &end, 10);
+    while (isspace((unsigned char) *end)) end++;
+    if (strncmp(end, "by size", 7) == 0) end += 7;
+    while (isspace((unsigned char) *end)) end++;
+    if (k <= 0 || *end != '\0' || end == buf + 4)
+    {
+        fprintf(out, "--Invalid command or arguments missing.\n");
+        return;
+    }
+    if (k > index->header->count) k = index->header->count;
+    
+    if ((largest = (xsize_t*) malloc(k * sizeof(xsize_t) + 1)) == NULL) ERR("malloc");
+    count = largestRecords(index, k, largest);
+    
+    // only the records printed are decoded, each from its restart point
+    openPager(&pager, out);
+    firstRecord(&cursor, index);
+    for (uint64_t i = 0; i < count; i++)
+        if (seekRecord(&cursor, largest[i].id, &fileinfo)) pageRecord(&pager, &fileinfo);
+    closePager(&pager);
+    
+    free(largest);
+}
+void u_sum(const index_t* index, const char* buf, FILE* out) // file sizes totalled by owner, type or directory
+{
+    const char* groupings[] = {"owner", "type", "dir"};
+    aggregate_t table = {0};
+    icursor_t cursor;
+    finfo_t fileinfo;
+    uint64_t files = 0, bytes = 0, count = 0, first = 0;
+    int by;
+    char text[16], dirpath[MAX_PATH];
+    
+    for (by = 0; by < 3; by++)
+        if (strncmp(buf + 4, "size by ", 8) == 0 && strncmp(buf + 12, groupings[by], strlen(groupings[by])) == 0 && strcmp(buf + 12 + strlen(groupings[by]), "\n") == 0) break;
+    if (by == 3)
+    {
+        fprintf(out, "--Invalid command or arguments missing.\n");
+        return;
+    }
+    
+    // sizes of directories themselves are not counted, as in du
+    if (by < 2) // the columns are enough, no record is decoded, a view has them in each of its parts
+    {
+        for (int part = 0; part < (index->parts != NULL ? index->nparts : 1); part++)
+        {
+            const index_t* segment = index->parts != NULL ? &index->parts[part] : index;
+            for (uint64_t id = 0; id < segment->header->count; id++)
+            {
+                if (segment->types[id] == dir || isHidden(index, first + id)) continue;
+                agroup_t* group = findGroup(&table, by == 0 ? segment->uids[id] : segment->types[id], NULL, 0);
+                group->count++;
+                group->bytes += segment->sizes[id];
+            }
+            first += segment->header->count;
+        }
+    }
+    else // files are grouped by the path of their directory
+    {
+        firstRecord(&cursor, index);
+        while (nextRecord(&cursor, &fileinfo))
+        {
+            if (fileinfo.type == dir) continue;
+            size_t length = fileinfo.name > fileinfo.path ? fileinfo.name - fileinfo.path - 1 : 0;
+            memcpy(dirpath, fileinfo.path, length);
+            dirpath[length] = '\0';
+            agroup_t* group = findGroup(&table, hashPath(dirpath), dirpath, length);
+            group->count++;
+            group->bytes += fileinfo.size;
+        }
+    }
+    
+    // groups are packed to the front of the table and printed largest first
+    for (uint64_t i = 0; i < table.cap; i++)
+        if (table.slots[i].count > 0) table.slots[count++] = table.slots[i];
+    if (count > 0) qsort(table.slots, count, sizeof(agroup_t), compareGroups); // an empty table has no slots
+    
+    fprintf(out, "  %12s %14s  %s\n", "count", "bytes", groupings[by]);
+    for (uint64_t i = 0; i < count; i++)
+    {
+        agroup_t* group = &table.slots[i];
+        if (by == 0) fprintf(out, "  %12lu %14lu  %lu\n", group->count, group->bytes, group->key);
+        else if (by == 1) fprintf(out, "  %12lu %14lu  %s\n", group->count, group->bytes, typeToText(group->key));
+        else fprintf(out, "  %12lu %14lu  %s\n", group->count, group->bytes, group->name[0] ? group->name : "/");
+        files += group->count;
+        bytes += group->bytes;
+        free(group->name);
+    }
+    fprintf(out, "--Total size: %lu bytes (%s) in %lu files and %lu groups\n", bytes, formatSize(bytes, text), files, count);
+    
+    free(table.slots);
+}
+void u_histogram(const index_t* index, const char* buf, FILE* out) // file sizes in power of 2 buckets
+{
+    uint64_t counts[HISTOGRAM_BUCKETS] = {0}, bytes[HISTOGRAM_BUCKETS] = {0};
+    uint64_t most = 0, offset = 0;
+    int first = HISTOGRAM_BUCKETS, last = -1;
+    char from[16], to[16];
+    
+    if (strcmp(buf + 10, "size\n") != 0)
+    {
+        fprintf(out, "--Invalid command or arguments missing.\n");
+        return;
+    }
+    
+    // bucket b holds the sizes of b significant bits, [2^(b-1), 2^b), bucket 0 the empty files
+    for (int part = 0; part < (index->parts != NULL ? index->nparts : 1); part++) // a view has the columns in each of its parts
+    {
+        const index_t* segment = index->parts != NULL ? &index->parts[part] : index;
+        for (uint64_t id = 0; id < segment->header->count; id++)
+        {
+            if (segment->types[id] == dir || isHidden(index, offset + id)) continue;
+            int b = segment->sizes[id] == 0 ? 0 : 64 - __builtin_clzll(segment->sizes[id]);
+            counts[b]++;
+            bytes[b] += segment->sizes[id];
+        }
+        offset += segment->header->count;
+    }
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++)
+    {
+        if (counts[b] == 0) continue;
+        if (b < first) first = b;
+        last = b;
+        if (counts[b] > most) most = counts[b];
+    }
+    
+    fprintf(out, "  %-10s %-10s %12s %14s\n", "from", "to", "count", "bytes");
+    for (int b = first; b <= last; b++)
+    {
+        int bar = (counts[b] * HISTOGRAM_BAR + most - 1) / most;
+        formatSize(b == 0 ? 0 : 1UL << (b - 1), from);
+        if (b < 64) formatSize(1UL << b, to);
+        else strcpy(to, "-");
+        fprintf(out, "  %-10s %-10s %12lu %14lu  %.*s\n", from, to, counts[b], bytes[b], bar, "########################################");
+    }
+    if (last < 0) fprintf(out, "No records match the query criteria.\n");
+}
+void siftDown(xsize_t* heap, uint64_t n, uint64_t i) // restores the min-heap below i
+{
+    for (uint64_t child; (child = 2 * i + 1) < n; i = child)
+    {
+        if (child + 1 < n && compareSizes(&heap[child + 1], &heap[child]) < 0) child++;
+        if (compareSizes(&heap[i], &heap[child]) <= 0) break;
+        xsize_t swap = heap[i]; heap[i] = heap[child]; heap[child] = swap;
+    }
+}
+void keepLargest(xsize_t* heap, uint64_t* count, uint64_t k, xsize_t x) // min-heap of the k largest, the smallest of them at the root to be replaced
+{
+    if (*count < k)
+    {
+        uint64_t i = (*count)++;
+        heap[i] = x;
+        for (; i > 0 && compareSizes(&heap[i], &heap[(i - 1) / 2]) < 0; i = (i - 1) / 2)
+        {
+            xsize_t swap = heap[i]; heap[i] = heap[(i - 1) / 2]; heap[(i - 1) / 2] = swap;
+        }
+    }
+    else if (compareSizes(&x, &heap[0]) > 0)
+    {
+        heap[0] = x;
+        siftDown(heap, *count, 0);
+    }
+}
+uint64_t largestRecords(const index_t* index, uint64_t k, xsize_t* largest) // k largest files in descending order, returns their number
+{
+    const index_t* last = index->parts != NULL ? &index->parts[index->nparts - 1] : index;
+    uint64_t n = last->header->count, count = 0, first = 0;
+    const xheader_t* header = (const xheader_t*) last->secondary[XSIZE].base;
+    bool sorted = header != NULL && header->count == n && last->secondary[XSIZE].length == sizeof(xheader_t) + 2 * n * sizeof(uint64_t);
+    
+    // the size index is sorted already, the largest files are at its end
+    if (sorted && index->parts == NULL)
+    {
+        const uint64_t* sizes = (const uint64_t*) (header + 1);
+        const uint64_t* ids = sizes + n;
+        for (uint64_t i = n; i > 0 && count < k; i--)
+            if (ids[i - 1] < n && index->types[ids[i - 1]] != dir) largest[count++] = (xsize_t){sizes[i - 1], ids[i - 1]};
+        return count;
+    }
+    
+    // otherwise a min-heap keeps the k largest seen so far, from the columns of each part of a view
+    for (int part = 0; part < (index->parts != NULL ? index->nparts : 1); part++)
+    {
+        const index_t* segment = index->parts != NULL ? &index->parts[part] : index;
+        if (segment == last && sorted) break;
+        for (uint64_t id = 0; id < segment->header->count; id++)
+            if (segment->types[id] != dir && !isHidden(index, first + id)) keepLargest(largest, &count, k, (xsize_t){segment->sizes[id], first + id});
+        first += segment->header->count;
+    }
+    
+    // of the last part of a view only the largest of its size index that are not hidden can make it
+    if (sorted)
+    {
+        const uint64_t* sizes = (const uint64_t*) (header + 1);
+        const uint64_t* ids = sizes + n;
+        for (uint64_t i = n, taken = 0; i > 0 && taken < k; i--)
+            if (ids[i - 1] < n && last->types[ids[i - 1]] != dir && !isHidden(index, first + ids[i - 1]))
+            {
+                keepLargest(largest, &count, k, (xsize_t){sizes[i - 1], first + ids[i - 1]});
+                taken++;
+            }
+    }
+    
+    // taking the root out each time leaves the heap sorted from the largest
+    for (uint64_t i = count; i > 1; i--)
+    {
+        xsize_t root = largest[0];
+        largest[0] = largest[i - 1];
+        siftDown(largest, i - 1, 0);
+        largest[i - 1] = root;
+    }
+    return count;
+}
+agroup_t* findGroup(aggregate_t* table, uint64_t key, const char* name, size_t length) // inserts if missing
+{
+    uint64_t i;
+    
+    if (2 * table->used >= table->cap) // keep table at most half full
+    {
+        agroup_t* old = table->slots;
+        uint64_t oldcap = table->cap;
+        
+        table->cap = oldcap ? 2 * oldcap : 64;
+        if ((table->slots = (agroup_t*) calloc(table->cap, sizeof(agroup_t))) == NULL) ERR("calloc");
+        for (uint64_t j = 0; j < oldcap; j++)
+        {
+            if (old[j].count == 0) continue;
+            for (i = old[j].key & (table->cap - 1); table->slots[i].count != 0; i = (i + 1) & (table->cap - 1));
+            table->slots[i] = old[j];
+        }
+        free(old);
+    }
+    
+    // keys of directories are hashes, their paths tell colliding ones apart
+    for (i = key & (table->cap - 1); table->slots[i].count != 0; i = (i + 1) & (table->cap - 1))
+        if (table->slots[i].key == key && (name == NULL || (strlen(table->slots[i].name) == length && memcmp(table->slots[i].name, name, length) == 0))) return &table->slots[i];
+    
+    table->slots[i].key = key;
+    if (name != NULL && (table->slots[i].name = strndup(name, length)) == NULL) ERR("strndup");
+    table->used++;
+    return &table->slots[i];
+}
+int compareGroups(const void* a, const void* b)
+{
+    const agroup_t *x = (const agroup_t*) a, *y = (const agroup_t*) b;
+    
+    if (x->bytes != y->bytes) return x->bytes > y->bytes ? -1 : 1;
+    if (x->name != NULL) return strcmp(x->name, y->name);
+    return (x->key > y->key) - (x->key < y->key);
+}
+bool isQuery(const char* buf) // checks if buf is a command answered from the index
+{
+    const char* queries[] = {"count\n", "count ", "stats\n", "du\n", "du ", "listall\n", "largerthan ", "namepart ", "owner ", "query ", "query\n", "top ", "sum ", "histogram "};
+    
+    // any of them can be answered from the indexing in progress too, once
+    if (strncmp(buf, "partial ", 8) == 0) buf += 8;
+    for (int i = 0; i < sizeof(queries) / sizeof(queries[0]); i++)
+        if (strncmp(buf, queries[i], strlen(queries[i])) == 0) return true;
+    return false;
+}
+void runQuery(const index_t* index, const char* buf, FILE* out) // answers a command accepted by isQuery()
+{
+    if (memcmp(buf, "partial ", 8) == 0)
+    {
+        partialQuery(index, buf + 8, out);
+    }
+    else if (memcmp(buf, "count\n", 6) == 0 || memcmp(buf, "count ", 6) == 0)
+    {
+        u_count(index, buf, out);
+    }
+    else if (memcmp(buf, "stats\n", 6) == 0)
+    {
+        u_stats(index, out);
+    }
+    else if (memcmp(buf, "du\n", 3) == 0 || memcmp(buf, "du ", 3) == 0)
+    {
+        u_du(index, buf, out);
+    }
+    else if (memcmp(buf, "listall\n", 8) == 0)
+    {
+        listRecords(index, NULL, -1, out);            
+    }
+    else if (memcmp(buf, "largerthan ", 11) == 0)
+    {
+        u_largerthan(index, buf, out);
+    }
+    else if (memcmp(buf, "namepart ", 9) == 0)
+    {
+        u_namepart(index, buf, out);
+    }
+    else if (memcmp(buf, "owner ", 6) == 0)
+    {
+        u_owner(index, buf, out);
+    }
+    else if (memcmp(buf, "query", 5) == 0)
+    {
+        u_query(index, buf, out);
+    }
+    else if (memcmp(buf, "top ", 4) == 0)
+    {
+        u_top(index, buf, out);
+    }
+    else if (memcmp(buf, "sum ", 4) == 0)
+    {
+        u_sum(index, buf, out);
+    }
+    else if (memcmp(buf, "histogram ", 10) == 0)
+    {
+        u_histogram(index, buf, out);
+    }
+}
+void publishProgress(const char* pathf) // lets partial queries read the records written so far, NULL once the build is over
+{
+    // only the serializer writes the temp files, so after the flush they hold exactly the records counted
+    if (pathf != NULL)
+    {
+        flushWriter(&tempfile);
+        for (int column = 0; column < WCOLUMNS; column++) flushWriter(&indexWriter.columns[column]);
     }
     
-    if (DEBUGTHREAD) printf("[threadWork] Ending thread.\n");
-    return NULL;
+    pthread_mutex_lock(&buildProgress.mx);
+    buildProgress.pathf = pathf;
+    buildProgress.count = indexWriter.count;
+    buildProgress.offset = indexWriter.offset;
+    pthread_mutex_unlock(&buildProgress.mx);
+    buildProgress.published = time(NULL); // read by the serializer only
 }
-void u_index(thread_t* threadArgs)
+void waitReaders(void) // returns once no partial query maps the temp files, before they are truncated
 {
-    int mxStatus = 0;
-            // check if there's an indexing operation currently in progress
-            if ( (mxStatus = pthread_mutex_trylock(threadArgs->pmxIndexer) ) == EBUSY)
-            {
-                printf ("--There's already an indexing process running...\n");
-                return;
-            }
-            else if ( mxStatus == 0 )
-            {
-                if(threadArgs->t == 0)  // perodic indexing disabled: there's no active thread
-                {
-                    // create a thread for indexing
-                    threadArgs->newIndex = 2;
-                    if (DEBUGMAIN) printf("[main] Creating new thread to start indexing...\n");
-                    if (pthread_create(&threadArgs->tid, NULL, threadWork, threadArgs)) ERR("pthread_create");
-                }
-                else // periodic indexing enabled: there's an active thread
-                {
-                    // send SIGUSR1 to active thread to start indexing
-                    if (DEBUGMAIN) printf("[main] Sending SIGUSR1 to thread to start indexing...\n");
-                    pthread_kill(threadArgs->tid, SIGUSR1);
-                }
-                
-                pthread_mutex_unlock(threadArgs->pmxIndexer);
-            }
-            else ERR("pthread_mutex_lock");
+    // partial queries only take long when paged, and an exit! waits for the indexer to stop
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_mutex_lock(&buildProgress.mx);
+    while (buildProgress.readers > 0) pthread_cond_wait(&buildProgress.idle, &buildProgress.mx);
+    pthread_mutex_unlock(&buildProgress.mx);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 }
-void u_count(const char* pathf)
+const void* mapTemp(const char* path, size_t length) // first length bytes of a temp file read-only, MAP_FAILED if it is gone
 {
-    int indexFile, state, dir = 0, jpg = 0, png = 0, gzip = 0, zip = 0;
+    void* base = NULL;
+    int fd;
+    
+    if ((fd = open(path, O_RDONLY)) < 0) return MAP_FAILED;
+    if (length > 0 && (base = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) ERR("mmap");
+    if (close(fd)) ERR("close");
+    return base;
+}
+bool readPartial(index_t* partial) // maps the records published by the build in progress, false if nothing is being built
+{
+    iheader_t* header;
+    const void* maps[4];
+    uint64_t count, offset;
+    const char* pathf;
+    
+    memset(partial, 0, sizeof(index_t));
+    pthread_mutex_lock(&buildProgress.mx);
+    if ((pathf = buildProgress.pathf) != NULL) buildProgress.readers++;
+    count = buildProgress.count;
+    offset = buildProgress.offset;
+    pthread_mutex_unlock(&buildProgress.mx);
+    if (pathf == NULL) return false;
+    
+    // the serializer only appends to the temp files, so what was published stays as it is while mapped,
+    // unless the build finished meanwhile and renamed or removed them
+    maps[0] = mapTemp("./.temp", sizeof(iheader_t) + offset);
+    maps[1] = mapTemp(columnTemps[WSIZES], count * sizeof(uint64_t));
+    maps[2] = mapTemp(columnTemps[WUIDS], count * sizeof(uint32_t));
+    maps[3] = mapTemp(columnTemps[WTYPES], count * sizeof(uint8_t));
+    if ((header = (iheader_t*) calloc(1, sizeof(iheader_t))) == NULL) ERR("calloc");
+    header->count = count;
+    
+    // enough of an index for a cursor, its restart points are found by buildView()
+    partial->pathf = pathf;
+    partial->base = (unsigned char*) maps[0];
+    partial->length = sizeof(iheader_t) + offset;
+    partial->header = header;
+    partial->records = partial->base + sizeof(iheader_t);
+    partial->end = partial->records + offset;
+    partial->sizes = maps[1];
+    partial->uids = maps[2];
+    partial->types = maps[3];
+    
+    if (maps[0] == MAP_FAILED || maps[1] == MAP_FAILED || maps[2] == MAP_FAILED || maps[3] == MAP_FAILED)
+    {
+        releasePartial(partial);
+        return false;
+    }
+    return true;
+}
+void releasePartial(index_t* partial)
+{
+    uint64_t count = partial->header->count;
+    
+    if (partial->base != MAP_FAILED && munmap(partial->base, partial->length)) ERR("munmap");
+    if (count > 0 && partial->sizes != MAP_FAILED && munmap((void*) partial->sizes, count * sizeof(uint64_t))) ERR("munmap");
+    if (count > 0 && partial->uids != MAP_FAILED && munmap((void*) partial->uids, count * sizeof(uint32_t))) ERR("munmap");
+    if (count > 0 && partial->types != MAP_FAILED && munmap((void*) partial->types, count * sizeof(uint8_t))) ERR("munmap");
+    free((void*) partial->header);
+    free((void*) partial->restarts);
+    memset(partial, 0, sizeof(index_t));
+    
+    pthread_mutex_lock(&buildProgress.mx);
+    if (--buildProgress.readers == 0) pthread_cond_broadcast(&buildProgress.idle);
+    pthread_mutex_unlock(&buildProgress.mx);
+}
+void tallyRecord(isummary_t* summary, aggregate_t* owners, const finfo_t* fileinfo) // adds a record to the summary of a view
+{
+    agroup_t* owner = findGroup(owners, fileinfo->uid, NULL, 0);
+    
+    owner->count++;
+    owner->bytes += fileinfo->size;
+    if (fileinfo->type < TYPE_COUNT)
+    {
+        summary->typeCount[fileinfo->type]++;
+        summary->typeBytes[fileinfo->type] += fileinfo->size;
+    }
+}
+void buildView(index_t* view, index_t* parts, int nparts, const index_t* old) // records of the build parts[0], then those of the previous index old, in the other parts, it has not written again
+{
+    icursor_t cursor;
     finfo_t fileinfo;
-    memset(&fileinfo, 0, sizeof(finfo_t));
-
-    if ( (indexFile = open(pathf, O_RDONLY)) < 0 ) ERR("open");
-
-    while( (state = read(indexFile, &fileinfo, sizeof(finfo_t))) > 0 )
+    isummary_t tally = {0}, *summary;
+    aggregate_t owners = {0};
+    iheader_t* header;
+    iowner_t* sorted;
+    uint64_t *seen, *restarts, *hidden = NULL, capseen = 64, visible = 0, nowners = 0, total = 0, first = parts[0].header->count, hash;
+    
+    // paths of the build are only kept as hashes, two different ones sharing a hash would hide a record of the previous index
+    while (capseen < 2 * parts[0].header->count) capseen *= 2;
+    if ((seen = (uint64_t*) calloc(capseen, sizeof(uint64_t))) == NULL) ERR("calloc");
+    if ((restarts = (uint64_t*) malloc((parts[0].header->count / INDEX_RESTART + 1) * sizeof(uint64_t))) == NULL) ERR("malloc");
+    
+    // the build restarts its front coding every INDEX_RESTART records, as any index file
+    for (firstRecord(&cursor, &parts[0]);; visible++)
+    {
+        if (cursor.next % INDEX_RESTART == 0) restarts[cursor.next / INDEX_RESTART] = cursor.p - parts[0].records;
+        if (!nextRecord(&cursor, &fileinfo)) break;
+        hash = hashPath(fileinfo.path) | 1; // 0 is an empty slot
+        uint64_t i = hash & (capseen - 1);
+        while (seen[i] != 0 && seen[i] != hash) i = (i + 1) & (capseen - 1);
+        seen[i] = hash;
+        tallyRecord(&tally, &owners, &fileinfo);
+    }
+    parts[0].restarts = restarts;
+    
+    // files the build has not reached yet are still listed as the previous index has them, deleted ones too until then
+    if (old != NULL)
     {
-        switch (fileinfo.type)
+        for (int part = 0; part < nparts; part++) total += parts[part].header->count;
+        if ((hidden = (uint64_t*) calloc(total / 64 + 1, sizeof(uint64_t))) == NULL) ERR("calloc");
+        firstRecord(&cursor, old);
+        while (nextRecord(&cursor, &fileinfo))
         {
-            case 0:
-                dir++;
-                break;
-            case 1:
-                jpg++;
-                break;
-            case 2:
-                png++;
-                break;
-            case 3:
-                gzip++;
-                break;
-            case 4:
-                zip++;
-                break;
-            default:
-                break;
+            uint64_t i, id = first + cursor.first + cursor.next - 1;
+            hash = hashPath(fileinfo.path) | 1;
+            for (i = hash & (capseen - 1); seen[i] != 0 && seen[i] != hash; i = (i + 1) & (capseen - 1));
+            if (seen[i] == hash) hidden[id / 64] |= 1UL << (id % 64);
+            else
+            {
+                tallyRecord(&tally, &owners, &fileinfo);
+                visible++;
+            }
         }
+        
+        // records of the index its delta hides stay hidden
+        for (uint64_t w = 0; old->hidden != NULL && w <= (total - first) / 64; w++)
+            for (uint64_t word = old->hidden[w], id; word != 0; word &= word - 1)
+            {
+                id = first + w * 64 + __builtin_ctzll(word);
+                hidden[id / 64] |= 1UL << (id % 64);
+            }
     }
-    if (state < 0) ERR("read");
-
-    if (close(indexFile)) ERR("close");
-
-    printf("--Files count: dir:%d, jpg:%d, png:%d, gzip:%d, zip: %d\n", dir, jpg, png, gzip, zip);
+    free(seen);
+    
+    // owners sorted by uid follow the summary, as in an index file
+    if ((summary = (isummary_t*) malloc(sizeof(isummary_t) + owners.used * sizeof(iowner_t))) == NULL) ERR("malloc");
+    sorted = (iowner_t*) (summary + 1);
+    for (uint64_t i = 0; i < owners.cap; i++)
+        if (owners.slots[i].count > 0) sorted[nowners++] = (iowner_t){owners.slots[i].key, 0, owners.slots[i].count, owners.slots[i].bytes};
+    qsort(sorted, nowners, sizeof(iowner_t), compareOwners);
+    free(owners.slots);
+    tally.created = time(NULL);
+    tally.owners = nowners;
+    memcpy(summary, &tally, sizeof(isummary_t));
+    
+    // directories and secondary indexes are those of the previous index, commands look them up in its part
+    pthread_once(&kernelsOnce, initKernels); // as for a mapped index
+    if ((header = (iheader_t*) calloc(1, sizeof(iheader_t))) == NULL) ERR("calloc");
+    header->count = visible;
+    memset(view, 0, sizeof(index_t));
+    view->pathf = old != NULL ? old->pathf : parts[0].pathf;
+    view->length = parts[0].length + (old != NULL ? old->length : 0);
+    view->header = header;
+    view->summary = summary;
+    view->owners = sorted;
+    view->parts = parts;
+    view->nparts = nparts;
+    view->hidden = hidden;
 }
-void u_largerthan(const char* pathf, const char* buf)
+void deltaView(index_t* view, index_t* parts) // records of the delta parts[0], then those of the index parts[1] it does not hide
 {
-    long x;
-    if ( (x = strtol(buf+11, NULL, 10)) < 0 ) printf("You must enter a positive integer value for x.\n");
-    else if (x > 0)
+    const ibase_t* base = (const ibase_t*) (parts[0].base + parts[0].header->sections[SEC_BASE].offset);
+    const uint64_t* ids = (const uint64_t*) (parts[0].base + parts[0].header->sections[SEC_HIDDEN].offset);
+    const iowner_t *added = parts[0].owners, *kept = parts[1].owners;
+    uint64_t first = parts[0].header->count, *hidden, nadded = parts[0].summary->owners, nkept = parts[1].summary->owners, nremoved = 0, nowners = 0;
+    aggregate_t table = {0};
+    isummary_t* summary;
+    iowner_t *owners, *removed;
+    iheader_t* header;
+    
+    if ((hidden = (uint64_t*) calloc((first + parts[1].header->count) / 64 + 1, sizeof(uint64_t))) == NULL) ERR("calloc");
+    if ((summary = (isummary_t*) malloc(sizeof(isummary_t) + (nadded + nkept) * sizeof(iowner_t))) == NULL) ERR("malloc");
+    owners = (iowner_t*) (summary + 1);
+    
+    // the summary of the index less its hidden records, taken from its columns, and that of the delta
+    memcpy(summary, parts[1].summary, sizeof(isummary_t));
+    for (uint64_t k = 0; k < base->hidden; k++)
     {
-        listRecords(pathf, (void*)&x, 0);
+        uint64_t id = ids[k];
+        agroup_t* owner = findGroup(&table, parts[1].uids[id], NULL, 0);
+        
+        hidden[(first + id) / 64] |= 1UL << ((first + id) % 64);
+        owner->count++;
+        owner->bytes += parts[1].sizes[id];
+        if (parts[1].types[id] < TYPE_COUNT)
+        {
+            summary->typeCount[parts[1].types[id]]--;
+            summary->typeBytes[parts[1].types[id]] -= parts[1].sizes[id];
+        }
     }
-    else printf("--Invalid command or arguments missing.\n");
-}
-void u_namepart(const char* pathf, const char* buf)
-{
-    int length;
-    char y[MAX_FILE];
-    strcpy(y, buf+9);
-    length = strlen(y);
-    y[length-1] = '\0'; // get rid of the \n character
-
-    if (strlen(y) > MAX_FILE-1) 
+    for (int type = 0; type < TYPE_COUNT; type++)
     {
-        printf("Name part string exceeds maximum file length of %d characters.\n", MAX_FILE-1);
+        summary->typeCount[type] += parts[0].summary->typeCount[type];
+        summary->typeBytes[type] += parts[0].summary->typeBytes[type];
     }
-    else if (strlen(y) > 0)
+    
+    // owners of both are sorted by uid and merged, those of the index less what it lost, owners left with no records are dropped
+    if ((removed = (iowner_t*) malloc((table.used + 1) * sizeof(iowner_t))) == NULL) ERR("malloc");
+    for (uint64_t i = 0; i < table.cap; i++)
+        if (table.slots[i].count > 0) removed[nremoved++] = (iowner_t){table.slots[i].key, 0, table.slots[i].count, table.slots[i].bytes};
+    qsort(removed, nremoved, sizeof(iowner_t), compareOwners);
+    free(table.slots);
+    for (uint64_t i = 0, j = 0, r = 0; i < nadded || j < nkept; )
     {
-        listRecords(pathf, (void*)&y, 1);
+        iowner_t owner;
+        if (j == nkept || (i < nadded && added[i].uid < kept[j].uid)) owner = added[i++];
+        else
+        {
+            owner = kept[j++];
+            if (i < nadded && added[i].uid == owner.uid)
+            {
+                owner.count += added[i].count;
+                owner.bytes += added[i++].bytes;
+            }
+            while (r < nremoved && removed[r].uid < owner.uid) r++;
+            if (r < nremoved && removed[r].uid == owner.uid)
+            {
+                owner.count -= removed[r].count;
+                owner.bytes -= removed[r].bytes;
+            }
+        }
+        if (owner.count > 0) owners[nowners++] = owner;
     }
-    else printf("--Invalid command or arguments missing.\n");
+    free(removed);
+    summary->created = parts[0].summary->created;
+    summary->owners = nowners;
+    
+    // directories and secondary indexes are those of the index, commands look them up in its part
+    if ((header = (iheader_t*) calloc(1, sizeof(iheader_t))) == NULL) ERR("calloc");
+    header->count = first + parts[1].header->count - base->hidden;
+    memset(view, 0, sizeof(index_t));
+    view->pathf = parts[1].pathf;
+    view->length = parts[0].length + parts[1].length;
+    view->header = header;
+    view->summary = summary;
+    view->owners = owners;
+    view->parts = parts;
+    view->nparts = 2;
+    view->hidden = hidden;
 }
-void u_owner(const char* pathf, const char* buf)
+void freeView(index_t* view)
 {
-    long uid;
-            
-    if ( (uid = strtol(buf+5, NULL, 10)) < 0 ) printf("You must enter a positive integer value for x.\n");
-    else if (uid > 0)
+    free((void*) view->header);
+    free((void*) view->summary);
+    free((void*) view->hidden);
+    memset(view, 0, sizeof(index_t));
+}
+void partialQuery(const index_t* old, const char* buf, FILE* out) // answers buf from the build in progress merged with old, which may be NULL
+{
+    index_t parts[3], view; // the build, then the index and its delta at most
+    int nparts = 1;
+    
+    if (!readPartial(&parts[0]))
     {
-        listRecords(pathf, (void*)&uid, 2);
+        // nothing is being built, so the index is as complete as it gets
+        if (old != NULL) runQuery(old, buf, out);
+        else fprintf(out, "--No index and no indexing in progress.\n");
+        return;
     }
-    else printf("--Invalid command or arguments missing.\n");
+    
+    // the previous index is read in place, the view only numbers its records after those of the build
+    if (old != NULL && old->parts != NULL)
+        for (int part = 0; part < old->nparts; part++) parts[nparts++] = old->parts[part];
+    else if (old != NULL) parts[nparts++] = *old;
+    buildView(&view, parts, nparts, old);
+    fprintf(out, "--Partial results: %lu records of the indexing in progress, %lu more from the previous index.\n", parts[0].header->count, view.header->count - parts[0].header->count);
+    runQuery(&view, buf, out);
+    
+    freeView(&view);
+    releasePartial(&parts[0]);
 }
 bool queryTest(finfo_t* fileinfo, void* value, int option)
 {
@@ -561,66 +6441,340 @@ bool queryTest(finfo_t* fileinfo, void* value, int option)
     {
         case -1: return true;                                       // listall
         case 0 : return fileinfo->size > *(long*)value;             // largerthan
-        case 1 : return isSubstring((char*)value, fileinfo->name);  // namepart
+        case 1 : return kernels.match((matcher_t*)value, fileinfo->name, fileinfo->nameLength); // namepart
         case 2 : return fileinfo->uid == *(int*)value;              // owner
     }
     
     ERR("Wrong option number passed to tests from getUserInput ");
 }
-void listRecords(const char* pathf, void* value, int option)
+uint64_t* selectRecords(const index_t* index, void* value, int option) // bitmap of records matching a column predicate
 {
-    int indexFile, state, count = 0;
-    char* pager;
-    FILE* stream = stdout;
-    finfo_t fileinfo;
-    memset(&fileinfo, 0, sizeof(finfo_t));
+    uint64_t* bitmap;
+    uint64_t n = index->header->count;
     
-    if ((indexFile = open(pathf, O_RDONLY)) < 0) ERR("open");
-
-    // count how many records meet the query requirements
-    while((state = read(indexFile, &fileinfo, sizeof(finfo_t))) > 0)
+    if ((bitmap = (uint64_t*) calloc(n / 64 + 1, sizeof(uint64_t))) == NULL) ERR("calloc");
+    
+    switch (option)
     {
-        if (queryTest(&fileinfo, value, option)) count++;
-        if (count >= 3) break;
+        case 0: // largerthan
+            kernels.greater64(index->sizes, n, *(long*)value, bitmap);
+            break;
+        case 2: // owner
+            if (*(long*)value <= UINT32_MAX) kernels.equal32(index->uids, n, *(long*)value, bitmap);
+            break;
+        default:
+            ERR("Wrong option number passed to selectRecords ");
     }
-
+    
+    return bitmap;
+}
+void openPager(pager_t* pager, FILE* out)
+{
+    memset(pager, 0, sizeof(pager_t));
+    pager->out = out;
+    pager->stream = out;
+    
+    // on the terminal first records are held back until it is known whether there are enough of them for the pager
+    if (out == stdout && (pager->stream = pager->hold = open_memstream(&pager->held, &pager->heldLength)) == NULL) ERR("open_memstream");
+}
+void pageRecord(pager_t* pager, const finfo_t* fileinfo) // switches to $PAGER at the third record on stdout
+{
+    char* command;
+    
     // if more than 2 records and $PAGER env. variable is set, change stream to $PAGER
-    if (count >= 3 && (pager = getenv("PAGER")) != NULL )
+    if (++pager->count == 3 && pager->hold != NULL)
     {
-        if ( (stream = popen(pager, "w")) == NULL )
+        pager->stream = stdout;
+        if ((command = getenv("PAGER")) != NULL && (pager->stream = popen(command, "w")) == NULL)
         {
             printf("WARNING! The $PAGER variable is invalid. Pagination disabled.\n");
-            stream = stdout;
-        }        
+            pager->stream = stdout;
+        }
+        if (fclose(pager->hold)) ERR("fclose");
+        fwrite(pager->held, 1, pager->heldLength, pager->stream);
     }
     
-    // move file descriptor offset to the beginning
-    lseek(indexFile, 0, SEEK_SET);    
-
-    //print to stream    
-    while((state = read(indexFile, &fileinfo, sizeof(finfo_t))) > 0)
+    fprintf(pager->stream, "File path: %s\n", fileinfo->path);
+    fprintf(pager->stream, "File size: %lu bytes\n", fileinfo->size);
+    fprintf(pager->stream, "File type: %s\n\n", typeToText(fileinfo->type));
+}
+void closePager(pager_t* pager)
+{
+    if (pager->hold != NULL && pager->count < 3) // less than 3 records, print them directly
     {
-        if (queryTest(&fileinfo, value, option))
-        {
-            fprintf(stream, "File path: %s\n", fileinfo.path);
-            fprintf(stream, "File size: %lu bytes\n", fileinfo.size);
-            fprintf(stream, "File type: %s\n\n", typeToText(fileinfo.type));
-        }
+        if (fclose(pager->hold)) ERR("fclose");
+        fwrite(pager->held, 1, pager->heldLength, stdout);
     }
-    if (state < 0) ERR("read");
+    free(pager->held);
 
-    if (close(indexFile)) ERR("close");
-    if (stream != stdout && pclose(stream) != 0) 
+    if (pager->stream != pager->out && pager->stream != pager->hold && pclose(pager->stream) != 0) 
     {
         if (errno != EPIPE) ERR("pclose"); // ignore broken pipe error
     }
 
-    if (count == 0) printf("No records match the query criteria.\n");
+    if (pager->count == 0) fprintf(pager->out, "No records match the query criteria.\n");
+}
+void listRecords(const index_t* index, void* value, int option, FILE* out)
+{
+    icursor_t cursor;
+    finfo_t fileinfo;
+    pager_t pager;
+    uint64_t *bitmap, *ids, count;
+    
+    openPager(&pager, out);
+    firstRecord(&cursor, index);
+
+    if (option >= 0 && (ids = lookupRecords(index, value, option, &count)) != NULL)
+    {
+        // secondary index gives the candidate records directly, each is checked once decoded
+        for (uint64_t i = 0; i < count; i++)
+            if (seekRecord(&cursor, ids[i], &fileinfo) && queryTest(&fileinfo, value, option)) pageRecord(&pager, &fileinfo);
+        free(ids);
+    }
+    else if ((option == 0 || option == 2) && index->parts == NULL) // numeric predicates are evaluated on the columns, only matches are decoded
+    {
+        bitmap = selectRecords(index, value, option);
+        for (uint64_t w = 0; w <= index->header->count / 64; w++)
+            for (uint64_t word = bitmap[w]; word != 0; word &= word - 1)
+                if (seekRecord(&cursor, w * 64 + __builtin_ctzll(word), &fileinfo)) pageRecord(&pager, &fileinfo);
+        free(bitmap);
+    }
+    else // print to stream in one pass over the mapped records
+    {
+        while (nextRecord(&cursor, &fileinfo))
+            if (queryTest(&fileinfo, value, option)) pageRecord(&pager, &fileinfo);
+    }
+
+    closePager(&pager);
+}
+snapshot_t* loadSnapshot(const char* pathf) // maps index with its secondary indexes and delta, NULL if not readable
+{
+    snapshot_t* snapshot;
+    
+    if ((snapshot = (snapshot_t*) malloc(sizeof(snapshot_t))) == NULL) ERR("malloc");
+    
+    // pages are read in ahead, the snapshot stays mapped for many queries
+    if (!mapCurrent(&snapshot->index, pathf, MADV_WILLNEED))
+    {
+        free(snapshot);
+        return NULL;
+    }
+    snapshot->next = NULL;
+    
+    return snapshot;
+}
+void freeSnapshot(snapshot_t* snapshot)
+{
+    unmapIndex(&snapshot->index);
+    free(snapshot);
+}
+void publishSnapshot(const char* pathf) // replaces the snapshot served to clients by the new index
+{
+    snapshot_t *snapshot, *old;
+    
+    if (!__atomic_load_n(&server.running, __ATOMIC_SEQ_CST)) return;
+    
+    snapshot = loadSnapshot(pathf);
+    old = __atomic_exchange_n(&server.current, snapshot, __ATOMIC_SEQ_CST);
+    
+    // readers that got the old snapshot before the swap keep it until they are done
+    if (old != NULL)
+    {
+        pthread_mutex_lock(&server.mxRetired);
+        old->next = server.retired;
+        server.retired = old;
+        pthread_mutex_unlock(&server.mxRetired);
+    }
+    reclaimSnapshots();
+    
+    if (DEBUGSERVER) printf("[publishSnapshot] Serving %lu records.\n", snapshot ? snapshot->index.header->count : 0);
+}
+snapshot_t* acquireSnapshot(int id) // protects the current snapshot with hazard slot id
+{
+    snapshot_t* snapshot;
+    
+    // snapshot is safe once it is in the hazard slot and still current afterwards
+    do
+    {
+        snapshot = __atomic_load_n(&server.current, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&server.hazards[id], snapshot, __ATOMIC_SEQ_CST);
+    } while (snapshot != __atomic_load_n(&server.current, __ATOMIC_SEQ_CST));
+    
+    return snapshot;
+}
+void releaseSnapshot(int id)
+{
+    __atomic_store_n(&server.hazards[id], NULL, __ATOMIC_SEQ_CST);
+}
+void reclaimSnapshots(void) // frees retired snapshots no worker is reading
+{
+    pthread_mutex_lock(&server.mxRetired);
+    
+    for (snapshot_t** p = &server.retired; *p != NULL; )
+    {
+        bool used = false;
+        for (int id = 0; id < SERVER_THREADS; id++)
+            if (__atomic_load_n(&server.hazards[id], __ATOMIC_SEQ_CST) == *p) used = true;
+        
+        if (used) 
+        {
+            p = &(*p)->next;
+            continue;
+        }
+        snapshot_t* snapshot = *p;
+        *p = snapshot->next;
+        freeSnapshot(snapshot);
+    }
+    
+    pthread_mutex_unlock(&server.mxRetired);
+}
+void closeClient(void* voidClient) // also cleanup function for cancelled workers
+{
+    client_t* client = (client_t*) voidClient;
+    
+    releaseSnapshot(client->id);
+    free(client->line);
+    if (client->in != NULL) fclose(client->in);
+    if (client->out != NULL) fclose(client->out);
+    client->line = NULL;
+    client->in = client->out = NULL;
+}
+void serveClient(client_t* client) // answers request lines until the client disconnects
+{
+    size_t cap = 0;
+    ssize_t length;
+    snapshot_t* snapshot;
+    
+    // every request is a command line as typed interactively, the response ends with a line holding a single dot
+    while ((length = getline(&client->line, &cap, client->in)) > 0)
+    {
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        
+        while (length > 0 && (client->line[length-1] == '\n' || client->line[length-1] == '\r')) length--;
+        client->line[length] = '\0';
+        
+        if (length + 1 >= SERVER_LINE) fprintf(client->out, "--Command too long.\n");
+        else
+        {
+            char buf[SERVER_LINE];
+            uint64_t start = nowNs();
+            snprintf(buf, SERVER_LINE, "%s\n", client->line);
+            
+            if (!isQuery(buf)) fprintf(client->out, "--Invalid command or arguments missing.\n");
+            else if ((snapshot = acquireSnapshot(client->id)) != NULL) runQuery(&snapshot->index, buf, client->out);
+            else if (memcmp(buf, "partial ", 8) == 0) runQuery(NULL, buf, client->out); // only the indexing in progress
+            else fprintf(client->out, "--Index is not available.\n");
+            releaseSnapshot(client->id);
+            if (isQuery(buf)) recordQuery(buf, start);
+        }
+        
+        fprintf(client->out, ".\n");
+        if (fflush(client->out) == EOF) 
+        {
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            break; // client went away
+        }
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    }
+}
+void* serveWork(void* voidId)
+{
+    client_t client = {(int)(intptr_t) voidId, NULL, NULL, NULL};
+    int fd;
+    
+    while ((fd = accept(server.fd, NULL, NULL)) >= 0 || errno == EINTR || errno == ECONNABORTED)
+    {
+        if (fd < 0) continue;
+        
+        if ((client.in = fdopen(fd, "r")) == NULL) ERR("fdopen");
+        if ((fd = dup(fd)) < 0 || (client.out = fdopen(fd, "w")) == NULL) ERR("fdopen");
+        
+        pthread_cleanup_push(closeClient, &client);
+        if (DEBUGSERVER) printf("[serveWork] Worker %d serving a client.\n", client.id);
+        serveClient(&client);
+        pthread_cleanup_pop(1);
+    }
+    
+    // accept() fails once the listening socket is shut down
+    return NULL;
+}
+void startServer(thread_t* threadArgs)
+{
+    struct sockaddr_un address;
+    struct stat s;
+    sigset_t all, old;
+    
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(threadArgs->socket) >= sizeof(address.sun_path)) 
+    {
+        fprintf(stderr, "Socket path \"%s\" is too long.\n", threadArgs->socket);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, threadArgs->socket);
+    
+    // a socket left by a previous server is replaced, any other file is not
+    if (lstat(threadArgs->socket, &s) == 0 && S_ISSOCK(s.st_mode) && unlink(threadArgs->socket)) ERR("unlink");
+    
+    if ((server.fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) ERR("socket");
+    if (bind(server.fd, (struct sockaddr*) &address, sizeof(address))) ERR("bind");
+    if (chmod(threadArgs->socket, 0600)) ERR("chmod");
+    if (listen(server.fd, SOMAXCONN)) ERR("listen");
+    
+    server.path = threadArgs->socket;
+    server.retired = NULL;
+    if (pthread_mutex_init(&server.mxRetired, NULL)) ERR("Couldn't initialize mutex!");
+    __atomic_store_n(&server.running, true, __ATOMIC_SEQ_CST);
+    publishSnapshot(threadArgs->pathf);
+    
+    // workers never handle signals, they are left to the main and indexer threads
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (int id = 0; id < SERVER_THREADS; id++)
+        if (pthread_create(&server.tids[id], NULL, serveWork, (void*)(intptr_t) id)) ERR("pthread_create");
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    
+    printf("--Serving queries on \"%s\".\n", server.path);
+}
+void stopServer(void)
+{
+    snapshot_t* snapshot;
+    
+    __atomic_store_n(&server.running, false, __ATOMIC_SEQ_CST);
+    
+    // wakes workers waiting in accept(), those waiting for a client's next request are cancelled
+    if (shutdown(server.fd, SHUT_RDWR) && errno != ENOTCONN) ERR("shutdown");
+    for (int id = 0; id < SERVER_THREADS; id++) pthread_cancel(server.tids[id]);
+    for (int id = 0; id < SERVER_THREADS; id++)
+        if (pthread_join(server.tids[id], NULL)) ERR("Can't join with server thread");
+    if (close(server.fd)) ERR("close");
+    unlink(server.path);
+    
+    if ((snapshot = __atomic_exchange_n(&server.current, NULL, __ATOMIC_SEQ_CST)) != NULL) freeSnapshot(snapshot);
+    reclaimSnapshots();
+    pthread_mutex_destroy(&server.mxRetired);
+}
+void serveQueries(thread_t* threadArgs) // server mode main loop, until SIGINT or SIGTERM
+{
+    sigset_t mask;
+    int sigNo = 0;
+    
+    startServer(threadArgs);
+    
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    while (sigNo != SIGINT && sigNo != SIGTERM) sigwait(&mask, &sigNo);
+    
+    // same as "exit", the indexer finishes first so it cannot publish into a stopped server
+    threadArgs->exitFlag = 1;
+    if (threadArgs->tid > 0) pthread_kill(threadArgs->tid, SIGUSR2);
 }
 void initialization(thread_t* threadArgs, int argc, char** argv)
 {
-    int t = 0;
-    char *pathd, *pathf, *home; 
+    int t = 0, j = 1;
+    bool w = false;
+    char *pathd, *pathf, *home, *socket = NULL; 
     
     // initialize pathf=$HOME/.mole_index (to be modified in readArgs() if necessary)
     if ( (home = getenv("HOME")) == NULL ) ERR("$HOME environment variable is NOT defined!!!");
@@ -629,13 +6783,20 @@ void initialization(thread_t* threadArgs, int argc, char** argv)
     pathf = threadArgs->tempBuffer;  // free'd in exit_sequence()
     
     // initialize command line arguments & check index file status
-    readArgs(argc, argv, &pathd, &pathf, &t);
+    readArgs(argc, argv, &pathd, &pathf, &t, &j, &w, &socket, &memoryBudget);
     
     // check if an old index file exists
     int indexStatus = -1;
     struct stat* indexStat;
     if ( (indexStat = (struct stat*) malloc(sizeof(struct stat))) == NULL ) ERR ("malloc"); // free'd in exit_sequence()
     indexStatus = lstat(pathf, indexStat);
+    
+    // an index that cannot be read is treated as missing and built again
+    if (indexStatus == 0 && !verifyIndex(pathf))
+    {
+        indexStatus = -1;
+        errno = ENOENT;
+    }
 
     // initialize signal mask
     sigset_t* mask;
@@ -646,6 +6807,11 @@ void initialization(thread_t* threadArgs, int argc, char** argv)
     sigaddset(mask, SIGUSR2);  // "exit" signal for indexer thread
     sigaddset(mask, SIGALRM);  // "periodic index" signal for indexer thread
     sigaddset(mask, SIGPIPE);  // to ignore the EPIPE error in pclose()
+    if (socket != NULL)
+    {
+        sigaddset(mask, SIGINT);   // "exit" signals for the server
+        sigaddset(mask, SIGTERM);
+    }
     pthread_sigmask(SIG_BLOCK, mask, NULL);
 
     // initialize mutex
@@ -659,27 +6825,37 @@ void initialization(thread_t* threadArgs, int argc, char** argv)
     threadArgs->pathd = pathd;
     threadArgs->pathf = pathf;
     threadArgs->t = t;
+    threadArgs->j = j;
+    threadArgs->watch = w;
+    threadArgs->socket = socket;
     threadArgs->newIndex = indexStatus ? 1 : 0;
+    if (threadArgs->newIndex == 0 && access(CHECKPOINT_FILE, F_OK) == 0) threadArgs->newIndex = 3; // interrupted indexing is finished first
     threadArgs->pIndexStat = indexStat;
     threadArgs->pMask = mask;
     threadArgs->pmxIndexer = mxIndexer;
     threadArgs->exitFlag = 0;
+    
+    // metrics are written for the whole run, the thread inherits the blocked signals
+    if (pthread_create(&threadArgs->metricsTid, NULL, metricsWork, threadArgs)) ERR("pthread_create");
 
     printf("\nStarting **mole**.\n");
 }
 void startupIndexing(thread_t* threadArgs)
 {
-    if (threadArgs->newIndex == 0 && threadArgs->t == 0) // startup indexing IS NOT necessary
+    if (threadArgs->newIndex == 0 && threadArgs->t == 0 && !threadArgs->watch) // startup indexing IS NOT necessary
     {
         printf("--Index file \"%s\" exists.\n--Periodic indexing disabled.\n", threadArgs->pathf);
     }
-    else if (threadArgs->newIndex == 0 || errno == ENOENT) // startup indexing IS necessary: create indexer thread
+    else if (threadArgs->newIndex == 0 || threadArgs->newIndex == 3 || errno == ENOENT) // startup indexing IS necessary: create indexer thread
     {
         // display informative messages for user
         if (threadArgs->newIndex == 0) printf("--Index file \"%s\" exists.\n", threadArgs->pathf);
+        else if (threadArgs->newIndex == 3) printf("--Index file \"%s\" exists, an interrupted indexing is resumed.\n", threadArgs->pathf);
+        else if (access(threadArgs->pathf, F_OK) == 0) printf("--Index file \"%s\" is damaged or of an older format. \n", threadArgs->pathf);
         else printf("--Index file \"%s\" does not exist. \n", threadArgs->pathf);
         if (threadArgs->t == 0) printf("--Periodic indexing disabled.\n");
         else printf("--Periodic indexing enabled. t = %d seconds\n", threadArgs->t);
+        if (threadArgs->watch) printf("--Watching \"%s\" for changes.\n", threadArgs->pathd);
     
         // create thread
         if (pthread_create(&threadArgs->tid, NULL, threadWork, threadArgs)) ERR("pthread_create");
@@ -689,6 +6865,9 @@ void startupIndexing(thread_t* threadArgs)
 }
 void getUserInput(thread_t* threadArgs)
 {    
+    bool startup = threadArgs->newIndex == 1; // indexer thread sends SIGUSR1 once the first index is written
+    int sigNo = 0;
+    
     // wait for user input until exited
     while(true) 
     {
@@ -716,25 +6895,34 @@ void getUserInput(thread_t* threadArgs)
         {
             u_index(threadArgs);
         }
-        else if (memcmp(buf, "count\n", 6) == 0)
-        {
-            u_count(threadArgs->pathf);
-        }
-        else if (memcmp(buf, "listall\n", 8) == 0)
+        else if (isQuery(buf))
         {
-            listRecords(threadArgs->pathf, NULL, -1);            
-        }
-        else if (memcmp(buf, "largerthan ", 11) == 0)
-        {
-            u_largerthan(threadArgs->pathf, buf);
-        }
-        else if (memcmp(buf, "namepart ", 9) == 0)
-        {
-            u_namepart(threadArgs->pathf, buf);
-        }
-        else if (memcmp(buf, "owner ", 6) == 0)
-        {
-            u_owner(threadArgs->pathf, buf);
+            index_t index;
+            uint64_t start;
+            bool partial = memcmp(buf, "partial ", 8) == 0, mapped;
+            sigset_t pending;
+            
+            // until the start-up indexing is finished there is no index to open, a file there is the damaged or older one it replaces
+            if (startup && (!partial || (sigpending(&pending) == 0 && sigismember(&pending, SIGUSR1))))
+            {
+                while (sigNo != SIGUSR1) sigwait(threadArgs->pMask, &sigNo);
+                startup = false;
+            }
+            start = nowNs(); // mapping the index is part of answering
+            if (partial)
+            {
+                // without an index that maps, only the indexing in progress is answered from
+                mapped = !startup && mapCurrent(&index, threadArgs->pathf, MADV_SEQUENTIAL);
+                runQuery(mapped ? &index : NULL, buf, stdout);
+                if (mapped) unmapIndex(&index);
+                recordQuery(buf, start);
+            }
+            else if (openIndex(&index, threadArgs->pathf, MADV_SEQUENTIAL))
+            {
+                runQuery(&index, buf, stdout);
+                unmapIndex(&index);
+                recordQuery(buf, start);
+            }
         }
         else if (memcmp(buf, "help\n", 5) == 0)
         {
@@ -745,17 +6933,24 @@ void getUserInput(thread_t* threadArgs)
 }
 void exitSequence(thread_t* threadArgs)
 {
-    free(threadArgs->pMask);
-    free(threadArgs->pmxIndexer);
-    free(threadArgs->pIndexStat);
-    free(threadArgs->tempBuffer);
-
     if (DEBUGMAIN && threadArgs->tid) printf("[main] Waiting to join with indexing thread.\n");
     
     // if there was an active thread check for its termination
     if (threadArgs->tid && pthread_join(threadArgs->tid, NULL)) ERR("Can't join with indexer thread");
     else if (DEBUGMAIN && threadArgs->tid != 0) printf("[main] Joined with indexer thread.\n");
     else if (DEBUGMAIN && threadArgs->tid == 0) printf("[main] There's no indexer thread to join.\n");
+    if (threadArgs->socket != NULL) stopServer();
+    
+    // last write has the counters of the whole run
+    pthread_cancel(threadArgs->metricsTid);
+    if (pthread_join(threadArgs->metricsTid, NULL)) ERR("Can't join with metrics thread");
+    writeMetrics(threadArgs->pathf);
+
+    // free only after the indexer thread is gone, it may still be using these
+    free(threadArgs->pMask);
+    free(threadArgs->pmxIndexer);
+    free(threadArgs->pIndexStat);
+    free(threadArgs->tempBuffer);
 
     printf("Ending **mole**.\n");
 }
\ No newline at end of file